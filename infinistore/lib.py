@@ -1,7 +1,7 @@
 from . import _infinistore
 import torch
 import os
-from typing import List, Tuple
+from typing import List, Optional, Tuple, Union
 import subprocess
 import time
 import re
@@ -74,6 +74,9 @@ class ClientConfig(_infinistore.ClientConfig):
         self.host_addr = kwargs.get("host_addr", None)
         self.dev_name = kwargs.get("dev_name", "")
         self.service_port = kwargs.get("service_port", None)
+        # keys of the connection live in this namespace, "" is the default one. Other
+        # namespaces are created on the server's control plane first
+        self.namespace = kwargs.get("namespace", "")
         # get log from system env
         # if log level is not set in Config and system env is not set either, use warning as default
         if "INFINISTORE_LOG_LEVEL" in os.environ:
@@ -85,6 +88,7 @@ class ClientConfig(_infinistore.ClientConfig):
         return (
             f"ServerConfig(service_port={self.service_port}, "
             f"log_level='{self.log_level}', host_addr='{self.host_addr}', "
+            f"namespace='{self.namespace}', "
             f"connection_type='{self.connection_type.name}')"
         )
 
@@ -107,11 +111,38 @@ class ServerConfig(_infinistore.ServerConfig):
         self.log_level = kwargs.get("log_level", "warning")
         self.dev_name = kwargs.get("dev_name", "")
         self.prealloc_size = kwargs.get("prealloc_size", 16)
+        # 0 keeps the pool at prealloc_size
+        self.max_size = kwargs.get("max_size", 0)
+        # huge page size in MB: 2 or 1024. 0 disables huge pages
+        self.hugepage_size = kwargs.get("hugepage_size", 0)
+        # NUMA nodes to spread the pool over, the RDMA device's node is always used
+        self.numa_nodes = kwargs.get("numa_nodes", [])
+        # "cuda" serves local GPU and RDMA clients, "host" needs no GPU and
+        # serves RDMA clients only
+        self.memory_backend = kwargs.get("memory_backend", "cuda")
+        # what to drop when the pool is full: "lru", "clock", "s3fifo" or "none"
+        self.eviction_policy = kwargs.get("eviction_policy", "none")
+        # chain block keys into a tree: correct prefix matching, sequences dropped at once
+        self.prefix_index = kwargs.get("prefix_index", False)
+        # TinyLFU: once the pool is full, writes whose keys are read less often
+        # than what they would evict are declined
+        self.admission = kwargs.get("admission", False)
+        # values with the same bytes share one block
+        self.dedup = kwargs.get("dedup", False)
+        # list of (block_size in KB, share of prealloc_size in percent)
+        self.size_classes = [
+            _size_class(block_size, share)
+            for block_size, share in kwargs.get("size_classes", [(32, 100)])
+        ]
 
     def __repr__(self):
+        classes = ",".join(f"{c.block_size}K:{c.share}%" for c in self.size_classes)
         return (
             f"ServerConfig(service_port={self.service_port}, manage_port={self.manage_port}, "
-            f"log_level='{self.log_level}')"
+            f"log_level='{self.log_level}', size_classes='{classes}', "
+            f"memory_backend='{self.memory_backend}', "
+            f"eviction_policy='{self.eviction_policy}', prefix_index={self.prefix_index}, "
+            f"admission={self.admission}, dedup={self.dedup})"
         )
 
     def verify(self):
@@ -121,6 +152,42 @@ class ServerConfig(_infinistore.ServerConfig):
             raise Exception("Manage port is 0")
         if self.log_level not in ["error", "debug", "info", "warning"]:
             raise Exception("log level should be error, debug, info or warning")
+        if self.max_size != 0 and self.max_size < self.prealloc_size:
+            raise Exception("Max size should not be less than prealloc size")
+        if self.hugepage_size not in [0, 2, 1024]:
+            raise Exception("huge page size should be 0, 2 or 1024")
+        if self.memory_backend not in ["cuda", "host"]:
+            raise Exception("memory backend should be cuda or host")
+        if self.eviction_policy not in ["lru", "clock", "s3fifo", "none"]:
+            raise Exception("eviction policy should be lru, clock, s3fifo or none")
+        if self.admission and self.eviction_policy == "none":
+            raise Exception("admission control needs an eviction policy")
+        if not self.size_classes:
+            raise Exception("At least one size class is required")
+        if sum(c.share for c in self.size_classes) != 100:
+            raise Exception("Size class shares should add up to 100")
+        for c in self.size_classes:
+            if c.block_size <= 0 or c.block_size & (c.block_size - 1) != 0:
+                raise Exception("Size class block size should be a power of 2")
+
+
+def _size_class(block_size, share):
+    c = _infinistore.SizeClassConfig()
+    c.block_size = block_size
+    c.share = share
+    return c
+
+
+def parse_size_classes(spec: str):
+    """
+    Parses a size class spec like "16:25,32:50,2048:25" into a list of
+    (block_size in KB, share in percent).
+    """
+    classes = []
+    for item in spec.split(","):
+        block_size, share = item.split(":")
+        classes.append((int(block_size), int(share)))
+    return classes
 
 
 class Logger:
@@ -206,9 +273,10 @@ def _check_rdma_devices_ibv():
         )
 
 
-def check_supported():
-    # check if kernel module nv_peer_mem is available
-    if (
+def check_supported(gpu=True):
+    # check if kernel module nv_peer_mem is available, a server without GPU
+    # only needs RDMA
+    if gpu and (
         "nv_peer_mem" not in _kernel_modules()
         and "nvidia_peermem" not in _kernel_modules()  # noqa: W503
     ):
@@ -274,7 +342,14 @@ class InfinityConnection:
             self.rdma_connected = True
 
     def write_cache(
-        self, cache: torch.Tensor, blocks: List[Tuple[str, int]], page_size: int
+        self,
+        cache: torch.Tensor,
+        blocks: List[Tuple],
+        page_size: Optional[int],
+        pinned: bool = False,
+        parent: Optional[Union[str, bytes]] = None,
+        ttl: Optional[float] = None,
+        if_absent: bool = False,
     ):
         """
         Writes the given cache tensor to the specified blocks in memory.
@@ -282,39 +357,96 @@ class InfinityConnection:
         Args:
             cache (torch.Tensor): The tensor containing the data to be written.
             blocks (List[Tuple[str, int]]): A list of tuples where each tuple contains a key and an offset.
+            A key is a str or bytes; when all keys are 16 bytes, e.g. 128-bit digests, they are sent packed.
             each pair represents a page to be written to. The page is fixed size and is specified by the page_size parameter.
+            If page_size is None, each tuple is (key, offset, size) and every value has its own size, RDMA only.
             page_size (int): How many element in one page.
+            pinned (bool): The values are never evicted, e.g. a shared system prompt.
+            parent: Chain the blocks in the server's prefix index: the first block follows
+            parent ("" for the start of a sequence), every next block the one before.
+            None: the blocks are not chained.
+            ttl (float): Seconds after which the values expire, None: never.
+            if_absent (bool): Keys the server already stores keep their value and their
+            blocks are not transferred, e.g. a shared prefix other writers may have stored
+            first. A key is stored as soon as the server answered its write, the other
+            writer's data may still be in flight until it syncs: do not read a present
+            key in the hope that it is complete.
+
+        Returns:
+            bool: False if the server's admission control declined the write, nothing was
+            transferred then. True otherwise.
+            With if_absent, a list instead: one bool per block, True if the server already
+            stored the key and the block was not transferred. None if the write was declined.
         """
+        chain = parent is not None
+        parent = parent or ""
+        ttl_ms = 0 if ttl is None else max(1, int(ttl * 1000))
         self._verify(cache)
         ptr = cache.data_ptr()
         element_size = cache.element_size()
 
+        if page_size is None:
+            torch.cuda.synchronize()
+            ret, present = self._rw_rdma_varlen(
+                self.OP_RDMA_WRITE,
+                cache,
+                blocks,
+                pinned,
+                chain,
+                parent,
+                ttl_ms,
+                if_absent,
+            )
+            return self._write_result(ret, present, if_absent)
+
         # each offset should multiply by the element size
         blocks_in_bytes = [(key, offset * element_size) for key, offset in blocks]
 
         torch.cuda.synchronize()
         if self.local_connected:
-            ret = _infinistore.rw_local(
-                self.conn, self.OP_W, blocks_in_bytes, page_size * element_size, ptr
+            ret, present = _infinistore.rw_local(
+                self.conn,
+                self.OP_W,
+                blocks_in_bytes,
+                page_size * element_size,
+                ptr,
+                pinned,
+                chain,
+                parent,
+                ttl_ms,
+                if_absent,
             )
             if ret < 0:
                 raise Exception(f"Failed to write to infinistore, ret = {ret}")
+            return self._write_result(ret, present, if_absent)
         elif self.rdma_connected:
-            ret = _infinistore.rw_rdma(
+            ret, present = _infinistore.rw_rdma(
                 self.conn,
                 self.OP_RDMA_WRITE,
                 blocks_in_bytes,
                 page_size * element_size,
                 ptr,
                 cache.numel() * element_size,
+                pinned,
+                chain,
+                parent,
+                ttl_ms,
+                if_absent,
             )
             if ret < 0:
                 raise Exception(f"Failed to write to infinistore, ret = {ret}")
+            return self._write_result(ret, present, if_absent)
         else:
             raise Exception("Not connected to any instance")
 
+    def _write_result(self, ret, present: List[bool], if_absent: bool):
+        admitted = ret != _infinistore.WRITE_NOT_ADMITTED
+        if not if_absent:
+            return admitted
+        return present if admitted else None
+
     def read_cache(
-        self, cache: torch.Tensor, blocks: List[Tuple[str, int]], page_size: int
+        self, cache: torch.Tensor, blocks: List[Tuple], page_size: Optional[int]
     ):
         """
         Reads data from the cache using either local or RDMA connection.
@@ -322,7 +454,9 @@ class InfinityConnection:
         Args:
             cache (torch.Tensor): The tensor containing the cache data.
             blocks (List[Tuple[str, int]]): A list of tuples where each tuple contains a key and an offset.
+            A key is a str or bytes; when all keys are 16 bytes, e.g. 128-bit digests, they are sent packed.
             each pair represents a page to be written to. The page is fixed size and is specified by the page_size parameter.
+            If page_size is None, each tuple is (key, offset, size) and size is the room for the value, RDMA only.
             page_size (int): The size of the page to read.
 
         Raises:
@@ -331,28 +465,82 @@ class InfinityConnection:
         self._verify(cache)
         ptr = cache.data_ptr()
         element_size = cache.element_size()
+
+        if page_size is None:
+            self._rw_rdma_varlen(
+                self.OP_RDMA_READ, cache, blocks, False, False, "", 0, False
+            )
+            return
         # each offset should multiply by the element size
         blocks_in_bytes = [(key, offset * element_size) for key, offset in blocks]
         if self.local_connected:
-            ret = _infinistore.rw_local(
-                self.conn, self.OP_R, blocks_in_bytes, page_size * element_size, ptr
+            ret, _ = _infinistore.rw_local(
+                self.conn,
+                self.OP_R,
+                blocks_in_bytes,
+                page_size * element_size,
+                ptr,
+                False,
+                False,
+                "",
+                0,
+                False,
             )
             if ret < 0:
                 raise Exception(f"Failed to read to infinistore, ret = {ret}")
         elif self.rdma_connected:
-            ret = _infinistore.rw_rdma(
+            ret, _ = _infinistore.rw_rdma(
                 self.conn,
                 self.OP_RDMA_READ,
                 blocks_in_bytes,
                 page_size * element_size,
                 ptr,
                 cache.numel() * element_size,
+                False,
+                False,
+                "",
+                0,
+                False,
             )
             if ret < 0:
                 raise Exception(f"Failed to read to infinistore, ret = {ret}")
         else:
             raise Exception("Not connected to any instance")
 
+    def _rw_rdma_varlen(
+        self,
+        op,
+        cache: torch.Tensor,
+        blocks: List[Tuple[str, int, int]],
+        pinned: bool,
+        chain: bool,
+        parent: Union[str, bytes],
+        ttl_ms: int,
+        if_absent: bool,
+    ):
+        if not self.rdma_connected:
+            raise Exception("Values of different sizes need an RDMA connection")
+        element_size = cache.element_size()
+        blocks_in_bytes = [
+            (key, offset * element_size, size * element_size)
+            for key, offset, size in blocks
+        ]
+        ret, present = _infinistore.rw_rdma_varlen(
+            self.conn,
+            op,
+            blocks_in_bytes,
+            cache.data_ptr(),
+            cache.numel() * element_size,
+            pinned,
+            chain,
+            parent,
+            ttl_ms,
+            if_absent,
+        )
+        if ret < 0:
+            raise Exception(f"Failed to access infinistore, ret = {ret}")
+        return ret, present
+
     def sync(self):
         """
         Synchronizes the current instance with the connected infinistore instance.
@@ -394,13 +582,80 @@ class InfinityConnection:
         if cache.is_contiguous() is False:
             raise Exception("Tensor must be contiguous")
 
-    def check_exist(self, key: str):
+    def check_exist(self, key: Union[str, bytes]):
         ret = _infinistore.check_exist(self.conn, key)
         if ret < 0:
             raise Exception("Failed to check if this key exists")
         return True if ret == 0 else False
 
-    def get_match_last_index(self, keys: List[str]):
+    def check_exist_batch(self, keys: List[Union[str, bytes]]) -> List[bool]:
+        """
+        Checks many keys in one round trip. Returns one bool per key, True if it is stored.
+        """
+        bitmap = _infinistore.check_exist_batch(self.conn, keys)
+        return [bool(bitmap[i // 8] >> (i % 8) & 1) for i in range(len(keys))]
+
+    def drop_subtree(self, key: Union[str, bytes]):
+        """
+        Drops key and every block chained after it, e.g. a whole conversation.
+        Needs a server started with the prefix index. Returns the number of values dropped.
+        """
+        ret = _infinistore.drop_subtree(self.conn, key)
+        if ret < 0:
+            raise Exception("Failed to drop subtree")
+        return ret
+
+    def delete_keys(self, keys: List[Union[str, bytes]]):
+        """
+        Deletes the keys, returns how many of them were stored. Missing keys are ignored.
+        A read that already started on a deleted value still completes.
+        """
+        ret = _infinistore.delete_keys(self.conn, keys)
+        if ret < 0:
+            raise Exception("Failed to delete keys")
+        return ret
+
+    def clone_keys(
+        self,
+        sources: List[Union[str, bytes]],
+        keys: List[Union[str, bytes]],
+        pinned: bool = False,
+        parent: Optional[Union[str, bytes]] = None,
+        ttl: Optional[float] = None,
+    ):
+        """
+        Gives keys[i] the value of sources[i] on the server without moving data, e.g. to
+        fork a conversation. The keys share the blocks until either one is written again.
+        pinned, parent and ttl apply to the new keys as in write_cache.
+
+        Returns:
+            bool: False if a source key is not stored, nothing is cloned then.
+        """
+        if len(sources) != len(keys) or not keys:
+            raise Exception("clone_keys needs as many keys as sources")
+        chain = parent is not None
+        parent = parent or ""
+        ttl_ms = 0 if ttl is None else max(1, int(ttl * 1000))
+        ret = _infinistore.clone_keys(
+            self.conn, sources, keys, pinned, chain, parent, ttl_ms
+        )
+        if ret < 0:
+            raise Exception("Failed to clone keys")
+        return ret > 0
+
+    def use_namespace(self, name: str):
+        """
+        Switches the connection to the keys of namespace name, which must exist: namespaces
+        are created, given a quota and dropped on the server's control plane. "" is the
+        default namespace. Once its namespace is dropped, every request of the connection
+        fails until it switches again.
+        """
+        ret = _infinistore.use_namespace(self.conn, name)
+        if ret < 0:
+            raise Exception(f"Failed to use namespace {name}")
+        self.config.namespace = name
+
+    def get_match_last_index(self, keys: List[Union[str, bytes]]):
         ret = _infinistore.get_match_last_index(self.conn, keys)
         if ret < 0:
             raise Exception("can't find a match")
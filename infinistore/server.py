@@ -1,9 +1,21 @@
-from .lib import register_server, check_supported, ServerConfig, Logger
-from ._infinistore import get_kvmap_len
+from .lib import (
+    register_server,
+    check_supported,
+    parse_size_classes,
+    ServerConfig,
+    Logger,
+)
+from ._infinistore import (
+    get_kvmap_len,
+    get_mem_stats,
+    get_namespace_stats,
+    set_namespace_quota,
+    drop_namespace,
+)
 
 import asyncio
 import uvloop
-from fastapi import FastAPI
+from fastapi import FastAPI, HTTPException
 import uvicorn
 import torch
 import argparse
@@ -20,6 +32,45 @@ async def read_status():
     return get_kvmap_len()
 
 
+@app.get("/memStats")
+async def read_mem_stats():
+    return get_mem_stats()
+
+
+@app.get("/startupProgress")
+async def read_startup_progress():
+    stats = get_mem_stats()
+    total = stats.get("pool_size", 0) + stats.get("loading_size", 0)
+    return {
+        "ready_size": stats.get("pool_size", 0),
+        "total_size": total,
+        "done": total > 0 and stats.get("loading_size", 0) == 0,
+    }
+
+
+@app.get("/namespaces")
+async def read_namespaces():
+    return get_namespace_stats()
+
+
+@app.put("/namespaces/{name}")
+async def put_namespace(name: str, quota: int = 0):
+    # quota in bytes, 0: none
+    if quota < 0:
+        raise HTTPException(status_code=400, detail="quota must not be negative")
+    if set_namespace_quota(name, quota) < 0:
+        raise HTTPException(status_code=507, detail="too many namespaces")
+    return get_namespace_stats()[name]
+
+
+@app.delete("/namespaces/{name}")
+async def delete_namespace(name: str):
+    dropped = drop_namespace(name)
+    if dropped < 0:
+        raise HTTPException(status_code=404, detail=f"no namespace {name} to drop")
+    return {"dropped_keys": dropped}
+
+
 def check_p2p_access():
     num_devices = torch.cuda.device_count()
     for i in range(num_devices):
@@ -72,6 +123,73 @@ def parse_args():
         default=16,
         help="prealloc mem pool size, default 16GB, unit: GB",
     )
+    parser.add_argument(
+        "--max-size",
+        required=False,
+        type=int,
+        default=0,
+        help="grow the mem pool on demand up to this size, default 0 (no growth), unit: GB",
+    )
+    parser.add_argument(
+        "--hugepage-size",
+        required=False,
+        type=int,
+        default=0,
+        choices=[0, 2, 1024],
+        help="back the mem pool with 2MB or 1024MB huge pages, default 0 (disabled), unit: MB",
+    )
+    parser.add_argument(
+        "--numa-nodes",
+        required=False,
+        default="",
+        help="spread the mem pool over these NUMA nodes, e.g. 0,1. default: the RDMA device's node",
+        type=str,
+    )
+    parser.add_argument(
+        "--size-classes",
+        required=False,
+        default="32:100",
+        help="block size classes as block_size_kb:share_percent pairs, default 32:100",
+        type=str,
+    )
+    parser.add_argument(
+        "--memory-backend",
+        required=False,
+        default="cuda",
+        choices=["cuda", "host"],
+        help="cuda: pinned by CUDA, serves local GPU and RDMA clients. "
+        "host: mmap + mlock, no GPU needed, RDMA clients only. default cuda",
+        type=str,
+    )
+    parser.add_argument(
+        "--eviction-policy",
+        required=False,
+        default="none",
+        choices=["lru", "clock", "s3fifo", "none"],
+        help="what to drop when the mem pool is full, none: reject writes. default none",
+        type=str,
+    )
+    parser.add_argument(
+        "--prefix-index",
+        required=False,
+        action="store_true",
+        help="chain written blocks into a prefix tree: exact prefix matching, "
+        "whole sequences can be dropped at once",
+    )
+    parser.add_argument(
+        "--admission",
+        required=False,
+        action="store_true",
+        help="once the mem pool is full, decline writes whose keys are read or checked "
+        "less often than what they would evict (TinyLFU)",
+    )
+    parser.add_argument(
+        "--dedup",
+        required=False,
+        action="store_true",
+        help="values of one namespace with the same bytes share one block, written "
+        "values are fingerprinted in the background",
+    )
     parser.add_argument(
         "--dev-name",
         required=False,
@@ -89,11 +207,22 @@ def main():
         service_port=args.service_port,
         log_level=args.log_level,
         prealloc_size=args.prealloc_size,
+        max_size=args.max_size,
+        hugepage_size=args.hugepage_size,
+        numa_nodes=[int(n) for n in args.numa_nodes.split(",") if n],
+        size_classes=parse_size_classes(args.size_classes),
+        memory_backend=args.memory_backend,
+        eviction_policy=args.eviction_policy,
+        prefix_index=args.prefix_index,
+        admission=args.admission,
+        dedup=args.dedup,
         dev_name=args.dev_name,
     )
     config.verify()
-    check_p2p_access()
-    check_supported()
+    gpu = config.memory_backend == "cuda"
+    if gpu:
+        check_p2p_access()
+    check_supported(gpu=gpu)
 
     Logger.set_log_level(config.log_level)
     Logger.info(config)
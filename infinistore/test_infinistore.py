@@ -8,18 +8,75 @@ import subprocess
 import random
 import string
 import contextlib
+import json
+import urllib.request
+from types import SimpleNamespace
 
 
-# Fixture to start the TCzpserver before running tests
+# servers the tests run against: extra flags, service port and manage port
+SERVERS = {
+    "default": ([], 22345, 18080),
+    "prefix": (["--prefix-index"], 22346, 18081),
+    "dedup": (["--dedup"], 22347, 18082),
+    # small enough for a test to fill
+    "lru": (["--eviction-policy", "lru", "--prealloc-size", "1"], 22348, 18083),
+}
+
+
+# Fixture to start the TCzpserver before running tests. Tests needing a server
+# with other flags use @pytest.mark.parametrize("server", [name], indirect=True)
 @pytest.fixture(scope="module")
-def server():
-    server_process = subprocess.Popen(["python", "-m", "infinistore.server"])
+def server(request):
+    flags, service_port, manage_port = SERVERS[getattr(request, "param", "default")]
+    server_process = subprocess.Popen(
+        ["python", "-m", "infinistore.server"]
+        + flags
+        + ["--service-port", str(service_port), "--manage-port", str(manage_port)]
+    )
     time.sleep(4)
-    yield
+    yield SimpleNamespace(port=service_port, manage_port=manage_port)
     os.kill(server_process.pid, signal.SIGINT)
     server_process.wait()
 
 
+def connect(port, **kwargs):
+    """
+    A connection to the test server on port, kwargs go to ClientConfig. RDMA
+    unless kwargs give another connection_type.
+    """
+    kwargs.setdefault("connection_type", infinistore.TYPE_RDMA)
+    config = infinistore.ClientConfig(
+        host_addr="127.0.0.1",
+        service_port=port,
+        dev_name="mlx5_0",
+        **kwargs,
+    )
+    conn = infinistore.InfinityConnection(config)
+    conn.connect()
+    return conn
+
+
+def control(server, method, path):
+    """
+    Calls the control plane of server, returns the decoded JSON answer.
+    """
+    req = urllib.request.Request(
+        f"http://127.0.0.1:{server.manage_port}{path}", method=method
+    )
+    with urllib.request.urlopen(req) as resp:
+        return json.load(resp)
+
+
+def wait_until(cond, timeout=5):
+    """
+    Polls cond until it holds, fails after timeout seconds.
+    """
+    deadline = time.time() + timeout
+    while not cond():
+        assert time.time() < deadline, "timed out"
+        time.sleep(0.05)
+
+
 # add a flat to wehther the same connection.
 
 
@@ -123,14 +180,7 @@ def test_batch_read_write_cache(server, seperated_gpu, local):
 
 @pytest.mark.parametrize("limited_bar1", [(True, 100 << 20), (False, 10 << 20)])
 def test_read_write_bottom_cache(server, limited_bar1):
-    config = infinistore.ClientConfig(
-        host_addr="127.0.0.1",
-        service_port=22345,
-        dev_name="mlx5_0",
-        connection_type=infinistore.TYPE_RDMA,
-    )
-    conn = infinistore.InfinityConnection(config)
-    conn.connect()
+    conn = connect(server.port)
     # force the limit, for GPU T4, limited_bar1 must be True
     conn.conn.limited_bar1 = limited_bar1[0]
 
@@ -154,14 +204,7 @@ def test_read_write_bottom_cache(server, limited_bar1):
 
 @pytest.mark.parametrize("limited_bar1", [(True, 100 << 20), (False, 10 << 20)])
 def test_read_write_interleave_cache(server, limited_bar1):
-    config = infinistore.ClientConfig(
-        host_addr="127.0.0.1",
-        service_port=22345,
-        dev_name="mlx5_0",
-        connection_type=infinistore.TYPE_RDMA,
-    )
-    conn = infinistore.InfinityConnection(config)
-    conn.connect()
+    conn = connect(server.port)
     # force the limit, for GPU T4, limited_bar1 must be True
     conn.conn.limited_bar1 = limited_bar1[0]
     # allocate a 4(float32) * 100 tensor on GPU, the size is 400MB
@@ -184,15 +227,153 @@ def test_read_write_interleave_cache(server, limited_bar1):
     assert torch.equal(src[-1024:], dst)
 
 
-def test_key_check(server):
-    config = infinistore.ClientConfig(
-        host_addr="127.0.0.1",
-        service_port=22345,
-        dev_name="mlx5_0",
-        connection_type=infinistore.TYPE_RDMA,
+def test_write_if_absent_limited_bar1(server):
+    conn = connect(server.port)
+    conn.conn.limited_bar1 = True
+    # room for the MRs of a few writes in flight, not for leaked ones
+    conn.conn.bar1_mem_in_mib = 1
+    keys = [generate_random_string(10) for _ in range(16)]
+    src = torch.randn(16 * 1024, device="cuda", dtype=torch.float32)
+    blocks = [(key, i * 1024) for i, key in enumerate(keys)]
+    # half of the keys are stored first
+    conn.write_cache(src, blocks[::2], 1024)
+    conn.sync()
+    assert conn.write_cache(src, blocks, 1024, if_absent=True) == [
+        i % 2 == 0 for i in range(16)
+    ]
+    conn.sync()
+    # 64 KB each, nothing transferred: 100 of them leaking MRs would pass 1 MB
+    for _ in range(100):
+        assert conn.write_cache(src, blocks, 1024, if_absent=True) == [True] * 16
+        conn.sync()
+
+    dst = torch.zeros(16 * 1024, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, blocks, 1024)
+    conn.sync()
+    assert torch.equal(src, dst)
+
+
+def test_variable_length_read_write(server):
+    conn = connect(server.port)
+    # a small metadata object next to a multi-megabyte slab
+    small, large = 100, 3 << 20
+    src = torch.randn(small + large, device="cuda", dtype=torch.float32)
+    key1 = generate_random_string(5)
+    key2 = generate_random_string(5)
+
+    conn.write_cache(src, [(key1, 0, small), (key2, small, large)], None)
+    conn.sync()
+
+    dst = torch.zeros(small + large, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(key2, 0, large), (key1, large, small)], None)
+    conn.sync()
+    assert torch.equal(src[small:], dst[:large])
+    assert torch.equal(src[:small], dst[large:])
+
+
+def test_digest_keys(server):
+    conn = connect(server.port)
+    # raw 128-bit digests travel packed, not as msgpack strings
+    keys = [os.urandom(16) for i in range(4)]
+    src = torch.randn(4 * 1024, device="cuda", dtype=torch.float32)
+    conn.write_cache(src, [(key, i * 1024) for i, key in enumerate(keys)], 1024)
+    conn.sync()
+
+    dst = torch.zeros(4 * 1024, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(key, i * 1024) for i, key in enumerate(keys)], 1024)
+    conn.sync()
+    assert torch.equal(src, dst)
+    assert conn.check_exist(keys[2])
+    assert conn.get_match_last_index(keys + [os.urandom(16)]) == 3
+
+
+def test_pinned_write(server):
+    conn = connect(server.port)
+    key = generate_random_string(10)
+    src = torch.randn(4096, device="cuda", dtype=torch.float32)
+    conn.write_cache(src, [(key, 0)], 4096, pinned=True)
+    conn.sync()
+
+    dst = torch.zeros(4096, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(key, 0)], 4096)
+    conn.sync()
+    assert torch.equal(src, dst)
+
+
+@pytest.mark.parametrize("server", ["lru"], indirect=True)
+def test_pinned_write_in_full_pool(server):
+    conn = connect(server.port)
+    block = 8192  # 32 KB, the block size class
+    key = generate_random_string(10)
+    src = torch.randn(block, device="cuda", dtype=torch.float32)
+    conn.write_cache(src, [(key, 0)], block, pinned=True)
+    conn.sync()
+
+    # two rounds of 768 MB in a 1 GB pool: the second one evicts most of the first
+    chunk = torch.randn(2048 * block, device="cuda", dtype=torch.float32)
+    first = []
+    for _ in range(2):
+        for _ in range(12):
+            keys = [generate_random_string(16) for _ in range(2048)]
+            conn.write_cache(chunk, [(k, i * block) for i, k in enumerate(keys)], block)
+            conn.sync()
+            first = first or keys
+        # values just written are not evicted yet
+        time.sleep(1.5)
+
+    stats = control(server, "GET", "/memStats")
+    assert stats["evicted_keys"] > 0
+    assert stats["pinned_keys"] == 1
+    # least recently used first
+    assert not conn.check_exist(first[0])
+    dst = torch.zeros(block, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(key, 0)], block)
+    conn.sync()
+    assert torch.equal(src, dst)
+
+
+def test_overwrite_during_read(server):
+    reader = connect(server.port)
+    writer = connect(server.port)
+    key = generate_random_string(10)
+    old = torch.randn(4096, device="cuda", dtype=torch.float32)
+    new = torch.randn(4096, device="cuda", dtype=torch.float32)
+    writer.write_cache(old, [(key, 0)], 4096)
+    writer.sync()
+    wait_until(lambda: control(server, "GET", "/memStats")["retired_bytes"] == 0)
+
+    # the read is posted and leased, sync waits for it and releases the lease
+    dst = torch.zeros(4096, device="cuda", dtype=torch.float32)
+    reader.read_cache(dst, [(key, 0)], 4096)
+    writer.write_cache(new, [(key, 0)], 4096)
+    writer.sync()
+    # more than two reclaim epochs: the old blocks are kept for the reader
+    time.sleep(1.5)
+    stats = control(server, "GET", "/memStats")
+    assert stats["leased_values"] == 1
+    assert stats["retired_bytes"] >= old.numel() * old.element_size()
+    reader.sync()
+    assert torch.equal(old, dst)
+    wait_until(lambda: control(server, "GET", "/memStats")["retired_bytes"] == 0)
+
+    # a lease never released holds the blocks until it times out, after 10 s
+    expired = control(server, "GET", "/memStats")["expired_leases"]
+    reader.read_cache(dst, [(key, 0)], 4096)
+    writer.write_cache(old, [(key, 0)], 4096)
+    writer.sync()
+    time.sleep(1.5)
+    assert control(server, "GET", "/memStats")["retired_bytes"] > 0
+    wait_until(
+        lambda: control(server, "GET", "/memStats")["expired_leases"] > expired,
+        timeout=15,
     )
-    conn = infinistore.InfinityConnection(config)
-    conn.connect()
+    wait_until(lambda: control(server, "GET", "/memStats")["retired_bytes"] == 0)
+    reader.sync()
+    assert torch.equal(new, dst)
+
+
+def test_key_check(server):
+    conn = connect(server.port)
     key = generate_random_string(5)
     src = torch.randn(4096, device="cuda", dtype=torch.float32)
     conn.write_cache(src, [(key, 0)], 4096)
@@ -200,15 +381,207 @@ def test_key_check(server):
     assert conn.check_exist(key)
 
 
-def test_get_match_last_index(server):
-    config = infinistore.ClientConfig(
-        host_addr="127.0.0.1",
-        service_port=22345,
-        dev_name="mlx5_0",
-        connection_type=infinistore.TYPE_RDMA,
+@pytest.mark.parametrize("key_size", [10, 16])
+def test_key_check_batch(server, key_size):
+    conn = connect(server.port)
+    keys = [generate_random_string(key_size) for i in range(20)]
+    src = torch.randn(10 * 1024, device="cuda", dtype=torch.float32)
+    # every other key is written
+    conn.write_cache(src, [(key, i * 512) for i, key in enumerate(keys[::2])], 512)
+    conn.sync()
+    assert conn.check_exist_batch(keys) == [i % 2 == 0 for i in range(len(keys))]
+    assert conn.check_exist_batch([]) == []
+
+
+def test_delete_keys(server):
+    conn = connect(server.port)
+    keys = [generate_random_string(10) for i in range(2)]
+    src = torch.randn(2048, device="cuda", dtype=torch.float32)
+    conn.write_cache(src, [(keys[0], 0), (keys[1], 1024)], 1024)
+    conn.sync()
+    # a missing key is not counted
+    assert conn.delete_keys(keys + [generate_random_string(10)]) == 2
+    assert not conn.check_exist(keys[0])
+    assert not conn.check_exist(keys[1])
+
+
+def test_ttl(server):
+    conn = connect(server.port)
+    key = generate_random_string(10)
+    src = torch.randn(1024, device="cuda", dtype=torch.float32)
+    # long enough to check the key before it expires on a slow machine
+    conn.write_cache(src, [(key, 0)], 1024, ttl=2)
+    conn.sync()
+    assert conn.check_exist(key)
+    wait_until(lambda: not conn.check_exist(key))
+    # the TTL timer erases it, not just hides it
+    wait_until(lambda: control(server, "GET", "/memStats")["ttl_timers"] == 0)
+
+    # writing the key again without a ttl keeps it past the first deadline
+    conn.write_cache(src, [(key, 0)], 1024, ttl=0.2)
+    conn.write_cache(src, [(key, 0)], 1024)
+    conn.sync()
+    wait_until(lambda: control(server, "GET", "/memStats")["ttl_timers"] == 0)
+    assert conn.check_exist(key)
+
+
+@pytest.mark.parametrize("local", [True, False])
+def test_write_if_absent(server, local):
+    conn = connect(
+        server.port,
+        connection_type=infinistore.TYPE_LOCAL_GPU if local else infinistore.TYPE_RDMA,
     )
-    conn = infinistore.InfinityConnection(config)
-    conn.connect()
+    key1 = generate_random_string(10)
+    key2 = generate_random_string(10)
+    with infinistore.DisableTorchCaching() if local else contextlib.nullcontext():
+        first = torch.randn(1024, device="cuda", dtype=torch.float32)
+        second = torch.randn(2048, device="cuda", dtype=torch.float32)
+        dst = torch.zeros(2048, device="cuda", dtype=torch.float32)
+    conn.write_cache(first, [(key1, 0)], 1024)
+    conn.sync()
+
+    # key1 keeps the value written first, key2 is new
+    present = conn.write_cache(second, [(key1, 0), (key2, 1024)], 1024, if_absent=True)
+    assert present == [True, False]
+    conn.sync()
+
+    conn.read_cache(dst, [(key1, 0), (key2, 1024)], 1024)
+    conn.sync()
+    assert torch.equal(dst[:1024], first)
+    assert torch.equal(dst[1024:], second[1024:])
+
+
+@pytest.mark.parametrize("server", ["dedup"], indirect=True)
+def test_dedup(server):
+    conn = connect(server.port)
+    # the same 4 KB under two keys
+    src = torch.randn(1024, device="cuda", dtype=torch.float32)
+    src = torch.cat([src, src])
+    keys = [generate_random_string(10) for _ in range(2)]
+    conn.write_cache(src, [(keys[0], 0), (keys[1], 1024)], 1024)
+    conn.sync()
+
+    # values are fingerprinted in the background once the write is over
+    time.sleep(2)
+    stats = control(server, "GET", "/memStats")
+    assert stats["dedup_saved_bytes"] >= 4096
+
+    dst = torch.zeros(2048, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(keys[0], 0), (keys[1], 1024)], 1024)
+    conn.sync()
+    assert torch.equal(src, dst)
+
+    # the same bytes in another namespace get their own block
+    control(server, "PUT", "/namespaces/dedup_other")
+    other = connect(server.port, namespace="dedup_other")
+    other.write_cache(src, [(generate_random_string(10), 0)], 1024)
+    other.sync()
+    saved = stats["dedup_saved_bytes"]
+    time.sleep(2)
+    assert control(server, "GET", "/memStats")["dedup_saved_bytes"] == saved
+
+
+def test_clone_keys(server):
+    conn = connect(server.port)
+    key = generate_random_string(10)
+    clone = generate_random_string(10)
+    src = torch.randn(1024, device="cuda", dtype=torch.float32)
+    conn.write_cache(src, [(key, 0)], 1024)
+    conn.sync()
+    assert conn.clone_keys([key], [clone])
+    assert control(server, "GET", "/memStats")["clone_saved_bytes"] >= 4096
+
+    # writing the source again leaves the clone alone
+    conn.write_cache(torch.zeros_like(src), [(key, 0)], 1024)
+    conn.sync()
+    dst = torch.zeros(1024, device="cuda", dtype=torch.float32)
+    conn.read_cache(dst, [(clone, 0)], 1024)
+    conn.sync()
+    assert torch.equal(src, dst)
+
+    assert not conn.clone_keys([generate_random_string(10)], [generate_random_string(10)])
+
+
+# quotas are kept by evicting
+@pytest.mark.parametrize("server", ["lru"], indirect=True)
+def test_namespaces(server):
+    # clients pick namespaces, only the control plane creates them
+    with pytest.raises(Exception):
+        connect(server.port, namespace="tenant_a")
+    control(server, "PUT", "/namespaces/tenant_a")
+    control(server, "PUT", "/namespaces/tenant_b")
+    a = connect(server.port, namespace="tenant_a")
+    b = connect(server.port, namespace="tenant_b")
+    # the same key in two namespaces holds two values
+    key = generate_random_string(10)
+    src_a = torch.randn(1024, device="cuda", dtype=torch.float32)
+    src_b = torch.randn(1024, device="cuda", dtype=torch.float32)
+    a.write_cache(src_a, [(key, 0)], 1024)
+    b.write_cache(src_b, [(key, 0)], 1024)
+    a.sync()
+    b.sync()
+    dst = torch.zeros(1024, device="cuda", dtype=torch.float32)
+    b.read_cache(dst, [(key, 0)], 1024)
+    b.sync()
+    assert torch.equal(src_b, dst)
+
+    stats = control(server, "GET", "/namespaces")
+    assert stats["tenant_a"]["keys"] == 1
+    assert stats["tenant_a"]["used_bytes"] == 4096
+
+    # a quota of two values: the oldest one of the namespace goes
+    control(server, "PUT", "/namespaces/tenant_b?quota=8192")
+    keys = [generate_random_string(10) for _ in range(2)]
+    for k in keys:
+        # values just written are not evicted yet
+        time.sleep(1.5)
+        b.write_cache(src_b, [(k, 0)], 1024)
+        b.sync()
+    assert b.check_exist_batch([key] + keys) == [False, True, True]
+    # values of their own sizes count as one batch: three of them do not fit
+    varlen = [(generate_random_string(10), 0, 1024) for _ in range(3)]
+    with pytest.raises(Exception):
+        b.write_cache(src_b, varlen, None)
+    assert b.check_exist_batch([k for k, _, _ in varlen]) == [False] * 3
+    assert control(server, "GET", "/namespaces")["tenant_b"]["used_bytes"] <= 8192
+    assert a.check_exist(key)
+
+    assert control(server, "DELETE", "/namespaces/tenant_a")["dropped_keys"] == 1
+    # the namespace is not brought back by its clients
+    with pytest.raises(Exception):
+        a.check_exist(key)
+    with pytest.raises(Exception):
+        a.use_namespace("tenant_a")
+    control(server, "PUT", "/namespaces/tenant_a")
+    a.use_namespace("tenant_a")
+    assert not a.check_exist(key)
+    assert b.check_exist(keys[0])
+    b.use_namespace("")
+    assert not b.check_exist(keys[0])
+
+
+def test_get_match_last_index(server):
+    conn = connect(server.port)
     src = torch.randn(4096, device="cuda", dtype=torch.float32)
     conn.write_cache(src, [("key1", 0), ("key2", 1024), ("key3", 2048)], 1024)
     assert conn.get_match_last_index(["A", "B", "C", "key1", "D", "E"]) == 3
+
+
+@pytest.mark.parametrize("server", ["prefix"], indirect=True)
+def test_prefix_index(server):
+    conn = connect(server.port)
+    src = torch.randn(4 * 1024, device="cuda", dtype=torch.float32)
+    system = [generate_random_string(10) for i in range(2)]
+    conv = [generate_random_string(10) for i in range(2)]
+    conn.write_cache(src, [(key, i * 1024) for i, key in enumerate(system)], 1024, parent="")
+    conn.write_cache(
+        src, [(key, i * 1024) for i, key in enumerate(conv)], 1024, parent=system[-1]
+    )
+    conn.sync()
+    assert conn.get_match_last_index(system + conv) == 3
+    # a block that does not follow the one before ends the match
+    assert conn.get_match_last_index(system + conv[1:]) == 1
+
+    assert conn.drop_subtree(conv[0]) == 2
+    assert not conn.check_exist(conv[1])
+    assert conn.get_match_last_index(system + conv) == 1
@@ -0,0 +1,265 @@
+#include "bitmap.h"
+
+#include <assert.h>
+
+#define WORD_BITS 64
+#define FULL_WORD (~0ULL)
+
+const size_t SummaryBitmap::npos;
+const size_t BlockBitmap::npos;
+
+// mask of len bits starting at bit b, len in [1, 64]
+static inline uint64_t range_mask(size_t b, size_t len) {
+    return (len == WORD_BITS ? FULL_WORD : ((1ULL << len) - 1)) << b;
+}
+
+// number of free (set) bits at the top of the word
+static inline size_t high_ones(uint64_t word) {
+    return word == FULL_WORD ? WORD_BITS : __builtin_clzll(~word);
+}
+
+// number of free (set) bits at the bottom of the word
+static inline size_t low_ones(uint64_t word) {
+    return word == FULL_WORD ? WORD_BITS : __builtin_ctzll(~word);
+}
+
+// bit i of the result is set iff bits [i, i + n) of word are all set, n in [1, 64]
+static inline uint64_t runs_in_word(uint64_t word, size_t n) {
+    size_t k = 1;
+    while (k < n && word) {
+        size_t s = k < n - k ? k : n - k;
+        word &= word >> s;
+        k += s;
+    }
+    return word;
+}
+
+void SummaryBitmap::reset(size_t nbits) {
+    nbits_ = nbits;
+    levels_.clear();
+    size_t words = (nbits + WORD_BITS - 1) / WORD_BITS;
+    do {
+        words = words ? words : 1;
+        levels_.push_back(std::vector<uint64_t>(words, 0));
+        words = (words + WORD_BITS - 1) / WORD_BITS;
+    } while (levels_.back().size() > 1);
+}
+
+void SummaryBitmap::set_word(size_t w, uint64_t value) {
+    uint64_t old = levels_[0][w];
+    levels_[0][w] = value;
+    if ((old != 0) == (value != 0)) {
+        return;
+    }
+    // the word flipped between empty and non-empty, fix summaries upwards
+    size_t idx = w;
+    for (size_t level = 1; level < levels_.size(); ++level) {
+        uint64_t &summary = levels_[level][idx / WORD_BITS];
+        bool was_set = summary != 0;
+        if (value) {
+            summary |= 1ULL << (idx % WORD_BITS);
+        }
+        else {
+            summary &= ~(1ULL << (idx % WORD_BITS));
+        }
+        if ((summary != 0) == was_set) {
+            break;
+        }
+        idx /= WORD_BITS;
+    }
+}
+
+size_t SummaryBitmap::find_next(size_t pos) const {
+    if (pos >= nbits_) {
+        return npos;
+    }
+    size_t level = 0;
+    size_t idx = pos;
+    // climb until a word has a set bit at or after idx
+    while (true) {
+        size_t w = idx / WORD_BITS;
+        if (w >= levels_[level].size()) {
+            return npos;
+        }
+        uint64_t word = levels_[level][w] & (FULL_WORD << (idx % WORD_BITS));
+        if (word) {
+            idx = w * WORD_BITS + __builtin_ctzll(word);
+            break;
+        }
+        if (level + 1 == levels_.size()) {
+            return npos;
+        }
+        idx = w + 1;
+        level++;
+    }
+    // descend to the first set bit under that summary bit
+    while (level > 0) {
+        level--;
+        idx = idx * WORD_BITS + __builtin_ctzll(levels_[level][idx]);
+    }
+    return idx < nbits_ ? idx : npos;
+}
+
+void BlockBitmap::reset(size_t total_blocks) {
+    total_blocks_ = total_blocks;
+    free_blocks_ = total_blocks;
+    free_.reset(total_blocks);
+    empty_.reset(free_.words());
+    for (size_t w = 0; w * WORD_BITS < total_blocks; ++w) {
+        size_t len = total_blocks - w * WORD_BITS;
+        update_word(w, range_mask(0, len < WORD_BITS ? len : WORD_BITS));
+    }
+}
+
+void BlockBitmap::update_word(size_t w, uint64_t value) {
+    free_.set_word(w, value);
+    if (value == FULL_WORD) {
+        empty_.set(w);
+    }
+    else if (empty_.test(w)) {
+        empty_.clear(w);
+    }
+}
+
+size_t BlockBitmap::allocate(size_t n) {
+    size_t start = find_run(n);
+    if (start != npos) {
+        set_range(start, n, false);
+    }
+    return start;
+}
+
+bool BlockBitmap::deallocate(size_t start, size_t n) {
+    if (n == 0 || start + n > total_blocks_ || !range_is(start, n, false)) {
+        return false;
+    }
+    set_range(start, n, true);
+    return true;
+}
+
+bool BlockBitmap::mark_used(size_t start, size_t n) {
+    if (n == 0 || start + n > total_blocks_ || !range_is(start, n, true)) {
+        return false;
+    }
+    set_range(start, n, false);
+    return true;
+}
+
+size_t BlockBitmap::find_run(size_t n) const {
+    if (n == 0 || n > free_blocks_) {
+        return npos;
+    }
+    if (n == 1) {
+        return free_.find_next(0);
+    }
+    if (n >= 2 * WORD_BITS) {
+        return find_long_run(n);
+    }
+
+    size_t pos = free_.find_next(0);
+    while (pos != npos) {
+        size_t w = pos / WORD_BITS;
+        uint64_t word = free_.word(w);
+        if (n <= WORD_BITS) {
+            uint64_t runs = runs_in_word(word, n);
+            if (runs) {
+                return w * WORD_BITS + __builtin_ctzll(runs);
+            }
+        }
+        // free high bits of this word joined with the words after it
+        size_t top = high_ones(word);
+        if (top > 0 && w + 1 < free_.words()) {
+            size_t next = (w + 1) * WORD_BITS;
+            if (top + free_run_from(next, n - top) >= n) {
+                return next - top;
+            }
+        }
+        pos = free_.find_next((w + 1) * WORD_BITS);
+    }
+    return npos;
+}
+
+// a run of at least 128 blocks always covers a fully free word, so only the
+// stretches around the words in empty_ are candidates.
+size_t BlockBitmap::find_long_run(size_t n) const {
+    size_t w = empty_.find_next(0);
+    while (w != npos) {
+        size_t prefix = w > 0 ? high_ones(free_.word(w - 1)) : 0;
+        size_t start = w * WORD_BITS - prefix;
+        size_t run = prefix + free_run_from(w * WORD_BITS, n - prefix);
+        if (run >= n) {
+            return start;
+        }
+        // the stretch ends at a used block, skip past its word
+        w = empty_.find_next((start + run) / WORD_BITS + 1);
+    }
+    return npos;
+}
+
+size_t BlockBitmap::largest_free_run() const {
+    size_t largest = 0;
+    size_t pos = free_.find_next(0);
+    while (pos != npos) {
+        size_t run = free_run_from(pos, total_blocks_);
+        if (run > largest) {
+            largest = run;
+        }
+        // pos + run is a used block, or the end
+        pos = free_.find_next(pos + run);
+    }
+    return largest;
+}
+
+size_t BlockBitmap::free_run_from(size_t start, size_t n) const {
+    size_t run = 0;
+    size_t i = start;
+    while (run < n && i < total_blocks_) {
+        size_t b = i % WORD_BITS;
+        size_t avail = WORD_BITS - b;
+        size_t ones = low_ones(free_.word(i / WORD_BITS) >> b);
+        if (ones > avail) {
+            ones = avail;
+        }
+        run += ones;
+        if (ones < avail) {
+            break;
+        }
+        i += avail;
+    }
+    return run;
+}
+
+bool BlockBitmap::range_is(size_t start, size_t n, bool free) const {
+    size_t i = start;
+    size_t end = start + n;
+    while (i < end) {
+        size_t b = i % WORD_BITS;
+        size_t len = end - i < WORD_BITS - b ? end - i : WORD_BITS - b;
+        uint64_t mask = range_mask(b, len);
+        if ((free_.word(i / WORD_BITS) & mask) != (free ? mask : 0)) {
+            return false;
+        }
+        i += len;
+    }
+    return true;
+}
+
+void BlockBitmap::set_range(size_t start, size_t n, bool free) {
+    assert(start + n <= total_blocks_);
+    size_t i = start;
+    size_t end = start + n;
+    while (i < end) {
+        size_t w = i / WORD_BITS;
+        size_t b = i % WORD_BITS;
+        size_t len = end - i < WORD_BITS - b ? end - i : WORD_BITS - b;
+        uint64_t mask = range_mask(b, len);
+        update_word(w, free ? free_.word(w) | mask : free_.word(w) & ~mask);
+        i += len;
+    }
+    if (free) {
+        free_blocks_ += n;
+    }
+    else {
+        free_blocks_ -= n;
+    }
+}
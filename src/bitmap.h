@@ -0,0 +1,103 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+SummaryBitmap is a plain bitmap with a tree of summary words on top of it.
+Bit j of a level k+1 word is set iff word j of level k is non-zero, so the
+next set bit can be found by climbing until a summary word has a set bit and
+then descending with ctz. Every query and update touches one word per level,
+which is log64(n): 3 levels cover 16M bits.
+*/
+class SummaryBitmap {
+   public:
+    static const size_t npos = (size_t)-1;
+
+    explicit SummaryBitmap(size_t nbits = 0) { reset(nbits); }
+
+    // clear every bit and resize to nbits
+    void reset(size_t nbits);
+
+    size_t size() const { return nbits_; }
+    size_t words() const { return levels_[0].size(); }
+
+    uint64_t word(size_t w) const { return levels_[0][w]; }
+    // replace a whole level 0 word and fix the summaries above it
+    void set_word(size_t w, uint64_t value);
+
+    bool test(size_t i) const { return levels_[0][i / 64] & (1ULL << (i % 64)); }
+    void set(size_t i) { set_word(i / 64, word(i / 64) | (1ULL << (i % 64))); }
+    void clear(size_t i) { set_word(i / 64, word(i / 64) & ~(1ULL << (i % 64))); }
+
+    // index of the first set bit >= pos, or npos
+    size_t find_next(size_t pos) const;
+
+   private:
+    size_t nbits_;
+    // levels_[0] holds the bits, levels_.back() is a single word
+    std::vector<std::vector<uint64_t>> levels_;
+};
+
+/*
+BlockBitmap tracks which blocks of a MemoryPool are free.
+
+Two summaries are kept:
+    free_  : bit i set iff block i is free. Its summary levels answer
+             "which word has a free bit".
+    empty_ : bit w set iff all 64 blocks of word w are free. It is the
+             "has 64-run" summary, used to jump to candidates for long runs.
+
+A run that fits in one word is found with shift-and on the free word, a run
+that crosses words is found by joining the free high bits of one word with
+the fully free words and the free low bits that follow it. Full words are
+never visited because candidates come from the summaries.
+*/
+class BlockBitmap {
+   public:
+    static const size_t npos = SummaryBitmap::npos;
+
+    explicit BlockBitmap(size_t total_blocks = 0) { reset(total_blocks); }
+
+    // mark every block free
+    void reset(size_t total_blocks);
+
+    // find the first run of n free blocks, mark it used and return its start
+    // index. Return npos if there is no such run.
+    size_t allocate(size_t n);
+    // mark [start, start + n) free. Return false if any block was already free,
+    // in which case the bitmap is left untouched.
+    bool deallocate(size_t start, size_t n);
+
+    // first run of n free blocks, without marking it
+    size_t find_run(size_t n) const;
+    // mark [start, start + n) used. Return false if any block was in use, in
+    // which case the bitmap is left untouched.
+    bool mark_used(size_t start, size_t n);
+
+    // longest run of free blocks, walks every free stretch once
+    size_t largest_free_run() const;
+
+    bool is_used(size_t i) const { return !free_.test(i); }
+    size_t total_blocks() const { return total_blocks_; }
+    size_t free_blocks() const { return free_blocks_; }
+
+   private:
+    size_t find_long_run(size_t n) const;
+    // number of free blocks starting at block start, looking at most n ahead
+    size_t free_run_from(size_t start, size_t n) const;
+    // true iff every block in [start, start + n) has the given state
+    bool range_is(size_t start, size_t n, bool free) const;
+    void set_range(size_t start, size_t n, bool free);
+    void update_word(size_t w, uint64_t value);
+
+    size_t total_blocks_;
+    size_t free_blocks_;
+    SummaryBitmap free_;
+    SummaryBitmap empty_;
+};
+
+#endif  // BITMAP_H
@@ -2,12 +2,39 @@
 #define LIBCONFIG_H
 
 #include <string>
+#include <vector>
+
+typedef struct SizeClassConfig {
+    size_t block_size;  // unit: KB
+    size_t share;       // unit: percent of prealloc_size
+} size_class_config_t;
 
 typedef struct ServerConfig {
     int service_port;
     std::string log_level;
     std::string dev_name;
     size_t prealloc_size;  // unit: GB
+    size_t max_size;       // unit: GB, pools grow on demand up to it. 0: prealloc_size
+    size_t hugepage_size;  // unit: MB, 2 or 1024. 0: no huge pages
+    std::vector<size_class_config_t> size_classes;
+    // NUMA nodes to spread the pool over, after the node of the RDMA device if it is
+    // known. Nodes that are not online are skipped. empty: the RDMA device's node only
+    std::vector<int> numa_nodes;
+    // "cuda": pool pinned through CUDA, serves local GPU and RDMA clients.
+    // "host": mmap + mlock, no CUDA call at all, RDMA clients only.
+    std::string memory_backend;
+    // what to drop when the pool is full: "lru", "clock" or "s3fifo".
+    // "none", the default: writes fail once the pool is full
+    std::string eviction_policy;
+    // keep a tree of chained block keys: get_match_last_index walks it and
+    // whole sequences can be dropped at once
+    bool prefix_index;
+    // TinyLFU: once the pool is full, only store writes whose keys are read or
+    // checked more often than the entry they would evict. Needs eviction.
+    bool admission;
+    // values of one namespace with the same bytes share one block, found in
+    // the background once their write is over. Namespaces never share
+    bool dedup;
 } server_config_t;
 
 typedef struct ClientConfig {
@@ -15,6 +42,8 @@ typedef struct ClientConfig {
     std::string log_level;
     std::string dev_name;
     std::string host_addr;
+    // namespace of the keys of the connection, "" for the default one
+    std::string ns;
 } client_config_t;
 
 #endif
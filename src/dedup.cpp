@@ -0,0 +1,147 @@
+#include "dedup.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "kvindex.h"
+
+#define LANES 8
+#define STRIPE_SIZE (LANES * 8)
+// stripes between two scrambles of the accumulators, which keeps the high
+// bits of the products flowing into the low ones
+#define STRIPES_PER_SCRAMBLE 16
+
+static const uint64_t PRIME32_1 = 0x9e3779b1ULL;
+static const uint64_t PRIME64_1 = 0x9e3779b185ebca87ULL;
+
+// arbitrary odd constants, one per lane and one to scramble with
+static const uint64_t SECRET[LANES + 1] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+    0xcb00c391bb52283cULL,
+};
+
+static inline void accumulate(uint64_t *acc, const char *stripe) {
+    for (int lane = 0; lane < LANES; ++lane) {
+        uint64_t word;
+        memcpy(&word, stripe + lane * 8, 8);
+        uint64_t keyed = word ^ SECRET[lane];
+        acc[lane ^ 1] += word;
+        acc[lane] += (keyed & 0xffffffff) * (keyed >> 32);
+    }
+}
+
+static inline void scramble(uint64_t *acc) {
+    for (int lane = 0; lane < LANES; ++lane) {
+        acc[lane] = (acc[lane] ^ (acc[lane] >> 47) ^ SECRET[LANES]) * PRIME32_1;
+    }
+}
+
+uint64_t DedupTable::fingerprint(const void *data, size_t size) {
+    const char *p = static_cast<const char *>(data);
+    uint64_t acc[LANES];
+    for (int lane = 0; lane < LANES; ++lane) {
+        acc[lane] = SECRET[lane] * PRIME64_1;
+    }
+    size_t stripes = size / STRIPE_SIZE;
+    for (size_t s = 0; s < stripes; ++s) {
+        accumulate(acc, p + s * STRIPE_SIZE);
+        if (s % STRIPES_PER_SCRAMBLE == STRIPES_PER_SCRAMBLE - 1) {
+            scramble(acc);
+        }
+    }
+    size_t rest = size % STRIPE_SIZE;
+    if (rest > 0) {
+        // zero padded, the size below tells the padding from data
+        char last[STRIPE_SIZE] = {0};
+        memcpy(last, p + stripes * STRIPE_SIZE, rest);
+        accumulate(acc, last);
+    }
+    uint64_t h = size * PRIME64_1;
+    for (int lane = 0; lane < LANES; ++lane) {
+        h = hash_mix(h ^ acc[lane]);
+    }
+    return h;
+}
+
+uint64_t DedupTable::add(uint64_t id, const void *data, size_t size, uint64_t scope) {
+    assert(blocks_.count(id) == 0);
+    auto start = std::chrono::steady_clock::now();
+    uint64_t hash = hash_mix(fingerprint(data, size) ^ scope);
+    uint64_t shared = id;
+    auto it = by_hash_.find(hash);
+    if (it != by_hash_.end()) {
+        Block &known = blocks_[it->second];
+        if (known.scope == scope && known.size == size && memcmp(known.data, data, size) == 0) {
+            known.refs++;
+            if (known.dedup_refs++ == 0) {
+                dedup_blocks_++;
+                dedup_physical_bytes_ += size;
+            }
+            shared = it->second;
+        }
+    }
+    if (shared == id) {
+        blocks_[id] = {
+            .hash = hash, .scope = scope, .data = data, .size = size, .refs = 1, .dedup_refs = 1};
+        physical_bytes_ += size;
+        dedup_blocks_++;
+        dedup_physical_bytes_ += size;
+        // on a collision the block known first stays the one matched against
+        if (it == by_hash_.end()) {
+            by_hash_[hash] = id;
+        }
+    }
+    logical_bytes_ += size;
+    dedup_logical_bytes_ += size;
+    hashed_bytes_ += size;
+    hash_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    return shared;
+}
+
+void DedupTable::retain(uint64_t id, const void *data, size_t size) {
+    auto it = blocks_.find(id);
+    if (it == blocks_.end()) {
+        blocks_[id] = {
+            .hash = 0, .scope = 0, .data = data, .size = size, .refs = 1, .dedup_refs = 0};
+        physical_bytes_ += size;
+    }
+    else {
+        it->second.refs++;
+    }
+    logical_bytes_ += size;
+}
+
+bool DedupTable::release(uint64_t id, bool deduped) {
+    auto it = blocks_.find(id);
+    assert(it != blocks_.end());
+    Block &block = it->second;
+    logical_bytes_ -= block.size;
+    if (deduped) {
+        assert(block.dedup_refs > 0);
+        dedup_logical_bytes_ -= block.size;
+        if (--block.dedup_refs == 0) {
+            dedup_blocks_--;
+            dedup_physical_bytes_ -= block.size;
+        }
+    }
+    if (--block.refs > 0) {
+        return false;
+    }
+    physical_bytes_ -= block.size;
+    auto h = by_hash_.find(block.hash);
+    if (h != by_hash_.end() && h->second == id) {
+        by_hash_.erase(h);
+    }
+    blocks_.erase(it);
+    return true;
+}
+
+uint32_t DedupTable::references(uint64_t id) const {
+    auto it = blocks_.find(id);
+    return it == blocks_.end() ? 0 : it->second.refs;
+}
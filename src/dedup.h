@@ -0,0 +1,81 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <unordered_map>
+
+/*
+DedupTable finds blocks holding the same bytes so that one physical copy can
+serve several values, and counts the values using each shared block. Blocks
+are identified by a 64 bit id chosen by the caller and never moved while the
+table knows them. A block is known from add() or retain() until release()
+drops its last reference. References from add() are counted apart from the
+others, which tells the bytes saved by dedup from those saved by clones.
+
+Blocks are fingerprinted with a 64 bit hash in the style of xxh3: eight
+independent 64 bit lanes, a 32x32 bit multiply per lane and 8 bytes, which
+compilers turn into SIMD code. Equal fingerprints are confirmed with memcmp,
+a collision only costs a missed match. Not thread safe.
+*/
+class DedupTable {
+   public:
+    static uint64_t fingerprint(const void *data, size_t size);
+
+    /*
+    @brief block id holds size bytes at data. Return the id of a known block
+    with the same bytes added in the same scope, e.g. a tenant, which gains a
+    reference; the caller then uses that block and frees its own. Otherwise
+    return id, now known with one reference.
+    */
+    uint64_t add(uint64_t id, const void *data, size_t size, uint64_t scope = 0);
+    /*
+    @brief one more value uses block id of size bytes at data, e.g. a clone.
+    An unknown block becomes known with this one reference but without a
+    fingerprint, add() never matches it.
+    */
+    void retain(uint64_t id, const void *data, size_t size);
+    /*
+    @brief drop a reference to block id, deduped: it came from add(). true if it
+    was the last and the block can be freed
+    */
+    bool release(uint64_t id, bool deduped);
+
+    uint32_t references(uint64_t id) const;
+    // distinct blocks known
+    size_t size() const { return blocks_.size(); }
+    // bytes of the values using known blocks, and of the blocks themselves
+    size_t logical_bytes() const { return logical_bytes_; }
+    size_t physical_bytes() const { return physical_bytes_; }
+    // the same for the references from add() only, and the blocks they use
+    size_t dedup_blocks() const { return dedup_blocks_; }
+    size_t dedup_logical_bytes() const { return dedup_logical_bytes_; }
+    size_t dedup_physical_bytes() const { return dedup_physical_bytes_; }
+    // cost of add(): bytes fingerprinted and the time spent on it, compares included
+    uint64_t hashed_bytes() const { return hashed_bytes_; }
+    uint64_t hash_ns() const { return hash_ns_; }
+
+   private:
+    struct Block {
+        uint64_t hash;  // fingerprint mixed with the scope
+        uint64_t scope;
+        const void *data;
+        size_t size;
+        uint32_t refs;
+        uint32_t dedup_refs;  // of refs, from add()
+    };
+
+    std::unordered_map<uint64_t, Block> blocks_;
+    // fingerprint mixed with the scope -> a known block with it
+    std::unordered_map<uint64_t, uint64_t> by_hash_;
+    size_t logical_bytes_ = 0;
+    size_t physical_bytes_ = 0;
+    size_t dedup_blocks_ = 0;
+    size_t dedup_logical_bytes_ = 0;
+    size_t dedup_physical_bytes_ = 0;
+    uint64_t hashed_bytes_ = 0;
+    uint64_t hash_ns_ = 0;
+};
+
+#endif  // DEDUP_H
@@ -0,0 +1,416 @@
+#include "eviction.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+#include "kvindex.h"
+
+#define NIL ((entry_id_t)-1)
+
+// S3-FIFO: share of the entries kept in the small queue
+#define S3FIFO_SMALL_PERCENT 10
+// S3-FIFO: access counts saturate here
+#define S3FIFO_MAX_FREQ 3
+
+// prev/next links of entry ids, shared by the lists of one policy since an
+// entry is in at most one of them
+struct IdLinks {
+    std::vector<entry_id_t> prev;
+    std::vector<entry_id_t> next;
+
+    void reserve(entry_id_t id) {
+        if (id >= prev.size()) {
+            prev.resize(id + 1, NIL);
+            next.resize(id + 1, NIL);
+        }
+    }
+    size_t memory_usage() const { return (prev.capacity() + next.capacity()) * sizeof(entry_id_t); }
+};
+
+// doubly linked list of entry ids, new entries at the front
+class IdList {
+   public:
+    explicit IdList(IdLinks *links) : links_(links) {}
+
+    void push_front(entry_id_t id) {
+        links_->reserve(id);
+        links_->prev[id] = NIL;
+        links_->next[id] = head_;
+        if (head_ != NIL) {
+            links_->prev[head_] = id;
+        }
+        else {
+            tail_ = id;
+        }
+        head_ = id;
+        size_++;
+    }
+
+    void remove(entry_id_t id) {
+        entry_id_t prev = links_->prev[id], next = links_->next[id];
+        if (prev != NIL) {
+            links_->next[prev] = next;
+        }
+        else {
+            head_ = next;
+        }
+        if (next != NIL) {
+            links_->prev[next] = prev;
+        }
+        else {
+            tail_ = prev;
+        }
+        size_--;
+    }
+
+    entry_id_t back() const { return tail_; }
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+   private:
+    IdLinks *links_;
+    entry_id_t head_ = NIL;
+    entry_id_t tail_ = NIL;
+    size_t size_ = 0;
+};
+
+// least recently read entry first
+class LRUPolicy : public EvictionPolicy {
+   public:
+    LRUPolicy() : list_(&links_) {}
+
+    void insert(entry_id_t id, uint64_t) override { list_.push_front(id); }
+    void access(entry_id_t id) override {
+        list_.remove(id);
+        list_.push_front(id);
+    }
+    void remove(entry_id_t id) override { list_.remove(id); }
+    bool evict(entry_id_t *id) override {
+        if (list_.empty()) {
+            return false;
+        }
+        *id = list_.back();
+        list_.remove(*id);
+        return true;
+    }
+    bool peek(entry_id_t *id) const override {
+        *id = list_.back();
+        return !list_.empty();
+    }
+    size_t size() const override { return list_.size(); }
+    size_t memory_usage() const override { return links_.memory_usage(); }
+
+   private:
+    IdLinks links_;
+    IdList list_;
+};
+
+// second chance: a read sets the entry's bit, the hand clears bits until it
+// finds an entry without one. A read costs one store instead of two list moves.
+class ClockPolicy : public EvictionPolicy {
+   public:
+    void insert(entry_id_t id, uint64_t) override {
+        if (id >= pos_.size()) {
+            pos_.resize(id + 1);
+            referenced_.resize(id + 1);
+        }
+        pos_[id] = ring_.size();
+        referenced_[id] = false;
+        ring_.push_back(id);
+    }
+    void access(entry_id_t id) override { referenced_[id] = true; }
+    void remove(entry_id_t id) override {
+        // the last entry takes the hole, so it is looked at a bit early
+        size_t pos = pos_[id];
+        ring_[pos] = ring_.back();
+        pos_[ring_[pos]] = pos;
+        ring_.pop_back();
+        if (hand_ >= ring_.size()) {
+            hand_ = 0;
+        }
+    }
+    bool evict(entry_id_t *id) override {
+        if (ring_.empty()) {
+            return false;
+        }
+        while (referenced_[ring_[hand_]]) {
+            referenced_[ring_[hand_]] = false;
+            hand_ = (hand_ + 1) % ring_.size();
+        }
+        *id = ring_[hand_];
+        remove(*id);
+        return true;
+    }
+    bool peek(entry_id_t *id) const override {
+        if (ring_.empty()) {
+            return false;
+        }
+        // the first entry without a bit, or the hand's after a full turn
+        for (size_t i = 0; i < ring_.size(); ++i) {
+            entry_id_t e = ring_[(hand_ + i) % ring_.size()];
+            if (!referenced_[e]) {
+                *id = e;
+                return true;
+            }
+        }
+        *id = ring_[hand_];
+        return true;
+    }
+    size_t size() const override { return ring_.size(); }
+    size_t memory_usage() const override {
+        return ring_.capacity() * sizeof(entry_id_t) + pos_.capacity() * sizeof(size_t) +
+               referenced_.capacity() / 8;
+    }
+
+   private:
+    std::vector<entry_id_t> ring_;
+    std::vector<size_t> pos_;
+    std::vector<bool> referenced_;
+    size_t hand_ = 0;
+};
+
+/*
+S3-FIFO (Yang et al., SOSP 2023): new entries go to a small FIFO. An entry
+leaving it unread is evicted and its fingerprint kept in a ghost FIFO; one
+that was read moves to the main FIFO. Keys found in the ghost FIFO go to the
+main FIFO directly. The main FIFO gives entries one more round per read,
+up to S3FIFO_MAX_FREQ. One-hit wonders, e.g. prefixes never shared, are
+dropped after a short stay without pushing out the entries that are reused.
+*/
+class S3FIFOPolicy : public EvictionPolicy {
+   public:
+    S3FIFOPolicy() : small_(&links_), main_(&links_) {}
+
+    void insert(entry_id_t id, uint64_t fingerprint) override {
+        if (id >= freq_.size()) {
+            freq_.resize(id + 1);
+            in_main_.resize(id + 1);
+            fingerprints_.resize(id + 1);
+        }
+        freq_[id] = 0;
+        fingerprints_[id] = fingerprint;
+        auto it = ghost_set_.find(fingerprint);
+        if (it != ghost_set_.end()) {
+            in_main_[id] = true;
+            main_.push_front(id);
+        }
+        else {
+            in_main_[id] = false;
+            small_.push_front(id);
+        }
+    }
+    void access(entry_id_t id) override {
+        if (freq_[id] < S3FIFO_MAX_FREQ) {
+            freq_[id]++;
+        }
+    }
+    void remove(entry_id_t id) override { (in_main_[id] ? main_ : small_).remove(id); }
+    bool evict(entry_id_t *id) override {
+        while (!small_.empty() || !main_.empty()) {
+            size_t small_target = size() * S3FIFO_SMALL_PERCENT / 100;
+            if (!small_.empty() && (small_.size() > small_target || main_.empty())) {
+                entry_id_t t = small_.back();
+                small_.remove(t);
+                if (freq_[t] > 0) {
+                    freq_[t] = 0;
+                    in_main_[t] = true;
+                    main_.push_front(t);
+                    continue;
+                }
+                remember(fingerprints_[t]);
+                *id = t;
+                return true;
+            }
+            entry_id_t t = main_.back();
+            main_.remove(t);
+            if (freq_[t] > 0) {
+                freq_[t]--;
+                main_.push_front(t);
+                continue;
+            }
+            *id = t;
+            return true;
+        }
+        return false;
+    }
+    bool peek(entry_id_t *id) const override {
+        if (small_.empty() && main_.empty()) {
+            return false;
+        }
+        size_t small_target = size() * S3FIFO_SMALL_PERCENT / 100;
+        *id = !small_.empty() && (small_.size() > small_target || main_.empty()) ? small_.back()
+                                                                                  : main_.back();
+        return true;
+    }
+    size_t size() const override { return small_.size() + main_.size(); }
+    size_t memory_usage() const override {
+        // a node of ghost_set_ holds the pair, the next pointer and the hash
+        return links_.memory_usage() + freq_.capacity() + in_main_.capacity() / 8 +
+               fingerprints_.capacity() * sizeof(uint64_t) + ghost_.size() * sizeof(uint64_t) +
+               ghost_set_.size() * (sizeof(std::pair<uint64_t, uint32_t>) + 2 * sizeof(void *)) +
+               ghost_set_.bucket_count() * sizeof(void *);
+    }
+
+   private:
+    // the ghost FIFO holds as many fingerprints as the main FIFO has entries
+    void remember(uint64_t fingerprint) {
+        ghost_.push_back(fingerprint);
+        ghost_set_[fingerprint]++;
+        while (ghost_.size() > std::max(main_.size(), (size_t)1)) {
+            auto it = ghost_set_.find(ghost_.front());
+            if (--it->second == 0) {
+                ghost_set_.erase(it);
+            }
+            ghost_.pop_front();
+        }
+    }
+
+    IdLinks links_;
+    IdList small_;
+    IdList main_;
+    std::vector<uint8_t> freq_;
+    std::vector<bool> in_main_;
+    std::vector<uint64_t> fingerprints_;
+    std::deque<uint64_t> ghost_;
+    std::unordered_map<uint64_t, uint32_t> ghost_set_;
+};
+
+std::unique_ptr<EvictionPolicy> make_eviction_policy(const std::string &name) {
+    if (name == "lru") {
+        return std::unique_ptr<EvictionPolicy>(new LRUPolicy());
+    }
+    if (name == "clock") {
+        return std::unique_ptr<EvictionPolicy>(new ClockPolicy());
+    }
+    if (name == "s3fifo") {
+        return std::unique_ptr<EvictionPolicy>(new S3FIFOPolicy());
+    }
+    return nullptr;
+}
+
+FrequencySketch::FrequencySketch(size_t width) : width_(16) {
+    while (width_ < width) {
+        width_ *= 2;
+    }
+    table_.assign(ROWS * width_ / 16, 0);
+    sample_size_ = 10 * width_;
+}
+
+void FrequencySketch::locate(uint64_t hash, int row, size_t *word, int *shift) const {
+    // one independent index per row from the same hash
+    size_t i = hash_mix(hash + row * 0x9e3779b97f4a7c15ULL) & (width_ - 1);
+    *word = row * (width_ / 16) + i / 16;
+    *shift = (i % 16) * 4;
+}
+
+void FrequencySketch::increment(uint64_t hash) {
+    for (int row = 0; row < ROWS; ++row) {
+        size_t word;
+        int shift;
+        locate(hash, row, &word, &shift);
+        if (((table_[word] >> shift) & 0xf) < 0xf) {
+            table_[word] += 1ULL << shift;
+        }
+    }
+    if (++additions_ >= sample_size_) {
+        halve();
+    }
+}
+
+uint32_t FrequencySketch::estimate(uint64_t hash) const {
+    uint32_t min = 0xf;
+    for (int row = 0; row < ROWS; ++row) {
+        size_t word;
+        int shift;
+        locate(hash, row, &word, &shift);
+        min = std::min(min, (uint32_t)((table_[word] >> shift) & 0xf));
+    }
+    return min;
+}
+
+void FrequencySketch::halve() {
+    for (auto &word : table_) {
+        word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    additions_ /= 2;
+}
+
+Evictor::Evictor(std::unique_ptr<EvictionPolicy> policy) : policy_(std::move(policy)) {}
+
+entry_id_t Evictor::new_id(uint32_t handle) {
+    entry_id_t id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+        handles_[id] = handle;
+    }
+    else {
+        id = handles_.size();
+        handles_.push_back(handle);
+        pinned_.push_back(false);
+    }
+    return id;
+}
+
+void Evictor::release(entry_id_t id) { free_ids_.push_back(id); }
+
+entry_id_t Evictor::add(uint32_t handle, uint64_t fingerprint, bool pinned) {
+    entry_id_t id = new_id(handle);
+    pinned_[id] = pinned;
+    if (pinned) {
+        pinned_count_++;
+    }
+    else {
+        policy_->insert(id, fingerprint);
+    }
+    return id;
+}
+
+void Evictor::access(entry_id_t id) {
+    if (!pinned_[id]) {
+        policy_->access(id);
+    }
+}
+
+void Evictor::remove(entry_id_t id) {
+    if (pinned_[id]) {
+        pinned_count_--;
+    }
+    else {
+        policy_->remove(id);
+    }
+    release(id);
+}
+
+bool Evictor::peek_victim(uint32_t *handle) const {
+    entry_id_t id;
+    if (!policy_->peek(&id)) {
+        return false;
+    }
+    *handle = handles_[id];
+    return true;
+}
+
+bool Evictor::next_victim(uint32_t *handle) {
+    entry_id_t id;
+    if (!policy_->evict(&id)) {
+        return false;
+    }
+    *handle = handles_[id];
+    release(id);
+    evicted_++;
+    return true;
+}
+
+size_t Evictor::memory_usage() const {
+    return handles_.capacity() * sizeof(uint32_t) + pinned_.capacity() / 8 +
+           free_ids_.capacity() * sizeof(entry_id_t) + policy_->memory_usage();
+}
+
+entry_id_t Evictor::readmit(uint32_t handle, uint64_t fingerprint) {
+    evicted_--;
+    return add(handle, fingerprint, false);
+}
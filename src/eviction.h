@@ -0,0 +1,121 @@
+#ifndef EVICTION_H
+#define EVICTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// handle of a cache entry, stored next to its value in the index
+typedef uint32_t entry_id_t;
+
+/*
+EvictionPolicy orders the evictable entries. It only sees entry ids, the
+Evictor maps them back to keys. Pinned entries are never given to the policy.
+*/
+class EvictionPolicy {
+   public:
+    virtual ~EvictionPolicy() {}
+    /*
+    @brief a new entry. fingerprint is the hash of its key, policies that
+    remember evicted keys (S3-FIFO) compare fingerprints only.
+    */
+    virtual void insert(entry_id_t id, uint64_t fingerprint) = 0;
+    // the entry was read
+    virtual void access(entry_id_t id) = 0;
+    // the entry left the cache for another reason than eviction (overwrite)
+    virtual void remove(entry_id_t id) = 0;
+    /*
+    @brief choose the next victim and forget it. false if there is no entry.
+    */
+    virtual bool evict(entry_id_t *id) = 0;
+    /*
+    @brief the entry evict() looks at first, nothing is changed. evict() may
+    still spare it if it was read. false if there is no entry.
+    */
+    virtual bool peek(entry_id_t *id) const = 0;
+    virtual size_t size() const = 0;
+    // bytes held for the entries and, for S3-FIFO, the ghost fingerprints
+    virtual size_t memory_usage() const = 0;
+};
+
+/*
+@brief "lru", "clock" or "s3fifo". NULL for an unknown name.
+*/
+std::unique_ptr<EvictionPolicy> make_eviction_policy(const std::string &name);
+
+/*
+FrequencySketch estimates how often a key hash was seen: a count-min sketch
+of 4 rows of 4 bit counters, 16 to a word. Once 10 * width hashes have been
+counted every counter is halved, so estimates follow recent popularity. This
+is the frequency filter of TinyLFU (Einziger et al., 2017).
+*/
+class FrequencySketch {
+   public:
+    // width: counters per row, rounded up to a power of two
+    explicit FrequencySketch(size_t width);
+
+    void increment(uint64_t hash);
+    // at most 15
+    uint32_t estimate(uint64_t hash) const;
+
+    size_t memory_usage() const { return table_.size() * sizeof(uint64_t); }
+
+   private:
+    static const int ROWS = 4;
+
+    // counter of hash in row, as a word index and a shift
+    void locate(uint64_t hash, int row, size_t *word, int *shift) const;
+    void halve();
+
+    std::vector<uint64_t> table_;  // ROWS rows of width_ / 16 words
+    size_t width_;
+    size_t additions_ = 0;
+    size_t sample_size_;
+};
+
+/*
+Evictor hands out entry ids, keeps the caller's handle of every entry (the
+server's value meta, 4 bytes, not a copy of the key) so a victim can be found
+in the index again, and keeps pinned entries away from the policy.
+Not thread safe, the server calls it from the event loop.
+*/
+class Evictor {
+   public:
+    explicit Evictor(std::unique_ptr<EvictionPolicy> policy);
+
+    // fingerprint: the hash of the entry's key, see EvictionPolicy::insert
+    entry_id_t add(uint32_t handle, uint64_t fingerprint, bool pinned);
+    void access(entry_id_t id);
+    void remove(entry_id_t id);
+    // handle next_victim() would most likely return, see EvictionPolicy::peek
+    bool peek_victim(uint32_t *handle) const;
+    /*
+    @brief handle of the next victim, the entry is released. false if every
+    entry is pinned or the cache is empty.
+    */
+    bool next_victim(uint32_t *handle);
+    // give a victim that could not be freed back to the policy, as a new entry
+    entry_id_t readmit(uint32_t handle, uint64_t fingerprint);
+
+    size_t size() const { return handles_.size() - free_ids_.size(); }
+    size_t pinned() const { return pinned_count_; }
+    size_t evictable() const { return policy_->size(); }
+    uint64_t evicted() const { return evicted_; }
+    size_t memory_usage() const;
+
+   private:
+    entry_id_t new_id(uint32_t handle);
+    void release(entry_id_t id);
+
+    std::unique_ptr<EvictionPolicy> policy_;
+    std::vector<uint32_t> handles_;
+    std::vector<bool> pinned_;
+    std::vector<entry_id_t> free_ids_;
+    size_t pinned_count_ = 0;
+    uint64_t evicted_ = 0;
+};
+
+#endif  // EVICTION_H
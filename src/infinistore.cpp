@@ -13,35 +13,818 @@
 #include <unistd.h>
 #include <uv.h>
 
+#include <algorithm>
 #include <chrono>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "config.h"
+#include "dedup.h"
+#include "eviction.h"
 #include "ibv_helper.h"
+#include "kvindex.h"
+#include "lease.h"
 #include "log.h"
 #include "mempool.h"
+#include "namespace.h"
+#include "prefix_tree.h"
 #include "protocol.h"
+#include "timer_wheel.h"
+#include "topology.h"
 #include "utils.h"
 
 #define BUFFER_SIZE (64 << 10)
-
-struct PTR {
+// how often empty slabs are checked, a slab is released after two checks
+#define SHRINK_INTERVAL_MS 30000
+// threads allocating and registering the initial slabs
+#define POOL_LOADER_THREADS 4
+// compaction: pools with a fragmentation above the threshold are compacted,
+// moving at most COMPACT_BUDGET bytes per run
+#define COMPACT_INTERVAL_MS 10000
+#define COMPACT_THRESHOLD 0.5
+#define COMPACT_BUDGET (64UL << 20)
+// the index is scanned for the values of the pool to compact once, and again
+// for the same pool no sooner than this after its values ran out
+#define COMPACT_RESCAN_MS 60000
+// values handed to a client more recently than this are not moved
+#define COMPACT_GRACE_MS 10000
+// values handed to a client more recently than this are not evicted, the
+// client may still be reading or writing them
+#define EVICT_GRACE_MS 1000
+// deleted and overwritten values are freed two epochs after they were
+// retired, so a client that got their address just before has had at least
+// one epoch to finish its RDMA read
+#define RECLAIM_EPOCH_MS 500
+// values freed per epoch at most, the rest wait for the next one
+#define RECLAIM_BATCH 65536
+// a dropped namespace retires its values DROP_BATCH index slots per tick
+#define DROP_INTERVAL_MS 1
+#define DROP_BATCH 65536
+// TTL timer wheel: 1024 ticks of 100 ms, deadlines further out take several turns
+#define TTL_TICK_MS 100
+#define TTL_WHEEL_SLOTS 1024
+// values handed out for an RDMA transfer stay in place until the client
+// releases the lease, or this long if it never does
+#define LEASE_TIMEOUT_MS 10000
+// counters per row of the admission sketch, 4 rows of 4 bit counters: 2 MB
+#define ADMISSION_SKETCH_WIDTH (1 << 22)
+// dedup: written values are fingerprinted in the background, at most
+// DEDUP_BUDGET bytes per run. Past DEDUP_QUEUE_MAX waiting values new ones
+// are left alone.
+#define DEDUP_INTERVAL_MS 100
+#define DEDUP_BUDGET (64UL << 20)
+#define DEDUP_QUEUE_MAX (1UL << 20)
+
+// one contiguous piece of a value
+struct segment_t {
     void *ptr;
     size_t size;
     int pool_idx;
 };
 
-std::unordered_map<std::string, PTR> kv_map;
+// flags of a PTR
+#define VALUE_SCATTERED 0x1  // the other segments are in value_tails
+#define VALUE_TTL 0x2        // the value has a deadline in value_deadlines
+#define VALUE_SHARED 0x4     // the blocks may be used by other values, see shared_blocks
+#define VALUE_DEDUPED 0x8    // shared by dedup, not by a clone
+
+/*
+PTR is the 16 byte index entry of a value. block, size and pool_idx describe
+the first segment: block is its block number in the pool, a pool is at most a
+slab so it fits 32 bits. ns is the id of the namespace holding the value. The
+fields a lookup does not need are in value_meta[meta], and the rare ones in
+maps keyed by meta, as told by flags.
+*/
+struct PTR {
+    uint32_t block;
+    uint32_t size;
+    uint16_t pool_idx;
+    uint8_t flags;
+    uint8_t ns;
+    uint32_t meta;
+};
+static_assert(sizeof(PTR) == 16, "PTR is an index entry, keep it small");
+
+struct value_meta_t {
+    // (uint32_t)uv_now() when the address was last handed to a client, the
+    // compactor and the evictor leave the value alone while a transfer may
+    // still be running. Compared modulo 2^32.
+    uint32_t last_access;
+    // handle in the evictor, unused without eviction
+    entry_id_t entry;
+    // hash_key() of the value's key, set once it is stored: the TTL wheel
+    // keeps meta, not the key, and finds the entry again with find_meta
+    size_t key_hash;
+};
+
+// the keys of a namespace
+struct keyspace_t {
+    FlatIndex<PTR> index;
+    // NULL with eviction_policy "none"
+    std::unique_ptr<Evictor> evictor;
+    // NULL unless prefix_index is set
+    std::unique_ptr<PrefixTree> prefix_tree;
+    std::unique_ptr<TimerWheel> ttl_wheel;
+};
+
+NamespaceTable *namespaces = NULL;
+// by namespace id, NULL for the ids of no live namespace
+std::vector<std::unique_ptr<keyspace_t>> keyspaces(MAX_NAMESPACES);
+// value_meta[i] is free while i is in free_meta
+std::vector<value_meta_t> value_meta;
+std::vector<uint32_t> free_meta;
+// the other segments of values that did not fit one contiguous run
+std::unordered_map<uint32_t, std::vector<segment_t>> value_tails;
+// uv_now() after which a value with a TTL is gone
+std::unordered_map<uint32_t, uint64_t> value_deadlines;
 uv_loop_t *loop;
 uv_tcp_t server;
+uv_timer_t shrink_timer;
+uv_timer_t compact_timer;
+uv_timer_t reclaim_timer;
+uv_timer_t ttl_timer;
+uv_timer_t dedup_timer;
+uv_timer_t drop_timer;
+uv_async_t pool_loaded_async;
+// false with the host memory backend, the server then makes no CUDA call
+bool cuda_enabled = true;
 // global ibv context
 struct ibv_context *ib_ctx;
 struct ibv_pd *pd;
-MM *mm;
+MM *mm = NULL;
+// what the keyspace of a new namespace is built with
+std::string eviction_policy;
+bool prefix_index = false;
+LeaseTable *leases = NULL;
+// NULL unless admission is set
+FrequencySketch *sketch = NULL;
+uint64_t rejected_writes = 0;
+// keys of if_absent writes that were already stored
+uint64_t skipped_writes = 0;
+
+// a value waiting for the end of its grace period
+struct retired_t {
+    uint64_t epoch;
+    PTR value;
+};
+std::deque<retired_t> retired;
+size_t retired_bytes = 0;
+uint64_t reclaim_epoch = 0;
+// of the most fragmented pool, as of the last compaction run
+double max_fragmentation = 0;
+
+// the keyspace of a dropped namespace, whose values are retired by
+// on_drop_timer from slot cursor of its index on
+struct dropping_t {
+    std::unique_ptr<keyspace_t> space;
+    size_t cursor;
+};
+std::deque<dropping_t> dropping;
+
+// references to the blocks of values with VALUE_SHARED, from clones and
+// from dedup if it is enabled
+DedupTable *shared_blocks = NULL;
+bool dedup = false;
+uint64_t cloned_keys = 0;
+// a written value to fingerprint once no client is using it, found again by its handle
+struct dedup_candidate_t {
+    uint8_t ns;
+    uint32_t meta;
+};
+std::deque<dedup_candidate_t> dedup_queue;
+
+// call fn(ns, space) for the keyspace of every live namespace
+template <typename F>
+void for_each_keyspace(F fn) {
+    for (size_t ns = 0; ns < keyspaces.size(); ++ns) {
+        if (keyspaces[ns]) {
+            fn((int)ns, *keyspaces[ns]);
+        }
+    }
+}
 
-int get_kvmap_len() { return kv_map.size(); }
+// id of namespace name, which gets an empty keyspace if it is new. -1 if
+// every id is in use. Only the control plane creates namespaces, clients
+// pick one that exists
+int open_namespace(const std::string &name) {
+    int ns = namespaces->open(name);
+    if (ns < 0 || keyspaces[ns]) {
+        return ns;
+    }
+    keyspace_t *space = new keyspace_t();
+    if (eviction_policy != "none") {
+        space->evictor.reset(new Evictor(make_eviction_policy(eviction_policy)));
+    }
+    if (prefix_index) {
+        space->prefix_tree.reset(new PrefixTree());
+    }
+    space->ttl_wheel.reset(new TimerWheel(TTL_WHEEL_SLOTS, TTL_TICK_MS, uv_now(loop)));
+    keyspaces[ns].reset(space);
+    return ns;
+}
+
+int get_kvmap_len() {
+    size_t len = 0;
+    for_each_keyspace([&len](int ns, keyspace_t &space) { len += space.index.size(); });
+    return len;
+}
+
+// the keys of a request are either strings or DIGEST_SIZE byte digests packed
+// in one buffer, which the index looks up without copying them
+template <typename T>
+size_t key_count(const T &req) {
+    return req.digests.empty() ? req.keys.size() : req.digests.size() / DIGEST_SIZE;
+}
+
+template <typename T>
+KeyView key_at(const T &req, size_t i) {
+    if (req.digests.empty()) {
+        return KeyView(req.keys[i]);
+    }
+    return KeyView(&req.digests[i * DIGEST_SIZE], DIGEST_SIZE);
+}
+
+template <typename T>
+bool valid_keys(const T &req) {
+    return req.digests.empty() || (req.keys.empty() && req.digests.size() % DIGEST_SIZE == 0);
+}
+
+KeyView key_at(const local_meta_t &meta, size_t i) {
+    if (meta.digests.empty()) {
+        return KeyView(meta.blocks[i].key);
+    }
+    return KeyView(&meta.digests[i * DIGEST_SIZE], DIGEST_SIZE);
+}
+
+bool valid_keys(const local_meta_t &meta) {
+    return meta.digests.empty() || meta.digests.size() == meta.blocks.size() * DIGEST_SIZE;
+}
+
+uint32_t now_ms32() { return (uint32_t)uv_now(loop); }
+
+// the entry of a new value whose first segment is size bytes at ptr
+PTR make_value(void *ptr, size_t size, int pool_idx) {
+    uint32_t meta;
+    if (!free_meta.empty()) {
+        meta = free_meta.back();
+        free_meta.pop_back();
+    }
+    else {
+        meta = value_meta.size();
+        value_meta.push_back(value_meta_t());
+    }
+    value_meta[meta] = {.last_access = now_ms32(), .entry = 0, .key_hash = 0};
+    return PTR{.block = (uint32_t)mm->get_block_index(pool_idx, ptr),
+               .size = (uint32_t)size,
+               .pool_idx = (uint16_t)pool_idx,
+               .flags = 0,
+               .meta = meta};
+}
+
+void *value_ptr(const PTR &value) { return mm->get_block_address(value.pool_idx, value.block); }
+
+// uv_now() after which the value is gone, 0: no TTL
+uint64_t value_deadline(const PTR &value) {
+    return (value.flags & VALUE_TTL) ? value_deadlines[value.meta] : 0;
+}
+
+// call fn(ptr, size, pool_idx) for every segment of the value, in order
+template <typename F>
+void for_each_segment(const PTR &value, F fn) {
+    fn(value_ptr(value), value.size, value.pool_idx);
+    if (value.flags & VALUE_SCATTERED) {
+        for (const auto &segment : value_tails[value.meta]) {
+            fn(segment.ptr, segment.size, segment.pool_idx);
+        }
+    }
+}
+
+// id of the block at ptr in shared_blocks
+uint64_t block_id(void *ptr, int pool_idx) {
+    return (uint64_t)pool_idx << 32 | mm->get_block_index(pool_idx, ptr);
+}
+
+// give the blocks of a value back to the pool, whether it was stored or not.
+// Return the bytes given back, less than the value's size if some of its
+// blocks are shared with other values
+size_t release_value(const PTR &value) {
+    size_t freed = 0;
+    for_each_segment(value, [&](void *ptr, size_t size, int pool_idx) {
+        // a shared block goes with its last value
+        if (!(value.flags & VALUE_SHARED) ||
+            shared_blocks->release(block_id(ptr, pool_idx), value.flags & VALUE_DEDUPED)) {
+            mm->deallocate(ptr, size, pool_idx);
+            freed += size;
+        }
+    });
+    if (value.flags & VALUE_SCATTERED) {
+        value_tails.erase(value.meta);
+    }
+    if (value.flags & VALUE_TTL) {
+        value_deadlines.erase(value.meta);
+    }
+    free_meta.push_back(value.meta);
+    return freed;
+}
+
+size_t value_bytes(const PTR &value) {
+    size_t bytes = 0;
+    for_each_segment(value, [&bytes](void *ptr, size_t size, int pool_idx) { bytes += size; });
+    return bytes;
+}
+
+// release a stored value, its bytes no longer count against its namespace
+size_t free_value(const PTR &value) {
+    namespaces->uncharge(value.ns, value_bytes(value));
+    return release_value(value);
+}
+
+// free the value in two epochs, clients may still read it until then. Its
+// bytes no longer count against its namespace
+void retire_value(PTR &&value) {
+    size_t bytes = value_bytes(value);
+    namespaces->uncharge(value.ns, bytes);
+    retired_bytes += bytes;
+    retired.push_back({.epoch = reclaim_epoch, .value = std::move(value)});
+}
+
+void on_reclaim_timer(uv_timer_t *timer) {
+    reclaim_epoch++;
+    leases->expire(uv_now(loop));
+    size_t reclaimed = 0;
+    while (!retired.empty() && retired.front().epoch + 2 <= reclaim_epoch &&
+           reclaimed++ < RECLAIM_BATCH) {
+        retired_t &front = retired.front();
+        if (leases->pinned(front.value.meta)) {
+            // a client is still reading or writing it, look again next epoch
+            retired.push_back({.epoch = reclaim_epoch, .value = front.value});
+        }
+        else {
+            retired_bytes -= value_bytes(front.value);
+            release_value(front.value);
+        }
+        retired.pop_front();
+    }
+}
+
+// remove key from the index and the prefix tree. Its value is freed right
+// away if defer is false, else retired. The caller has released its entry
+// in the evictor. Return the bytes given back to the pool.
+size_t erase_value(KeyView key, PTR *value, bool defer) {
+    keyspace_t &space = *keyspaces[value->ns];
+    size_t freed = 0;
+    if (defer) {
+        retire_value(std::move(*value));
+    }
+    else {
+        freed = free_value(*value);
+    }
+    if (space.prefix_tree) {
+        space.prefix_tree->remove(key);
+    }
+    space.index.erase(key);
+    return freed;
+}
+
+// delete, TTL or drop: the value may have just been handed to a client
+void delete_value(KeyView key, PTR *value) {
+    Evictor *evictor = keyspaces[value->ns]->evictor.get();
+    if (evictor) {
+        evictor->remove(value_meta[value->meta].entry);
+    }
+    erase_value(key, value, true);
+}
+
+// the value of key in namespace ns, NULL if there is none or its TTL has passed
+PTR *find_value(int ns, KeyView key) {
+    PTR *value = keyspaces[ns]->index.find(key);
+    if (value && (value->flags & VALUE_TTL) && value_deadline(*value) <= uv_now(loop)) {
+        return NULL;
+    }
+    return value;
+}
+
+// the stored value with handle meta in space and its key, NULL if there is
+// none: meta may have been freed, or reused for a value of another key
+PTR *find_meta(keyspace_t &space, uint32_t meta, KeyView *key) {
+    auto *slot = space.index.find_hashed(value_meta[meta].key_hash,
+                                         [meta](const PTR &value) { return value.meta == meta; });
+    if (!slot) {
+        return NULL;
+    }
+    *key = slot->key.view();
+    return &slot->value;
+}
+
+// find_value of every key of req, looked up as one batch
+template <typename T>
+void find_values(int ns, const T &req, size_t count, std::vector<PTR *> *values) {
+    std::vector<KeyView> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back(key_at(req, i));
+    }
+    keyspaces[ns]->index.find_batch(keys, values);
+    uint64_t now = uv_now(loop);
+    for (PTR *&value : *values) {
+        if (value && (value->flags & VALUE_TTL) && value_deadline(*value) <= now) {
+            value = NULL;
+        }
+    }
+}
+
+// link the keys of a chained write in the prefix tree
+template <typename T>
+void chain_keys(int ns, const T &req, size_t count) {
+    PrefixTree *prefix_tree = keyspaces[ns]->prefix_tree.get();
+    if (!prefix_tree || !req.chain) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        prefix_tree->insert(key_at(req, i), i == 0 ? KeyView(req.parent) : key_at(req, i - 1));
+    }
+}
+
+// insert or replace the value of key in namespace ns, which is charged for
+// it. ttl_ms: 0 for no TTL
+void insert_value(int ns, KeyView key, PTR value, bool pinned, unsigned int ttl_ms) {
+    keyspace_t &space = *keyspaces[ns];
+    PTR *old = space.index.find(key);
+    if (old) {
+        if (space.evictor) {
+            space.evictor->remove(value_meta[old->meta].entry);
+        }
+        // a client may be reading the old value
+        retire_value(std::move(*old));
+    }
+    size_t key_hash = hash_key(key);
+    value_meta[value.meta].key_hash = key_hash;
+    if (space.evictor) {
+        value_meta[value.meta].entry = space.evictor->add(value.meta, key_hash, pinned);
+    }
+    if (ttl_ms > 0) {
+        uint64_t deadline = uv_now(loop) + ttl_ms;
+        value.flags |= VALUE_TTL;
+        value_deadlines[value.meta] = deadline;
+        space.ttl_wheel->add(value.meta, deadline);
+    }
+    if (dedup && dedup_queue.size() < DEDUP_QUEUE_MAX &&
+        !(value.flags & (VALUE_SCATTERED | VALUE_SHARED))) {
+        dedup_queue.push_back({.ns = (uint8_t)ns, .meta = value.meta});
+    }
+    value.ns = ns;
+    namespaces->charge(ns, value_bytes(value));
+    space.index.insert_or_assign(key, std::move(value));
+}
+
+void on_ttl_timer(uv_timer_t *timer) {
+    uint64_t now = uv_now(loop);
+    std::vector<uint32_t> expired;
+    for_each_keyspace([&](int ns, keyspace_t &space) {
+        expired.clear();
+        space.ttl_wheel->advance(now, &expired);
+        for (uint32_t meta : expired) {
+            // the value may have been deleted, or meta reused for another one, since
+            KeyView slot_key(NULL, 0);
+            PTR *value = find_meta(space, meta, &slot_key);
+            if (value && (value->flags & VALUE_TTL) && value_deadline(*value) <= now) {
+                // the slot may move while the key is erased
+                std::string key = slot_key.str();
+                delete_value(key, value);
+            }
+        }
+    });
+}
+
+void touch_value(PTR *value) {
+    value_meta_t &meta = value_meta[value->meta];
+    meta.last_access = now_ms32();
+    Evictor *evictor = keyspaces[value->ns]->evictor.get();
+    if (evictor) {
+        evictor->access(meta.entry);
+    }
+}
+
+// free victims of the eviction policy of namespace ns until at least bytes
+// are released, return the bytes released
+size_t evict(int ns, size_t bytes) {
+    keyspace_t &space = *keyspaces[ns];
+    Evictor *evictor = space.evictor.get();
+    if (!evictor) {
+        return 0;
+    }
+    uint32_t now = now_ms32();
+    size_t freed = 0;
+    // every entry is looked at once at most, even if all of them are in use
+    size_t candidates = evictor->evictable();
+    uint32_t handle;
+    std::string key;
+    while (freed < bytes && candidates-- > 0 && evictor->next_victim(&handle)) {
+        KeyView slot_key(NULL, 0);
+        PTR *value = find_meta(space, handle, &slot_key);
+        assert(value != NULL);
+        value_meta_t &meta = value_meta[handle];
+        if ((uint32_t)(now - meta.last_access) < EVICT_GRACE_MS || leases->pinned(handle)) {
+            meta.entry = evictor->readmit(handle, meta.key_hash);
+            continue;
+        }
+        // the slot may move while the key is erased
+        key.assign(slot_key.data, slot_key.size);
+        // a shared block is only freed with its last value
+        freed += erase_value(key, value, false);
+    }
+    DEBUG("evicted {} bytes", freed);
+    return freed;
+}
+
+// point the value at a stored block with the same bytes and free its own,
+// or make its block the one later values with these bytes share. Only values
+// of the same namespace share a block: a tenant neither reads nor times
+// another one's data through it. A reused namespace id starts apart too.
+void dedup_value(PTR *value) {
+    uint64_t id = block_id(value_ptr(*value), value->pool_idx);
+    uint64_t scope = (uint64_t)namespaces->generation(value->ns) << 32 | value->ns;
+    uint64_t shared = shared_blocks->add(id, value_ptr(*value), value->size, scope);
+    if (shared != id) {
+        mm->deallocate(value_ptr(*value), value->size, value->pool_idx);
+        value->pool_idx = shared >> 32;
+        value->block = (uint32_t)shared;
+    }
+    value->flags |= VALUE_SHARED | VALUE_DEDUPED;
+}
+
+// fingerprint the values written since the last run once their transfer is
+// over: no lease on them and not handed out for EVICT_GRACE_MS, the rule the
+// evictor frees blocks by
+void on_dedup_timer(uv_timer_t *timer) {
+    uint32_t now = now_ms32();
+    size_t hashed = 0;
+    // values still in use go to the back and wait for the next run
+    size_t n = dedup_queue.size();
+    while (n-- > 0 && hashed < DEDUP_BUDGET) {
+        dedup_candidate_t candidate = dedup_queue.front();
+        dedup_queue.pop_front();
+        // the key or its namespace may have been deleted or rewritten since
+        keyspace_t *space = keyspaces[candidate.ns].get();
+        KeyView key(NULL, 0);
+        PTR *value = space ? find_meta(*space, candidate.meta, &key) : NULL;
+        if (!value || (value->flags & VALUE_SHARED)) {
+            continue;
+        }
+        if ((uint32_t)(now - value_meta[value->meta].last_access) < EVICT_GRACE_MS ||
+            leases->pinned(value->meta)) {
+            dedup_queue.push_back(candidate);
+            continue;
+        }
+        hashed += value->size;
+        dedup_value(value);
+    }
+}
+
+// a read or an existence check of key, counted by the admission sketch
+void record_access(KeyView key) {
+    if (sketch) {
+        sketch->increment(hash_key(key));
+    }
+}
+
+// mean estimated frequency of the keys of a write
+template <typename T>
+uint32_t write_frequency(const T &req, size_t count) {
+    if (!sketch || count == 0) {
+        return 0;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += sketch->estimate(hash_key(key_at(req, i)));
+    }
+    return sum / count;
+}
+
+// may values seen freq times push out the next victim of namespace ns
+bool admit(int ns, uint32_t freq) {
+    uint32_t victim;
+    if (!sketch || !keyspaces[ns]->evictor->peek_victim(&victim)) {
+        return true;
+    }
+    return freq > sketch->estimate(value_meta[victim].key_hash);
+}
+
+// make room for bytes more in the quota of namespace ns by evicting from it,
+// false if they do not fit
+bool fit_quota(int ns, size_t bytes) {
+    size_t quota = namespaces->quota(ns);
+    if (quota > 0 && bytes > quota) {
+        // evicting the whole namespace would not make room
+        ERROR("A write of {} bytes is larger than the quota of namespace {}", bytes,
+              namespaces->name(ns));
+        return false;
+    }
+    while (namespaces->over_quota(ns, bytes)) {
+        size_t used = namespaces->used(ns);
+        evict(ns, used + bytes - namespaces->quota(ns));
+        if (namespaces->used(ns) == used) {
+            ERROR("Namespace {} is over its quota of {} bytes", namespaces->name(ns),
+                  namespaces->quota(ns));
+            return false;
+        }
+    }
+    return true;
+}
+
+// call alloc() for a write of bytes to namespace ns until it succeeds. A
+// namespace over its quota first evicts from itself, then every failure
+// evicts about bytes more from the namespace furthest above its quota, see
+// NamespaceTable::victim. false once nothing is left to evict, or when the
+// next victim is used more often than freq (admission), *rejected is then set.
+template <typename F>
+bool allocate_or_evict(int ns, size_t bytes, uint32_t freq, bool *rejected, F alloc) {
+    *rejected = false;
+    if (!fit_quota(ns, bytes)) {
+        return false;
+    }
+    while (!alloc()) {
+        int victim = namespaces->victim(ns);
+        if (!admit(victim, freq)) {
+            *rejected = true;
+            return false;
+        }
+        // the writer's own values are the last resort
+        if (evict(victim, bytes) == 0 && (victim == ns || evict(ns, bytes) == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// bytes of an unordered_map: one node per entry (the pair, the next pointer
+// and the cached hash) and the bucket array
+template <typename M>
+size_t map_bytes(const M &map) {
+    return map.size() * (sizeof(typename M::value_type) + 2 * sizeof(void *)) +
+           map.bucket_count() * sizeof(void *);
+}
+
+// bytes of the index of a namespace and of what is kept per key beside it
+size_t keyspace_bytes(keyspace_t &space) {
+    size_t bytes = space.index.memory_usage() + space.ttl_wheel->memory_usage();
+    if (space.evictor) {
+        bytes += space.evictor->memory_usage();
+    }
+    if (space.prefix_tree) {
+        bytes += space.prefix_tree->memory_usage();
+    }
+    return bytes;
+}
+
+std::map<std::string, size_t> get_mem_stats() {
+    std::map<std::string, size_t> stats;
+    if (mm) {
+        stats["pool_size"] = mm->get_total_size();
+        stats["loading_size"] = mm->get_loading_size();
+        stats["used_size"] = mm->get_used_size();
+        stats["max_fragmentation_pct"] = max_fragmentation * 100;
+    }
+    // index_bytes: everything the server keeps per key, the values aside
+    size_t keys = 0, index_bytes = value_meta.capacity() * sizeof(value_meta_t) +
+                                   free_meta.capacity() * sizeof(uint32_t) +
+                                   map_bytes(value_tails) + map_bytes(value_deadlines);
+    for (const auto &tail : value_tails) {
+        index_bytes += tail.second.capacity() * sizeof(segment_t);
+    }
+    size_t key_arena_bytes = 0, ttl_timers = 0, evicted = 0, pinned = 0;
+    for_each_keyspace([&](int ns, keyspace_t &space) {
+        keys += space.index.size();
+        index_bytes += keyspace_bytes(space);
+        key_arena_bytes += space.index.key_arena_bytes();
+        ttl_timers += space.ttl_wheel->size();
+        if (space.evictor) {
+            evicted += space.evictor->evicted();
+            pinned += space.evictor->pinned();
+        }
+    });
+    stats["index_bytes"] = index_bytes;
+    stats["key_arena_bytes"] = key_arena_bytes;
+    if (keys > 0) {
+        stats["index_bytes_per_key"] = index_bytes / keys;
+    }
+    if (eviction_policy != "none") {
+        stats["evicted_keys"] = evicted;
+        stats["pinned_keys"] = pinned;
+    }
+    stats["retired_bytes"] = retired_bytes;
+    stats["skipped_writes"] = skipped_writes;
+    stats["ttl_timers"] = ttl_timers;
+    if (namespaces) {
+        stats["namespaces"] = namespaces->size();
+    }
+    if (leases) {
+        stats["active_leases"] = leases->size();
+        stats["leased_values"] = leases->pinned_values();
+        stats["expired_leases"] = leases->expired();
+    }
+    // saved: bytes of the values sharing blocks less the bytes of the blocks
+    size_t saved = 0, dedup_saved = 0;
+    if (shared_blocks) {
+        saved = shared_blocks->logical_bytes() - shared_blocks->physical_bytes();
+        dedup_saved =
+            shared_blocks->dedup_logical_bytes() - shared_blocks->dedup_physical_bytes();
+        stats["cloned_keys"] = cloned_keys;
+        stats["clone_saved_bytes"] = saved - dedup_saved;
+    }
+    if (dedup) {
+        size_t physical = shared_blocks->dedup_physical_bytes();
+        stats["dedup_blocks"] = shared_blocks->dedup_blocks();
+        stats["dedup_logical_bytes"] = shared_blocks->dedup_logical_bytes();
+        stats["dedup_physical_bytes"] = physical;
+        stats["dedup_saved_bytes"] = dedup_saved;
+        if (physical > 0) {
+            stats["dedup_ratio_pct"] = shared_blocks->dedup_logical_bytes() * 100 / physical;
+        }
+        stats["dedup_hashed_bytes"] = shared_blocks->hashed_bytes();
+        stats["dedup_hash_ns"] = shared_blocks->hash_ns();
+        stats["dedup_queue"] = dedup_queue.size();
+    }
+    if (sketch) {
+        stats["rejected_writes"] = rejected_writes;
+        stats["admission_sketch_bytes"] = sketch->memory_usage();
+    }
+    return stats;
+}
+
+// usage of every namespace by name, the default one is ""
+std::map<std::string, std::map<std::string, size_t>> get_namespace_stats() {
+    std::map<std::string, std::map<std::string, size_t>> stats;
+    if (!namespaces) {
+        return stats;
+    }
+    namespaces->for_each([&](int ns) {
+        keyspace_t &space = *keyspaces[ns];
+        std::map<std::string, size_t> &s = stats[namespaces->name(ns)];
+        s["keys"] = space.index.size();
+        s["used_bytes"] = namespaces->used(ns);
+        s["quota_bytes"] = namespaces->quota(ns);
+        s["index_bytes"] = keyspace_bytes(space);
+        if (space.evictor) {
+            s["evicted_keys"] = space.evictor->evicted();
+            s["pinned_keys"] = space.evictor->pinned();
+        }
+    });
+    return stats;
+}
+
+// namespace name is created if needed. A quota below its usage is enforced
+// by its next write. Return -1 if every namespace id is in use
+int set_namespace_quota(const std::string &name, size_t quota) {
+    int ns = open_namespace(name);
+    if (ns < 0) {
+        ERROR("Too many namespaces, can't create {}", name);
+        return -1;
+    }
+    namespaces->set_quota(ns, quota);
+    INFO("namespace {}: quota {} bytes", name, quota);
+    return 0;
+}
+
+// retire the values of the namespace dropped first, DROP_BATCH slots of its
+// index per tick, and free its keyspace after the last one
+void on_drop_timer(uv_timer_t *timer) {
+    dropping_t &front = dropping.front();
+    if (front.space->index.for_each_slice(&front.cursor, DROP_BATCH, [](KeyView key, PTR &value) {
+            retire_value(std::move(value));
+        })) {
+        return;
+    }
+    DEBUG("dropped keyspace of {} keys freed", front.space->index.size());
+    dropping.pop_front();
+    if (dropping.empty()) {
+        uv_timer_stop(timer);
+    }
+}
+
+// drop namespace name with all its keys. The name is gone at once and the
+// clients using it get NAMESPACE_GONE, the values are retired in the
+// background by on_drop_timer, so reads already handed an address complete.
+// The id is reused once they all are. Return the keys dropped, -1 if there is
+// no such namespace or it is the default one.
+int drop_namespace(const std::string &name) {
+    int ns = namespaces->find(name);
+    if (ns < 0 || !namespaces->drop(ns)) {
+        return -1;
+    }
+    size_t keys = keyspaces[ns]->index.size();
+    if (dropping.empty()) {
+        uv_timer_start(&drop_timer, on_drop_timer, DROP_INTERVAL_MS, DROP_INTERVAL_MS);
+    }
+    dropping.push_back({.space = std::move(keyspaces[ns]), .cursor = 0});
+    INFO("dropped namespace {}: {} keys", name, keys);
+    return keys;
+}
 
 typedef enum {
     READ_HEADER,
@@ -60,7 +843,8 @@ struct Client {
     // TODO: remove send_buffer
     char *send_buffer = NULL;
 
-    cudaStream_t cuda_stream;
+    // created on the first local GPU request, RDMA clients never get one
+    cudaStream_t cuda_stream = NULL;
 
     rdma_conn_info_t remote_info;
     rdma_conn_info_t local_info;
@@ -72,6 +856,11 @@ struct Client {
 
     int remain;
 
+    // namespace of the keys of the client's requests, and its generation when
+    // the client picked it: the id may have been dropped and reused since
+    int ns = DEFAULT_NAMESPACE;
+    uint32_t ns_generation = 0;
+
     Client() = default;
     Client(const Client &) = delete;
     ~Client();
@@ -87,8 +876,10 @@ Client::~Client() {
         free(recv_buffer);
         recv_buffer = NULL;
     }
-    cudaStreamDestroy(cuda_stream);
-    INFO("destroy cuda stream");
+    if (cuda_stream) {
+        cudaStreamDestroy(cuda_stream);
+        INFO("destroy cuda stream");
+    }
     if (qp) {
         struct ibv_qp_attr attr;
         memset(&attr, 0, sizeof(attr));
@@ -163,7 +954,19 @@ void after_ipc_close_completion(uv_work_t *req, int status) {
     delete req;
 }
 
-int read_cache(client_t *client, local_meta_t &meta) {
+// local GPU requests need the cuda memory backend and a stream per client
+bool init_local_client(client_t *client) {
+    if (!cuda_enabled) {
+        ERROR("Local GPU access is not available with the host memory backend");
+        return false;
+    }
+    if (client->cuda_stream == NULL) {
+        CHECK_CUDA(cudaStreamCreate(&client->cuda_stream));
+    }
+    return true;
+}
+
+int read_cache(client_t *client, int ns, local_meta_t &meta) {
     const header_t *header = &client->header;
     void *d_ptr;
 
@@ -172,24 +975,32 @@ int read_cache(client_t *client, local_meta_t &meta) {
 
     CHECK_CUDA(cudaIpcOpenMemHandle(&d_ptr, meta.ipc_handle, cudaIpcMemLazyEnablePeerAccess));
 
-    for (auto &block : meta.blocks) {
-        if (kv_map.count(block.key) == 0) {
-            std::cout << "Key not found: " << block.key << std::endl;
+    std::vector<PTR *> values;
+    find_values(ns, meta, meta.blocks.size(), &values);
+    for (size_t i = 0; i < meta.blocks.size(); ++i) {
+        const block_t &block = meta.blocks[i];
+        record_access(key_at(meta, i));
+        PTR *found = values[i];
+        if (found == NULL) {
+            std::cout << "Key not found: " << key_at(meta, i).str() << std::endl;
             CHECK_CUDA(cudaIpcCloseMemHandle(d_ptr));
             send_resp(client, KEY_NOT_FOUND, NULL, 0);
             return 0;
         }
 
         // key found
-        // std::cout << "Key found: " << block.key << std::endl;
-        void *h_src = kv_map[block.key].ptr;
-        if (h_src == NULL) {
-            send_resp(client, KEY_NOT_FOUND, NULL, 0);
-            return 0;
-        }
-        // push the host cpu data to local device
-        CHECK_CUDA(cudaMemcpyAsync((char *)d_ptr + block.offset, h_src, meta.block_size,
-                                   cudaMemcpyHostToDevice, client->cuda_stream));
+        PTR &ptr = *found;
+        touch_value(&ptr);
+        // push the host cpu data to local device, segment by segment
+        size_t pos = 0;
+        for_each_segment(ptr, [&](void *src, size_t size, int pool_idx) {
+            size_t len = std::min(size, (size_t)meta.block_size - pos);
+            if (len > 0) {
+                CHECK_CUDA(cudaMemcpyAsync((char *)d_ptr + block.offset + pos, src, len,
+                                           cudaMemcpyHostToDevice, client->cuda_stream));
+            }
+            pos += len;
+        });
     }
     client->remain++;
     wqueue_data_t *wqueue_data = new wqueue_data_t();
@@ -204,27 +1015,95 @@ int read_cache(client_t *client, local_meta_t &meta) {
     return 0;
 }
 
-int write_cache(client_t *client, local_meta_t &meta) {
-    // allocate host memory
+// the blocks of meta at positions index, keeping its write options
+local_meta_t select_keys(const local_meta_t &meta, const std::vector<size_t> &index) {
+    local_meta_t selected = {
+        .ipc_handle = meta.ipc_handle,
+        .block_size = meta.block_size,
+        .pinned = meta.pinned,
+        .chain = meta.chain,
+        .parent = meta.parent,
+        .ttl_ms = meta.ttl_ms,
+        .if_absent = meta.if_absent,
+    };
+    for (size_t i : index) {
+        selected.blocks.push_back(meta.blocks[i]);
+        if (!meta.digests.empty()) {
+            selected.digests.insert(selected.digests.end(), &meta.digests[i * DIGEST_SIZE],
+                                    &meta.digests[(i + 1) * DIGEST_SIZE]);
+        }
+    }
+    return selected;
+}
+
+int write_cache(client_t *client, int ns, local_meta_t &request) {
+    size_t total = request.blocks.size();
+    // if_absent: bit i % 8 of present[i / 8] is set if key i was already stored
+    std::vector<uint8_t> present;
+    local_meta_t absent;
+    local_meta_t &meta = request.if_absent ? absent : request;
+    if (request.if_absent) {
+        std::vector<PTR *> stored;
+        find_values(ns, request, total, &stored);
+        present.assign((total + 7) / 8, 0);
+        std::vector<size_t> index;
+        index.reserve(total);
+        for (size_t i = 0; i < total; ++i) {
+            if (stored[i]) {
+                // another writer got there first, its value counts as used
+                touch_value(stored[i]);
+                present[i / 8] |= 1 << (i % 8);
+            }
+            else {
+                index.push_back(i);
+            }
+        }
+        skipped_writes += total - index.size();
+        absent = select_keys(request, index);
+    }
+    if (meta.blocks.empty()) {
+        // every key is stored, there is nothing to copy
+        chain_keys(ns, request, total);
+        send_resp(client, TASK_ACCEPTED, present.data(), present.size());
+        reset_client_read_state(client);
+        return 0;
+    }
+
+    // allocate host memory for all blocks at once, so a failure leaves nothing behind
+    std::vector<extent_t> extents;
+    size_t count = meta.blocks.size();
+    bool rejected;
+    uint32_t freq = write_frequency(meta, count);
+    if (!allocate_or_evict(ns, meta.block_size * count, freq, &rejected, [&]() {
+            return mm->allocate_batch(meta.block_size, count, &extents);
+        })) {
+        if (rejected) {
+            rejected_writes++;
+            return NOT_ADMITTED;
+        }
+        ERROR("Failed to allocat host memroy");
+        return SYSTEM_ERROR;
+    }
+
     void *d_ptr;
     CHECK_CUDA(cudaIpcOpenMemHandle(&d_ptr, meta.ipc_handle, cudaIpcMemLazyEnablePeerAccess));
 
-    for (auto &block : meta.blocks) {
-        // pull data from local device to CPU host
-        void *h_dst;
-        int pool_idx;
-        h_dst = mm->allocate(meta.block_size, &pool_idx);
-        if (h_dst == NULL) {
-            ERROR("Failed to allocat host memroy");
-            CHECK_CUDA(cudaIpcCloseMemHandle(d_ptr));
-            return SYSTEM_ERROR;
+    size_t i = 0;
+    for (const auto &extent : extents) {
+        for (size_t j = 0; j < extent.count; ++j, ++i) {
+            const block_t &block = meta.blocks[i];
+            void *h_dst = (char *)extent.ptr + j * extent.stride;
+            // how to deal with memory overflow?
+            // pull data from local device to CPU host
+            CHECK_CUDA(cudaMemcpyAsync(h_dst, (char *)d_ptr + block.offset, meta.block_size,
+                                       cudaMemcpyDeviceToHost, client->cuda_stream));
+            insert_value(ns, key_at(meta, i),
+                         make_value(h_dst, meta.block_size, extent.pool_idx), meta.pinned,
+                         meta.ttl_ms);
         }
-        // how to deal with memory overflow?
-        // pull data from local device to CPU host
-        CHECK_CUDA(cudaMemcpyAsync(h_dst, (char *)d_ptr + block.offset, meta.block_size,
-                                   cudaMemcpyDeviceToHost, client->cuda_stream));
-        kv_map[block.key] = {.ptr = h_dst, .size = meta.block_size, .pool_idx = pool_idx};
     }
+    // the keys that were stored are linked too
+    chain_keys(ns, request, total);
     client->remain++;
     wqueue_data_t *wqueue_data = new wqueue_data_t();
     wqueue_data->client = client;
@@ -233,8 +1112,7 @@ int write_cache(client_t *client, local_meta_t &meta) {
     req->data = (void *)wqueue_data;
     uv_queue_work(loop, req, wait_for_ipc_close_completion, after_ipc_close_completion);
 
-    int return_code = TASK_ACCEPTED;
-    send_resp(client, TASK_ACCEPTED, NULL, 0);
+    send_resp(client, TASK_ACCEPTED, present.data(), present.size());
 
     reset_client_read_state(client);
     return 0;
@@ -433,18 +1311,61 @@ int sync_stream(client_t *client) {
     return 0;
 }
 
-int check_key(client_t *client, std::string &key_to_check) {
-    int ret = kv_map.count(key_to_check) ? 0 : 1;
+int check_key(client_t *client, int ns, std::string &key_to_check) {
+    record_access(key_to_check);
+    int ret = find_value(ns, key_to_check) ? 0 : 1;
     send_resp(client, FINISH, &ret, sizeof(ret));
     reset_client_read_state(client);
     return 0;
 }
 
-int get_match_last_index(client_t *client, keys_t &keys_meta) {
-    int left = 0, right = keys_meta.keys.size();
+// answer with a bitmap, bit i % 8 of byte i / 8 is set if key i is stored
+int check_keys(client_t *client, int ns, keys_t &keys_meta) {
+    size_t count = key_count(keys_meta);
+    std::vector<uint8_t> bitmap((count + 7) / 8, 0);
+    std::vector<PTR *> values;
+    find_values(ns, keys_meta, count, &values);
+    for (size_t i = 0; i < count; ++i) {
+        record_access(key_at(keys_meta, i));
+        if (values[i]) {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+    send_resp(client, FINISH, bitmap.data(), bitmap.size());
+    reset_client_read_state(client);
+    return 0;
+}
+
+int get_match_last_index(client_t *client, int ns, keys_t &keys_meta) {
+    for (size_t i = 0; i < key_count(keys_meta); ++i) {
+        record_access(key_at(keys_meta, i));
+    }
+    keyspace_t &space = *keyspaces[ns];
+    if (space.prefix_tree) {
+        // one walk down the chain, correct when a block in the middle is missing
+        std::vector<KeyView> keys;
+        keys.reserve(key_count(keys_meta));
+        for (size_t i = 0; i < key_count(keys_meta); ++i) {
+            keys.push_back(key_at(keys_meta, i));
+        }
+        int last = (int)space.prefix_tree->match(keys) - 1;
+        send_resp(client, FINISH, &last, sizeof(last));
+        reset_client_read_state(client);
+        return 0;
+    }
+
+    // without the prefix tree, key i is assumed to imply every key before it
+    int left = 0, right = key_count(keys_meta);
     while (left < right) {
         int mid = left + (right - left) / 2;
-        if (kv_map.count(keys_meta.keys[mid])) {
+        // the next probe is one of the two midpoints around mid, start loading both
+        if (left < mid) {
+            space.index.prefetch(key_at(keys_meta, left + (mid - left) / 2));
+        }
+        if (mid + 1 < right) {
+            space.index.prefetch(key_at(keys_meta, mid + 1 + (right - mid - 1) / 2));
+        }
+        if (find_value(ns, key_at(keys_meta, mid))) {
             left = mid + 1;
         }
         else {
@@ -457,28 +1378,252 @@ int get_match_last_index(client_t *client, keys_t &keys_meta) {
     return 0;
 }
 
+int delete_keys(client_t *client, int ns, keys_t &keys_meta) {
+    int deleted = 0;
+    for (size_t i = 0; i < key_count(keys_meta); ++i) {
+        KeyView key = key_at(keys_meta, i);
+        PTR *value = find_value(ns, key);
+        if (value) {
+            delete_value(key, value);
+            deleted++;
+            continue;
+        }
+        // a value past its TTL that the timer has not erased yet goes too, uncounted
+        value = keyspaces[ns]->index.find(key);
+        if (value) {
+            delete_value(key, value);
+        }
+    }
+    DEBUG("deleted {} of {} keys", deleted, key_count(keys_meta));
+    send_resp(client, FINISH, &deleted, sizeof(deleted));
+    reset_client_read_state(client);
+    return 0;
+}
+
+// the next requests of client are about the keys of namespace name, which
+// the control plane created
+int use_namespace(client_t *client, std::string &name) {
+    int ns = namespaces->find(name);
+    if (ns < 0) {
+        ERROR("No namespace {}", name);
+        return KEY_NOT_FOUND;
+    }
+    client->ns = ns;
+    client->ns_generation = namespaces->generation(ns);
+    send_resp(client, FINISH, NULL, 0);
+    reset_client_read_state(client);
+    return 0;
+}
+
+int release_leases(client_t *client, leases_t &req) {
+    int released = 0;
+    for (uint64_t id : req.leases) {
+        // a lease that timed out is gone already
+        released += leases->release(id);
+    }
+    send_resp(client, FINISH, &released, sizeof(released));
+    reset_client_read_state(client);
+    return 0;
+}
+
+// count one more value using each block of value
+void retain_blocks(const PTR &value) {
+    for_each_segment(value, [](void *ptr, size_t size, int pool_idx) {
+        shared_blocks->retain(block_id(ptr, pool_idx), ptr, size);
+    });
+}
+
+// a new value using the blocks of value, which must be shared already
+PTR clone_value(const PTR &value) {
+    PTR clone = make_value(value_ptr(value), value.size, value.pool_idx);
+    clone.flags = VALUE_SHARED | (value.flags & VALUE_SCATTERED);
+    if (value.flags & VALUE_SCATTERED) {
+        value_tails[clone.meta] = value_tails[value.meta];
+    }
+    retain_blocks(clone);
+    return clone;
+}
+
+// give the keys of req the values of req.sources, all or nothing. No data is
+// copied, the values share their blocks. Stored values are never written in
+// place, so a later write to either key replaces its value and leaves the
+// other one alone.
+int clone_keys(client_t *client, int ns, clone_request &req) {
+    int count = key_count(req);
+    if (count == 0 || count != (int)key_count(req.sources)) {
+        ERROR("Invalid clone of {} keys from {} keys", count, key_count(req.sources));
+        return INVALID_REQ;
+    }
+    std::vector<PTR *> sources;
+    find_values(ns, req.sources, count, &sources);
+    if (std::find(sources.begin(), sources.end(), (PTR *)NULL) != sources.end()) {
+        return KEY_NOT_FOUND;
+    }
+    // build every clone before inserting, which may move the entries of sources
+    std::vector<PTR> clones;
+    clones.reserve(count);
+    for (PTR *source : sources) {
+        if (!(source->flags & VALUE_SHARED)) {
+            retain_blocks(*source);
+            source->flags |= VALUE_SHARED;
+        }
+        clones.push_back(clone_value(*source));
+    }
+    for (int i = 0; i < count; ++i) {
+        insert_value(ns, key_at(req, i), clones[i], req.pinned, req.ttl_ms);
+    }
+    chain_keys(ns, req, count);
+    cloned_keys += count;
+    send_resp(client, FINISH, &count, sizeof(count));
+    reset_client_read_state(client);
+    return 0;
+}
+
+int drop_subtree(client_t *client, int ns, std::string &key) {
+    keyspace_t &space = *keyspaces[ns];
+    if (!space.prefix_tree) {
+        ERROR("Prefix index is not enabled");
+        return INVALID_REQ;
+    }
+    std::vector<std::string> keys;
+    space.prefix_tree->drop_subtree(key, &keys);
+    int dropped = 0;
+    for (const auto &k : keys) {
+        PTR *value = space.index.find(k);
+        if (value == NULL) {
+            continue;
+        }
+        delete_value(k, value);
+        dropped++;
+    }
+    INFO("dropped {} values", dropped);
+    send_resp(client, FINISH, &dropped, sizeof(dropped));
+    reset_client_read_state(client);
+    return 0;
+}
+
+// the extents a client reads or writes a value through
+std::vector<remote_block_t> extents_of(const PTR &value) {
+    std::vector<remote_block_t> extents;
+    for_each_segment(value, [&extents](void *ptr, size_t size, int pool_idx) {
+        DEBUG("rkey: {}, local_addr: {}, size : {}", mm->get_rkey(pool_idx), (uintptr_t)ptr, size);
+        extents.push_back(
+            {.rkey = mm->get_rkey(pool_idx), .remote_addr = (uintptr_t)ptr, .size = size});
+    });
+    return extents;
+}
+
+// allocate one value per key, all or nothing. *rejected: see allocate_or_evict
+bool allocate_values(int ns, const remote_meta_request &req, std::vector<PTR> *values,
+                     bool *rejected) {
+    values->reserve(key_count(req));
+    uint32_t freq = write_frequency(req, key_count(req));
+    if (req.sizes.empty()) {
+        // same size for every key: as few contiguous extents as possible
+        std::vector<extent_t> extents;
+        size_t count = key_count(req);
+        if (!allocate_or_evict(ns, req.block_size * count, freq, rejected, [&]() {
+                return mm->allocate_batch(req.block_size, count, &extents);
+            })) {
+            return false;
+        }
+        DEBUG("{} keys allocated in {} extents", key_count(req), extents.size());
+        for (const auto &extent : extents) {
+            for (size_t j = 0; j < extent.count; ++j) {
+                values->push_back(make_value((char *)extent.ptr + j * extent.stride,
+                                             req.block_size, extent.pool_idx));
+            }
+        }
+        return true;
+    }
+
+    // values are only charged once inserted: the whole batch has to fit the
+    // quota, not each value by itself
+    size_t total = 0;
+    for (size_t size : req.sizes) {
+        total += size;
+    }
+    *rejected = false;
+    if (!fit_quota(ns, total)) {
+        return false;
+    }
+    std::vector<extent_t> segments;
+    for (size_t size : req.sizes) {
+        if (!allocate_or_evict(ns, size, freq, rejected,
+                               [&]() { return mm->allocate_scattered(size, &segments); })) {
+            // never stored, so never charged
+            for (const auto &value : *values) {
+                release_value(value);
+            }
+            values->clear();
+            return false;
+        }
+        PTR value = make_value(segments[0].ptr, segments[0].stride, segments[0].pool_idx);
+        if (segments.size() > 1) {
+            value.flags |= VALUE_SCATTERED;
+            std::vector<segment_t> &tail = value_tails[value.meta];
+            for (size_t j = 1; j < segments.size(); ++j) {
+                tail.push_back({.ptr = segments[j].ptr,
+                                .size = segments[j].stride,
+                                .pool_idx = segments[j].pool_idx});
+            }
+        }
+        values->push_back(std::move(value));
+    }
+    return true;
+}
+
+// the keys of req at positions index, with their sizes and the write options of req
+remote_meta_request select_keys(const remote_meta_request &req, const std::vector<size_t> &index) {
+    remote_meta_request selected = {
+        .block_size = req.block_size,
+        .pinned = req.pinned,
+        .chain = req.chain,
+        .parent = req.parent,
+        .ttl_ms = req.ttl_ms,
+        .if_absent = req.if_absent,
+    };
+    for (size_t i : index) {
+        if (req.digests.empty()) {
+            selected.keys.push_back(req.keys[i]);
+        }
+        else {
+            selected.digests.insert(selected.digests.end(), &req.digests[i * DIGEST_SIZE],
+                                    &req.digests[(i + 1) * DIGEST_SIZE]);
+        }
+        if (!req.sizes.empty()) {
+            selected.sizes.push_back(req.sizes[i]);
+        }
+    }
+    return selected;
+}
+
 // TODO: refactor this function to use RDMA_WRITE_IMM.
-int rdma_read(client_t *client, remote_meta_request &remote_meta_req) {
-    INFO("do rdma read #keys: {}", remote_meta_req.keys.size());
+int rdma_read(client_t *client, int ns, remote_meta_request &remote_meta_req) {
+    INFO("do rdma read #keys: {}", key_count(remote_meta_req));
 
     int error_code = TASK_ACCEPTED;
     remote_meta_response resp;
     uv_write_t *write_req = (uv_write_t *)malloc(sizeof(uv_write_t));
     std::string out;
-    resp.blocks.reserve(remote_meta_req.keys.size());
-
-    for (const auto &key : remote_meta_req.keys) {
-        auto it = kv_map.find(key);
-        if (it == kv_map.end()) {
+    resp.blocks.reserve(key_count(remote_meta_req));
+    std::vector<uint32_t> leased;
+    leased.reserve(key_count(remote_meta_req));
+
+    std::vector<PTR *> values;
+    find_values(ns, remote_meta_req, key_count(remote_meta_req), &values);
+    for (size_t i = 0; i < key_count(remote_meta_req); ++i) {
+        record_access(key_at(remote_meta_req, i));
+        PTR *ptr = values[i];
+        if (ptr == NULL) {
             // key not found
             return KEY_NOT_FOUND;
         }
-        const PTR &ptr = it->second;
-        DEBUG("rkey: {}, local_addr: {}, size : {}", mm->get_rkey(ptr.pool_idx), (uintptr_t)ptr.ptr,
-              ptr.size);
-        resp.blocks.push_back(
-            {.rkey = mm->get_rkey(ptr.pool_idx), .remote_addr = (uintptr_t)ptr.ptr});
+        touch_value(ptr);
+        resp.blocks.push_back(extents_of(*ptr));
+        leased.push_back(ptr->meta);
     }
+    resp.lease = leases->grant(leased, uv_now(loop));
     // send the response
 
     if (!serialize(resp, out)) {
@@ -501,38 +1646,92 @@ int rdma_read(client_t *client, remote_meta_request &remote_meta_req) {
     return 0;
 }
 
-int rdma_write(client_t *client, remote_meta_request &remote_meta_req) {
-    INFO("do rdma write keys: {}, remote_block_size: {}", remote_meta_req.keys.size(),
+int rdma_write(client_t *client, int ns, remote_meta_request &remote_meta_req) {
+    INFO("do rdma write keys: {}, remote_block_size: {}", key_count(remote_meta_req),
          remote_meta_req.block_size);
     remote_meta_response resp;
-    uv_write_t *write_req = (uv_write_t *)malloc(sizeof(uv_write_t));
     std::string out;
     int error_code = TASK_ACCEPTED;
 
-    resp.blocks.reserve(remote_meta_req.keys.size());
-    for (std::string &key : remote_meta_req.keys) {
-        void *h_dst;
-        int pool_idx;
-        h_dst = mm->allocate(remote_meta_req.block_size, &pool_idx);
-        // FIXME: only one h_dst is sent
-        if (h_dst == NULL) {
-            ERROR("Failed to allocate host memory");
-            return SYSTEM_ERROR;
-        }
-        auto ptr = PTR{.ptr = h_dst, .size = remote_meta_req.block_size, .pool_idx = pool_idx};
-        // save to the map
-        kv_map[key] = ptr;
-        DEBUG("rkey: {}, local_addr: {}, size : {}", mm->get_rkey(pool_idx), (uintptr_t)h_dst,
-              remote_meta_req.block_size);
+    if (!remote_meta_req.sizes.empty()) {
+        if (remote_meta_req.sizes.size() != key_count(remote_meta_req) ||
+            std::find(remote_meta_req.sizes.begin(), remote_meta_req.sizes.end(), (size_t)0) !=
+                remote_meta_req.sizes.end()) {
+            ERROR("Invalid value sizes");
+            return INVALID_REQ;
+        }
+    }
+    else if (remote_meta_req.block_size <= 0) {
+        ERROR("Invalid block size {}", remote_meta_req.block_size);
+        return INVALID_REQ;
+    }
 
-        resp.blocks.push_back({.rkey = mm->get_rkey(pool_idx), .remote_addr = (uintptr_t)h_dst});
+    size_t count = key_count(remote_meta_req);
+    // position in the request of the keys that get a value
+    std::vector<size_t> index;
+    index.reserve(count);
+    const remote_meta_request *to_write = &remote_meta_req;
+    remote_meta_request absent;
+    if (remote_meta_req.if_absent) {
+        std::vector<PTR *> stored;
+        find_values(ns, remote_meta_req, count, &stored);
+        resp.present.assign((count + 7) / 8, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (stored[i]) {
+                // another writer got there first, its value counts as used
+                touch_value(stored[i]);
+                resp.present[i / 8] |= 1 << (i % 8);
+            }
+            else {
+                index.push_back(i);
+            }
+        }
+        skipped_writes += count - index.size();
+        if (index.size() < count) {
+            absent = select_keys(remote_meta_req, index);
+            to_write = &absent;
+        }
     }
+    else {
+        for (size_t i = 0; i < count; ++i) {
+            index.push_back(i);
+        }
+    }
+
+    // all or nothing: keys are only inserted once every value is reserved
+    std::vector<PTR> values;
+    bool rejected;
+    if (!index.empty() && !allocate_values(ns, *to_write, &values, &rejected)) {
+        if (rejected) {
+            // the client skips the transfer
+            rejected_writes++;
+            return NOT_ADMITTED;
+        }
+        ERROR("Failed to allocate host memory");
+        return SYSTEM_ERROR;
+    }
+
+    // keys already stored keep no extent
+    resp.blocks.resize(count);
+    std::vector<uint32_t> leased;
+    leased.reserve(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        resp.blocks[index[i]] = extents_of(values[i]);
+        leased.push_back(values[i].meta);
+        // save to the map
+        insert_value(ns, key_at(*to_write, i), std::move(values[i]), remote_meta_req.pinned,
+                     remote_meta_req.ttl_ms);
+    }
+    chain_keys(ns, remote_meta_req, count);
+    // a key overwritten while the client writes must not free the blocks under it
+    resp.lease = leased.empty() ? 0 : leases->grant(leased, uv_now(loop));
 
     if (!serialize(resp, out)) {
         ERROR("Failed to serialize response");
         return -1;
     }
 
+    uv_write_t *write_req = (uv_write_t *)malloc(sizeof(uv_write_t));
     int size = out.size();
     client->send_buffer =
         (char *)realloc(client->send_buffer, out.size() + sizeof(error_code) + sizeof(size));
@@ -555,6 +1754,16 @@ void handle_request(uv_stream_t *stream, client_t *client) {
     auto start = std::chrono::high_resolution_clock::now();
     int error_code = 0;
     int op = client->header.op;
+    int ns = client->ns;
+    bool keyed = op != OP_SYNC && op != OP_RDMA_EXCHANGE && op != OP_RELEASE_LEASES &&
+                 op != OP_USE_NAMESPACE;
+    if (keyed && (!namespaces->live(ns) || namespaces->generation(ns) != client->ns_generation)) {
+        // dropped since the client picked it, it is not brought back behind the client's back
+        ERROR("Namespace {} of the client was dropped", ns);
+        send_resp(client, NAMESPACE_GONE, NULL, 0);
+        reset_client_read_state(client);
+        return;
+    }
     // if error_code is not 0, close the connection
     switch (client->header.op) {
         case OP_RDMA_WRITE: {
@@ -564,7 +1773,12 @@ void handle_request(uv_stream_t *stream, client_t *client) {
                 error_code = SYSTEM_ERROR;
                 break;
             }
-            error_code = rdma_write(client, remote_meta_req);
+            if (!valid_keys(remote_meta_req)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = rdma_write(client, ns, remote_meta_req);
             break;
         }
         case OP_RDMA_READ: {
@@ -574,7 +1788,12 @@ void handle_request(uv_stream_t *stream, client_t *client) {
                 error_code = SYSTEM_ERROR;
                 break;
             }
-            error_code = rdma_read(client, remote_meta_req);
+            if (!valid_keys(remote_meta_req)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = rdma_read(client, ns, remote_meta_req);
             break;
         }
         case OP_R: {
@@ -585,7 +1804,16 @@ void handle_request(uv_stream_t *stream, client_t *client) {
                 error_code = SYSTEM_ERROR;
                 break;
             }
-            error_code = read_cache(client, local_meta);
+            if (!valid_keys(local_meta)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            if (!init_local_client(client)) {
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = read_cache(client, ns, local_meta);
             break;
         }
         case OP_W: {
@@ -596,7 +1824,16 @@ void handle_request(uv_stream_t *stream, client_t *client) {
                 error_code = SYSTEM_ERROR;
                 break;
             }
-            error_code = write_cache(client, local_meta);
+            if (!valid_keys(local_meta)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            if (!init_local_client(client)) {
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = write_cache(client, ns, local_meta);
             break;
         }
         case OP_SYNC: {
@@ -610,7 +1847,72 @@ void handle_request(uv_stream_t *stream, client_t *client) {
         }
         case OP_CHECK_EXIST: {
             std::string key_to_check(client->recv_buffer, client->expected_bytes);
-            error_code = check_key(client, key_to_check);
+            error_code = check_key(client, ns, key_to_check);
+            break;
+        }
+        case OP_DROP_SUBTREE: {
+            std::string key(client->recv_buffer, client->expected_bytes);
+            error_code = drop_subtree(client, ns, key);
+            break;
+        }
+        case OP_USE_NAMESPACE: {
+            std::string name(client->recv_buffer, client->expected_bytes);
+            error_code = use_namespace(client, name);
+            break;
+        }
+        case OP_RELEASE_LEASES: {
+            leases_t req;
+            if (!deserialize(client->recv_buffer, client->expected_bytes, req)) {
+                ERROR("Failed to deserialize leases");
+                error_code = SYSTEM_ERROR;
+                break;
+            }
+            error_code = release_leases(client, req);
+            break;
+        }
+        case OP_CLONE: {
+            clone_request req;
+            if (!deserialize(client->recv_buffer, client->expected_bytes, req)) {
+                ERROR("Failed to deserialize clone request");
+                error_code = SYSTEM_ERROR;
+                break;
+            }
+            if (!valid_keys(req) || !valid_keys(req.sources)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = clone_keys(client, ns, req);
+            break;
+        }
+        case OP_CHECK_EXIST_BATCH: {
+            keys_t keys_meta;
+            if (!deserialize(client->recv_buffer, client->expected_bytes, keys_meta)) {
+                ERROR("Failed to deserialize keys meta");
+                error_code = SYSTEM_ERROR;
+                break;
+            }
+            if (!valid_keys(keys_meta)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = check_keys(client, ns, keys_meta);
+            break;
+        }
+        case OP_DELETE: {
+            keys_t keys_meta;
+            if (!deserialize(client->recv_buffer, client->expected_bytes, keys_meta)) {
+                ERROR("Failed to deserialize keys meta");
+                error_code = SYSTEM_ERROR;
+                break;
+            }
+            if (!valid_keys(keys_meta)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = delete_keys(client, ns, keys_meta);
             break;
         }
         case OP_GET_MATCH_LAST_IDX: {
@@ -620,7 +1922,12 @@ void handle_request(uv_stream_t *stream, client_t *client) {
                 error_code = SYSTEM_ERROR;
                 break;
             }
-            error_code = get_match_last_index(client, keys_meta);
+            if (!valid_keys(keys_meta)) {
+                ERROR("Invalid keys");
+                error_code = INVALID_REQ;
+                break;
+            }
+            error_code = get_match_last_index(client, ns, keys_meta);
             break;
         }
         default:
@@ -662,7 +1969,13 @@ void on_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
                           (unsigned int)client->header.body_size);
                     if (client->header.op == OP_R || client->header.op == OP_W ||
                         client->header.op == OP_CHECK_EXIST ||
+                        client->header.op == OP_CHECK_EXIST_BATCH ||
+                        client->header.op == OP_RELEASE_LEASES ||
+                        client->header.op == OP_USE_NAMESPACE ||
+                        client->header.op == OP_CLONE ||
                         client->header.op == OP_GET_MATCH_LAST_IDX ||
+                        client->header.op == OP_DROP_SUBTREE ||
+                        client->header.op == OP_DELETE ||
                         client->header.op == OP_RDMA_EXCHANGE ||
                         client->header.op == OP_RDMA_WRITE || client->header.op == OP_RDMA_READ) {
                         int ret = veryfy_header(&client->header);
@@ -717,7 +2030,6 @@ void on_new_connection(uv_stream_t *server, int status) {
     uv_tcp_init(loop, client_handle);
     if (uv_accept(server, (uv_stream_t *)client_handle) == 0) {
         client_t *client = new client_t();
-        CHECK_CUDA(cudaStreamCreate(&client->cuda_stream));
         client->handle = client_handle;
         client_handle->data = client;
         client->state = READ_HEADER;
@@ -761,6 +2073,117 @@ void signal_handler(int signum) {
     }
 }
 
+void on_pool_loaded(uv_async_t *async) {
+    if (mm->load_failed()) {
+        // the pool would stay short of its size for good
+        ERROR("Failed to build the memory pool, shutting down");
+        uv_stop(loop);
+        // joins the loader threads first
+        delete mm;
+        exit(EXIT_FAILURE);
+    }
+    if (mm->collect_loaded() > 0 && mm->get_loading_size() == 0) {
+        INFO("memory pool ready: {} GB", mm->get_total_size() >> 30);
+    }
+}
+
+// a value of the pool being compacted, found again by its handle
+struct compact_candidate_t {
+    uint8_t ns;
+    uint32_t meta;
+};
+// values of compact_pool from the last scan of the index, highest block at the back
+std::vector<compact_candidate_t> compact_queue;
+int compact_pool = -1;
+uint64_t compact_scanned_at = 0;
+
+// queue the values of pool_idx that compaction may move, lowest block first
+void scan_compact_pool(int pool_idx) {
+    std::vector<std::pair<uint32_t, compact_candidate_t>> found;
+    for_each_keyspace([&](int ns, keyspace_t &space) {
+        space.index.for_each([&](KeyView key, PTR &value) {
+            // only values held in one segment and by themselves are moved
+            if (value.pool_idx == pool_idx && !(value.flags & (VALUE_SCATTERED | VALUE_SHARED))) {
+                found.push_back({value.block, {.ns = (uint8_t)ns, .meta = value.meta}});
+            }
+        });
+    });
+    std::sort(found.begin(), found.end(),
+              [](const std::pair<uint32_t, compact_candidate_t> &a,
+                 const std::pair<uint32_t, compact_candidate_t> &b) { return a.first < b.first; });
+    compact_queue.clear();
+    for (const auto &f : found) {
+        compact_queue.push_back(f.second);
+    }
+    compact_pool = pool_idx;
+    compact_scanned_at = uv_now(loop);
+}
+
+// move values of the most fragmented pool to the lowest free runs, so large
+// free runs form again at the end of the pool. Runs on the event loop, so
+// index entries are updated before any request sees them. The index is only
+// scanned when another pool needs compacting or the queue of the current one
+// is used up, values are checked again by handle before they are moved.
+void on_compact_timer(uv_timer_t *timer) {
+    double fragmentation;
+    int pool_idx = mm->most_fragmented_pool(0, &fragmentation);
+    max_fragmentation = fragmentation;
+    if (pool_idx < 0 || fragmentation <= COMPACT_THRESHOLD) {
+        return;
+    }
+    if (pool_idx != compact_pool ||
+        (compact_queue.empty() && uv_now(loop) - compact_scanned_at >= COMPACT_RESCAN_MS)) {
+        scan_compact_pool(pool_idx);
+    }
+
+    uint32_t now = now_ms32();
+    size_t moved = 0, moved_bytes = 0, skipped = 0;
+    while (!compact_queue.empty() && moved_bytes < COMPACT_BUDGET) {
+        compact_candidate_t candidate = compact_queue.back();
+        // deleted, rewritten or dropped since the scan
+        keyspace_t *space = keyspaces[candidate.ns].get();
+        KeyView key(NULL, 0);
+        PTR *ptr = space ? find_meta(*space, candidate.meta, &key) : NULL;
+        if (!ptr || ptr->pool_idx != pool_idx || (ptr->flags & (VALUE_SCATTERED | VALUE_SHARED))) {
+            compact_queue.pop_back();
+            continue;
+        }
+        if ((uint32_t)(now - value_meta[ptr->meta].last_access) < COMPACT_GRACE_MS ||
+            leases->pinned(ptr->meta)) {
+            // the next scan looks at it again
+            compact_queue.pop_back();
+            skipped++;
+            continue;
+        }
+        void *dst = mm->allocate_in_pool(pool_idx, ptr->size);
+        if (dst == NULL) {
+            break;
+        }
+        void *src = value_ptr(*ptr);
+        if (dst > src) {
+            // no free space below this value any more
+            mm->deallocate(dst, ptr->size, pool_idx);
+            compact_queue.clear();
+            break;
+        }
+        memcpy(dst, src, ptr->size);
+        mm->deallocate(src, ptr->size, pool_idx);
+        ptr->block = mm->get_block_index(pool_idx, dst);
+        compact_queue.pop_back();
+        moved++;
+        moved_bytes += ptr->size;
+    }
+    INFO("compact pool {}: fragmentation {:.2f}, moved {} values ({} bytes), skipped {} in use",
+         pool_idx, fragmentation, moved, moved_bytes, skipped);
+}
+
+void on_shrink_timer(uv_timer_t *timer) {
+    size_t released = mm->shrink();
+    if (released > 0) {
+        INFO("released {} slabs, memory pool size: {} GB", released, mm->get_total_size() >> 30);
+    }
+}
+
 int register_server(unsigned long loop_ptr, server_config_t config) {
     signal(SIGSEGV, signal_handler);
     signal(SIGINT, signal_handler);
@@ -782,7 +2205,102 @@ int register_server(unsigned long loop_ptr, server_config_t config) {
     if (init_rdma_context(config.dev_name.c_str()) < 0) {
         return -1;
     }
-    mm = new MM(config.prealloc_size << 30, 32 << 10, pd);
+    std::vector<size_class_config_t> size_classes = config.size_classes;
+    if (size_classes.empty()) {
+        size_classes.push_back({.block_size = 32, .share = 100});
+    }
+    for (const auto &size_class : size_classes) {
+        size_t block_size = size_class.block_size << 10;
+        if (block_size == 0 || SLAB_SIZE % block_size != 0) {
+            ERROR("Invalid size class {} KB, it must divide the slab size {} KB",
+                  size_class.block_size, SLAB_SIZE >> 10);
+            return -1;
+        }
+    }
+    if (config.hugepage_size != 0 && config.hugepage_size != 2 && config.hugepage_size != 1024) {
+        ERROR("Invalid huge page size {} MB, it must be 2 or 1024", config.hugepage_size);
+        return -1;
+    }
+    std::string backend = config.memory_backend.empty() ? "cuda" : config.memory_backend;
+    if (backend != "cuda" && backend != "host") {
+        ERROR("Invalid memory backend {}, it must be cuda or host", backend);
+        return -1;
+    }
+    cuda_enabled = backend == "cuda";
+    INFO("Memory backend: {}", backend);
+    eviction_policy = config.eviction_policy.empty() ? "none" : config.eviction_policy;
+    if (eviction_policy != "none" && !make_eviction_policy(eviction_policy)) {
+        ERROR("Invalid eviction policy {}, it must be lru, clock, s3fifo or none",
+              eviction_policy);
+        return -1;
+    }
+    INFO("Eviction policy: {}", eviction_policy);
+    if (config.prefix_index) {
+        prefix_index = true;
+        INFO("Prefix index enabled");
+    }
+    if (config.admission) {
+        if (eviction_policy == "none") {
+            ERROR("Admission control needs an eviction policy");
+            return -1;
+        }
+        sketch = new FrequencySketch(ADMISSION_SKETCH_WIDTH);
+        INFO("Admission control enabled");
+    }
+    shared_blocks = new DedupTable();
+    if (config.dedup) {
+        dedup = true;
+        uv_timer_init(loop, &dedup_timer);
+        uv_timer_start(&dedup_timer, on_dedup_timer, DEDUP_INTERVAL_MS, DEDUP_INTERVAL_MS);
+        INFO("Dedup enabled");
+    }
+    pool_options_t pool_options = {.hugepage_size = config.hugepage_size << 20,
+                                   .numa_nodes = {},
+                                   .host_only = !cuda_enabled};
+
+    // keep the pool, the event loop and the NIC on the same socket
+    int nic_node = get_device_numa_node(ib_ctx);
+    INFO("RDMA device is on NUMA node {}", nic_node);
+    if (nic_node >= 0) {
+        pool_options.numa_nodes.push_back(nic_node);
+    }
+    // the configured nodes are used as well when the NIC's node is unknown
+    std::vector<int> online = get_numa_nodes();
+    for (int node : config.numa_nodes) {
+        if (!online.empty() && std::find(online.begin(), online.end(), node) == online.end()) {
+            WARN("NUMA node {} is not online, not used", node);
+        }
+        else if (node != nic_node) {
+            pool_options.numa_nodes.push_back(node);
+        }
+    }
+    // register_server runs on the event loop thread, next to the preferred node
+    if (!pool_options.numa_nodes.empty()) {
+        bind_thread_to_node(pool_options.numa_nodes[0]);
+    }
+
+    size_t max_size = std::max(config.max_size, config.prealloc_size);
+    mm = new MM(config.prealloc_size << 30, max_size << 30, size_classes, pool_options, pd);
+    // slabs are built in the background and used as soon as each one is ready,
+    // so requests are served while the rest of the pool is still registering
+    uv_async_init(loop, &pool_loaded_async, on_pool_loaded);
+    uv_timer_init(loop, &compact_timer);
+    uv_timer_start(&compact_timer, on_compact_timer, COMPACT_INTERVAL_MS, COMPACT_INTERVAL_MS);
+    uv_timer_init(loop, &reclaim_timer);
+    uv_timer_start(&reclaim_timer, on_reclaim_timer, RECLAIM_EPOCH_MS, RECLAIM_EPOCH_MS);
+    leases = new LeaseTable(LEASE_TIMEOUT_MS);
+    // every namespace has its own index, evictor, prefix tree and TTL wheel
+    namespaces = new NamespaceTable();
+    open_namespace("");
+    uv_timer_init(loop, &drop_timer);
+    uv_timer_init(loop, &ttl_timer);
+    uv_timer_start(&ttl_timer, on_ttl_timer, TTL_TICK_MS, TTL_TICK_MS);
+    mm->load_async(POOL_LOADER_THREADS, []() { uv_async_send(&pool_loaded_async); });
+    if (max_size > config.prealloc_size) {
+        // give grown slabs back to the OS once they have been empty for a while
+        uv_timer_init(loop, &shrink_timer);
+        uv_timer_start(&shrink_timer, on_shrink_timer, SHRINK_INTERVAL_MS, SHRINK_INTERVAL_MS);
+    }
 
     INFO("register server done");
 
@@ -0,0 +1,579 @@
+#ifndef KVINDEX_H
+#define KVINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// keys up to this size, a 16 byte digest in particular, are stored in the slot
+#define INLINE_KEY_SIZE 16
+// longer keys are interned in chunks of this size
+#define KEY_ARENA_CHUNK_SIZE (1UL << 20)
+// keys hashed and prefetched ahead of the ones being resolved by find_batch
+#define FIND_BATCH_WINDOW 32
+
+// non owning reference to the bytes of a key
+struct KeyView {
+    const char *data;
+    size_t size;
+
+    KeyView(const char *data, size_t size) : data(data), size(size) {}
+    KeyView(const std::string &key) : data(key.data()), size(key.size()) {}
+    KeyView(const char *key) : data(key), size(strlen(key)) {}
+
+    bool operator==(const KeyView &other) const {
+        return size == other.size && memcmp(data, other.data, size) == 0;
+    }
+    std::string str() const { return std::string(data, size); }
+};
+
+// murmur3 finalizer
+inline uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// a few multiply-xorshift rounds per 8 bytes, two for a 16 byte digest
+inline size_t hash_key(KeyView key) {
+    uint64_t h = key.size * 0x9e3779b97f4a7c15ULL;
+    size_t i = 0;
+    for (; i + 8 <= key.size; i += 8) {
+        uint64_t word;
+        memcpy(&word, key.data + i, 8);
+        h = hash_mix(h ^ word);
+    }
+    if (i < key.size) {
+        uint64_t word = 0;
+        memcpy(&word, key.data + i, key.size - i);
+        h = hash_mix(h ^ word);
+    }
+    return h;
+}
+
+/*
+KeyArena stores key bytes back to back in large append-only chunks instead of
+one heap allocation per key. Released bytes are only counted; a chunk is
+freed once every key in it is released, so a chunk with one long lived key
+keeps the others' bytes. Not thread safe.
+*/
+class KeyArena {
+   public:
+    KeyArena() {}
+    KeyArena(const KeyArena &) = delete;
+    KeyArena &operator=(const KeyArena &) = delete;
+    ~KeyArena() {
+        for (auto &chunk : chunks_) {
+            delete[] chunk.data;
+        }
+    }
+
+    // copy key into the arena, *chunk is passed back to release()
+    const char *intern(KeyView key, uint32_t *chunk) {
+        if (current_ == NO_CHUNK ||
+            chunks_[current_].used + key.size > chunks_[current_].capacity) {
+            size_t capacity = KEY_ARENA_CHUNK_SIZE;
+            if (key.size > capacity) {
+                capacity = key.size;
+            }
+            current_ = new_chunk(capacity);
+        }
+        Chunk &c = chunks_[current_];
+        char *dst = c.data + c.used;
+        memcpy(dst, key.data, key.size);
+        c.used += key.size;
+        c.live += key.size;
+        live_bytes_ += key.size;
+        *chunk = current_;
+        return dst;
+    }
+
+    void release(uint32_t chunk, size_t size) {
+        Chunk &c = chunks_[chunk];
+        c.live -= size;
+        live_bytes_ -= size;
+        if (c.live > 0) {
+            return;
+        }
+        if (chunk == current_) {
+            // start over, the bytes written so far are all dead
+            c.used = 0;
+            return;
+        }
+        reserved_bytes_ -= c.capacity;
+        delete[] c.data;
+        c.data = NULL;
+        free_chunks_.push_back(chunk);
+    }
+
+    // bytes of the chunks held, live or not
+    size_t memory_usage() const { return reserved_bytes_; }
+    size_t live_bytes() const { return live_bytes_; }
+
+   private:
+    static const uint32_t NO_CHUNK = (uint32_t)-1;
+
+    struct Chunk {
+        char *data;
+        size_t capacity;
+        size_t used;
+        size_t live;
+    };
+
+    uint32_t new_chunk(size_t capacity) {
+        uint32_t id;
+        if (!free_chunks_.empty()) {
+            id = free_chunks_.back();
+            free_chunks_.pop_back();
+        }
+        else {
+            id = chunks_.size();
+            chunks_.push_back(Chunk());
+        }
+        chunks_[id] = {.data = new char[capacity], .capacity = capacity, .used = 0, .live = 0};
+        reserved_bytes_ += capacity;
+        // the chunk being replaced may have no live key left
+        if (current_ != NO_CHUNK && chunks_[current_].live == 0) {
+            uint32_t old = current_;
+            current_ = id;
+            release(old, 0);
+        }
+        return id;
+    }
+
+    std::vector<Chunk> chunks_;
+    std::vector<uint32_t> free_chunks_;
+    uint32_t current_ = NO_CHUNK;
+    size_t reserved_bytes_ = 0;
+    size_t live_bytes_ = 0;
+};
+
+/*
+IndexKey is a key of up to INLINE_KEY_SIZE bytes stored in place, or a
+pointer into a KeyArena. It owns nothing by itself: the arena that interned a
+long key must release it. Copying an IndexKey copies the reference.
+*/
+class IndexKey {
+   public:
+    IndexKey(KeyView key, KeyArena *arena) : size_(key.size) {
+        if (size_ > INLINE_KEY_SIZE) {
+            long_.data = arena->intern(key, &long_.chunk);
+        }
+        else {
+            memcpy(inline_, key.data, size_);
+        }
+    }
+
+    // give the bytes of a long key back to arena, the key is not usable any more
+    void release(KeyArena *arena) {
+        if (size_ > INLINE_KEY_SIZE) {
+            arena->release(long_.chunk, size_);
+        }
+        size_ = 0;
+    }
+
+    KeyView view() const { return KeyView(size_ > INLINE_KEY_SIZE ? long_.data : inline_, size_); }
+
+   private:
+    union {
+        char inline_[INLINE_KEY_SIZE];
+        struct {
+            const char *data;
+            uint32_t chunk;
+        } long_;
+    };
+    uint32_t size_;
+};
+
+/*
+FlatIndex is an open addressing hash table from byte string keys to V, in the
+style of Swiss tables.
+
+Slots are grouped by 16. Every slot has one control byte: EMPTY, DELETED, or
+the low 7 bits of the key's hash (the tag). A lookup loads the 16 control
+bytes of a group, compares them all with the tag in one SSE2 instruction and
+only compares keys of the slots whose tag matched. Groups are probed
+quadratically, and a probe stops at the first group with an empty slot.
+
+Growth is incremental: when the table is 7/8 full a table twice as large is
+allocated and every insert or erase moves MIGRATE_GROUPS groups of the old
+table to the new one, so no single call pays for the whole rehash. Lookups
+check the new table, then the old one while the migration runs.
+
+Keys are hashed with a few multiply-xorshift rounds per 8 bytes, two for a
+16 byte digest. Keys of up to INLINE_KEY_SIZE bytes are stored in the slot,
+so digests cost no allocation; longer keys are interned in a KeyArena.
+
+Memory: (sizeof(Slot) + 1) / load bytes per key plus the arena bytes of keys
+longer than INLINE_KEY_SIZE, load being between 7/16 and 7/8. At 100M keys the
+table has 2^27 slots, a load of 0.745. With the server's 16 byte PTR that is
+(40 + 1) / 0.745 = 55 bytes per key, against about 125 bytes for
+std::unordered_map<std::string, PTR> (112 byte node + bucket array).
+
+Lookups of many keys should go through find_batch: it hashes a window of keys
+and prefetches their control bytes, then their candidate slots, before
+comparing any key, so the cache misses of the window overlap instead of
+being paid one after the other.
+
+Pointers to values stay valid until the next insert or erase. Not thread safe.
+*/
+template <typename V>
+class FlatIndex {
+   public:
+    struct Slot {
+        IndexKey key;
+        V value;
+    };
+
+    FlatIndex() { init(&cur_, MIN_GROUPS); }
+    FlatIndex(const FlatIndex &) = delete;
+    FlatIndex &operator=(const FlatIndex &) = delete;
+    ~FlatIndex() {
+        destroy(&cur_);
+        destroy(&old_);
+    }
+
+    size_t size() const { return cur_.size + old_.size; }
+    bool empty() const { return size() == 0; }
+
+    // pointer to the value of key, or NULL
+    V *find(KeyView key) {
+        size_t hash = hash_key(key);
+        Slot *slot = lookup(cur_, key, hash);
+        if (!slot && old_.groups) {
+            slot = lookup(old_, key, hash);
+        }
+        return slot ? &slot->value : NULL;
+    }
+    const V *find(KeyView key) const { return const_cast<FlatIndex *>(this)->find(key); }
+
+    /*
+    @brief the entry whose key hashes to hash (hash_key) and whose value
+    satisfies pred(const V &), NULL if there is none. For callers that keep a
+    handle stored in the value and the key's hash instead of a copy of the key.
+    */
+    template <typename P>
+    Slot *find_hashed(size_t hash, P pred) {
+        auto found = [&pred](const Slot &slot) { return pred(slot.value); };
+        Slot *slot = probe(cur_, hash, found);
+        if (!slot && old_.groups) {
+            slot = probe(old_, hash, found);
+        }
+        return slot;
+    }
+    size_t count(KeyView key) const { return find(key) ? 1 : 0; }
+
+    // (*out)[i] = find(keys[i])
+    void find_batch(const std::vector<KeyView> &keys, std::vector<V *> *out) {
+        size_t hashes[FIND_BATCH_WINDOW];
+        out->resize(keys.size());
+        for (size_t start = 0; start < keys.size(); start += FIND_BATCH_WINDOW) {
+            size_t n = std::min(keys.size() - start, (size_t)FIND_BATCH_WINDOW);
+            for (size_t i = 0; i < n; ++i) {
+                hashes[i] = hash_key(keys[start + i]);
+                __builtin_prefetch(cur_.ctrl + first_group(cur_, hashes[i]) * GROUP_SIZE);
+            }
+            // the control bytes are on their way, prefetch the first slot whose tag matches
+            for (size_t i = 0; i < n; ++i) {
+                size_t g = first_group(cur_, hashes[i]);
+                uint32_t candidates = match(cur_.ctrl + g * GROUP_SIZE, tag(hashes[i]));
+                if (candidates) {
+                    __builtin_prefetch(&cur_.slots[g * GROUP_SIZE + __builtin_ctz(candidates)]);
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                Slot *slot = lookup(cur_, keys[start + i], hashes[i]);
+                if (!slot && old_.groups) {
+                    slot = lookup(old_, keys[start + i], hashes[i]);
+                }
+                (*out)[start + i] = slot ? &slot->value : NULL;
+            }
+        }
+    }
+
+    // start loading the control bytes key's lookup reads first
+    void prefetch(KeyView key) const {
+        __builtin_prefetch(cur_.ctrl + first_group(cur_, hash_key(key)) * GROUP_SIZE);
+    }
+
+    // insert key or replace its value, return the stored value
+    V &insert_or_assign(KeyView key, V value) {
+        migrate_step();
+        size_t hash = hash_key(key);
+        Slot *slot = lookup(cur_, key, hash);
+        if (!slot && old_.groups) {
+            slot = lookup(old_, key, hash);
+        }
+        if (slot) {
+            slot->value = std::move(value);
+            return slot->value;
+        }
+        if (cur_.size + cur_.deleted + old_.size + 1 > max_load(cur_)) {
+            grow();
+        }
+        slot = place(&cur_, hash);
+        new (slot) Slot{IndexKey(key, &arena_), std::move(value)};
+        return slot->value;
+    }
+
+    // return false if key was not there
+    bool erase(KeyView key) {
+        migrate_step();
+        size_t hash = hash_key(key);
+        if (erase_from(&cur_, key, hash)) {
+            return true;
+        }
+        return old_.groups && erase_from(&old_, key, hash);
+    }
+
+    // fn(KeyView key, V &value) for every entry, in no particular order.
+    // fn must not insert or erase.
+    template <typename F>
+    void for_each(F fn) {
+        for_each_in(cur_, fn);
+        if (old_.groups) {
+            for_each_in(old_, fn);
+        }
+    }
+
+    /*
+    @brief for_each over at most slots slots, starting at *cursor (0 at first),
+    which is then moved past them. false once every slot has been visited. The
+    index must not change between the calls of one walk.
+    */
+    template <typename F>
+    bool for_each_slice(size_t *cursor, size_t slots, F fn) {
+        size_t cur_slots = cur_.groups * GROUP_SIZE;
+        size_t end = cur_slots + old_.groups * GROUP_SIZE;
+        for (size_t stop = std::min(*cursor + slots, end); *cursor < stop; ++*cursor) {
+            Table &t = *cursor < cur_slots ? cur_ : old_;
+            size_t i = *cursor < cur_slots ? *cursor : *cursor - cur_slots;
+            if (t.ctrl[i] >= 0) {
+                fn(t.slots[i].key.view(), t.slots[i].value);
+            }
+        }
+        return *cursor < end;
+    }
+
+    // bytes used by the tables and by keys that are not stored inline
+    size_t memory_usage() const {
+        return (cur_.groups + old_.groups) * GROUP_SIZE * (sizeof(Slot) + 1) +
+               arena_.memory_usage();
+    }
+    // part of memory_usage() held by the key arena
+    size_t key_arena_bytes() const { return arena_.memory_usage(); }
+
+    bool rehashing() const { return old_.groups != 0; }
+
+   private:
+    static const int8_t EMPTY = -128;  // 0b10000000
+    static const int8_t DELETED = -2;  // 0b11111110, a full slot is 0b0xxxxxxx
+    static const size_t GROUP_SIZE = 16;
+    static const size_t MIN_GROUPS = 1;
+    static const size_t MIGRATE_GROUPS = 4;
+
+    struct Table {
+        size_t groups;
+        int8_t *ctrl;
+        Slot *slots;
+        size_t size;
+        size_t deleted;
+    };
+
+    static size_t max_load(const Table &t) { return t.groups * GROUP_SIZE / 8 * 7; }
+    static int8_t tag(size_t hash) { return hash & 0x7f; }
+    static size_t first_group(const Table &t, size_t hash) { return (hash >> 7) & (t.groups - 1); }
+
+    // bit i set iff control byte i of the group equals c
+    static uint32_t match(const int8_t *group, int8_t c) {
+#ifdef __SSE2__
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= (uint32_t)(group[i] == c) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // bit i set iff slot i of the group is empty or deleted
+    static uint32_t match_free(const int8_t *group) {
+#ifdef __SSE2__
+        // EMPTY and DELETED are the only negative control bytes
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+        return _mm_movemask_epi8(ctrl);
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; ++i) {
+            mask |= (uint32_t)(group[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    static void init(Table *t, size_t groups) {
+        t->groups = groups;
+        t->ctrl = new int8_t[groups * GROUP_SIZE];
+        memset(t->ctrl, EMPTY, groups * GROUP_SIZE);
+        t->slots = static_cast<Slot *>(::operator new(groups * GROUP_SIZE * sizeof(Slot)));
+        t->size = 0;
+        t->deleted = 0;
+    }
+
+    static void destroy(Table *t) {
+        if (!t->groups) {
+            return;
+        }
+        for (size_t i = 0; i < t->groups * GROUP_SIZE; ++i) {
+            if (t->ctrl[i] >= 0) {
+                t->slots[i].~Slot();
+            }
+        }
+        delete[] t->ctrl;
+        ::operator delete(t->slots);
+        t->groups = 0;
+        t->ctrl = NULL;
+        t->slots = NULL;
+        t->size = 0;
+        t->deleted = 0;
+    }
+
+    static Slot *lookup(const Table &t, KeyView key, size_t hash) {
+        return probe(t, hash, [&key](const Slot &slot) { return slot.key.view() == key; });
+    }
+
+    // the first slot on the probe path of hash whose tag matches and found(slot) holds
+    template <typename P>
+    static Slot *probe(const Table &t, size_t hash, P found) {
+        size_t g = first_group(t, hash);
+        for (size_t step = 1;; ++step) {
+            const int8_t *group = t.ctrl + g * GROUP_SIZE;
+            uint32_t candidates = match(group, tag(hash));
+            while (candidates) {
+                size_t i = g * GROUP_SIZE + __builtin_ctz(candidates);
+                if (found(t.slots[i])) {
+                    return &t.slots[i];
+                }
+                candidates &= candidates - 1;
+            }
+            if (match(group, EMPTY) || step > t.groups) {
+                return NULL;
+            }
+            // triangular numbers visit every group of a power of two table
+            g = (g + step) & (t.groups - 1);
+        }
+    }
+
+    // claim the first free slot on the probe path of hash, the key must be absent
+    static Slot *place(Table *t, size_t hash) {
+        size_t g = first_group(*t, hash);
+        for (size_t step = 1;; ++step) {
+            int8_t *group = t->ctrl + g * GROUP_SIZE;
+            uint32_t free_slots = match_free(group);
+            if (free_slots) {
+                size_t i = __builtin_ctz(free_slots);
+                if (group[i] == DELETED) {
+                    t->deleted--;
+                }
+                group[i] = tag(hash);
+                t->size++;
+                return &t->slots[g * GROUP_SIZE + i];
+            }
+            g = (g + step) & (t->groups - 1);
+        }
+    }
+
+    bool erase_from(Table *t, KeyView key, size_t hash) {
+        Slot *slot = lookup(*t, key, hash);
+        if (!slot) {
+            return false;
+        }
+        size_t i = slot - t->slots;
+        int8_t *group = t->ctrl + i / GROUP_SIZE * GROUP_SIZE;
+        slot->key.release(&arena_);
+        slot->~Slot();
+        // probes stop at a group with an empty slot, so if the group still has
+        // one no probe can pass through it and the slot can be empty again
+        if (match(group, EMPTY)) {
+            t->ctrl[i] = EMPTY;
+        }
+        else {
+            t->ctrl[i] = DELETED;
+            t->deleted++;
+        }
+        t->size--;
+        return true;
+    }
+
+    template <typename F>
+    static void for_each_in(Table &t, F &fn) {
+        for (size_t i = 0; i < t.groups * GROUP_SIZE; ++i) {
+            if (t.ctrl[i] >= 0) {
+                fn(t.slots[i].key.view(), t.slots[i].value);
+            }
+        }
+    }
+
+    // move the entries of one group of old_ to cur_
+    void migrate_group(size_t g) {
+        for (size_t i = g * GROUP_SIZE; i < (g + 1) * GROUP_SIZE; ++i) {
+            if (old_.ctrl[i] < 0) {
+                continue;
+            }
+            Slot &from = old_.slots[i];
+            Slot *to = place(&cur_, hash_key(from.key.view()));
+            new (to) Slot{from.key, std::move(from.value)};
+            from.~Slot();
+            // not EMPTY: keys further down the probe path are still looked up in old_
+            old_.ctrl[i] = DELETED;
+            old_.size--;
+        }
+    }
+
+    void migrate_step() {
+        if (!old_.groups) {
+            return;
+        }
+        for (size_t n = 0; n < MIGRATE_GROUPS && migrate_pos_ < old_.groups; ++n) {
+            migrate_group(migrate_pos_++);
+        }
+        if (migrate_pos_ == old_.groups) {
+            destroy(&old_);
+        }
+    }
+
+    void grow() {
+        // a migration still running is finished first, it is short compared
+        // to the inserts that filled the new table
+        while (old_.groups) {
+            migrate_step();
+        }
+        // drop tombstones in place when they take most of the room
+        size_t groups = cur_.size * 2 > max_load(cur_) ? cur_.groups * 2 : cur_.groups;
+        old_ = cur_;
+        init(&cur_, groups);
+        migrate_pos_ = 0;
+    }
+
+    Table cur_ = Table();
+    Table old_ = Table();
+    size_t migrate_pos_ = 0;
+    KeyArena arena_;
+};
+
+#endif  // KVINDEX_H
@@ -0,0 +1,50 @@
+#include "lease.h"
+
+LeaseTable::LeaseTable(uint64_t timeout) : timeout_(timeout) {}
+
+uint64_t LeaseTable::grant(const std::vector<uint32_t> &values, uint64_t now) {
+    uint64_t id = next_id_++;
+    for (uint32_t value : values) {
+        pins_[value]++;
+    }
+    leases_[id] = {.deadline = now + timeout_, .values = values};
+    order_.push_back(id);
+    return id;
+}
+
+void LeaseTable::unpin(const Lease &lease) {
+    for (uint32_t value : lease.values) {
+        auto it = pins_.find(value);
+        if (--it->second == 0) {
+            pins_.erase(it);
+        }
+    }
+}
+
+bool LeaseTable::release(uint64_t id) {
+    auto it = leases_.find(id);
+    if (it == leases_.end()) {
+        return false;
+    }
+    unpin(it->second);
+    leases_.erase(it);
+    return true;
+}
+
+size_t LeaseTable::expire(uint64_t now) {
+    size_t n = 0;
+    while (!order_.empty()) {
+        auto it = leases_.find(order_.front());
+        if (it != leases_.end()) {
+            if (it->second.deadline > now) {
+                break;
+            }
+            unpin(it->second);
+            leases_.erase(it);
+            n++;
+        }
+        order_.pop_front();
+    }
+    expired_ += n;
+    return n;
+}
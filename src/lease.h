@@ -0,0 +1,54 @@
+#ifndef LEASE_H
+#define LEASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+/*
+LeaseTable tracks the values clients may be reading with one-sided RDMA. An
+RDMA read response carries a lease; the values it covers are pinned until the
+client releases the lease or it times out, and pinned values are neither
+freed nor moved. Values are identified by a 32 bit handle, a value covered by
+several leases stays pinned until the last one ends. Not thread safe.
+*/
+class LeaseTable {
+   public:
+    // timeout: how long a lease lasts if the client never releases it
+    explicit LeaseTable(uint64_t timeout);
+
+    // pin values until release(id) or now + timeout, return the lease id, never 0
+    uint64_t grant(const std::vector<uint32_t> &values, uint64_t now);
+    // false if the lease is unknown, e.g. it has expired
+    bool release(uint64_t id);
+    // end the leases whose time is up, return how many
+    size_t expire(uint64_t now);
+
+    bool pinned(uint32_t value) const { return pins_.count(value) != 0; }
+
+    size_t size() const { return leases_.size(); }
+    size_t pinned_values() const { return pins_.size(); }
+    uint64_t expired() const { return expired_; }
+
+   private:
+    struct Lease {
+        uint64_t deadline;
+        std::vector<uint32_t> values;
+    };
+
+    void unpin(const Lease &lease);
+
+    uint64_t timeout_;
+    uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, Lease> leases_;
+    // ids in grant order, which is deadline order. Released ids are skipped.
+    std::deque<uint64_t> order_;
+    // value -> number of leases covering it
+    std::unordered_map<uint32_t, uint32_t> pins_;
+    uint64_t expired_ = 0;
+};
+
+#endif  // LEASE_H
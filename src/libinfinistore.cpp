@@ -18,6 +18,7 @@
 #include "ibv_helper.h"
 #include "log.h"
 #include "protocol.h"
+#include "topology.h"
 #include "utils.h"
 
 Connection::~Connection() {
@@ -224,12 +225,72 @@ int modify_qp_to_init(struct ibv_qp *qp) {
     return 0;
 }
 
-int sync_rdma(connection_t *conn) {
-    std::unique_lock<std::mutex> lock(conn->mutex);
-    conn->cv.wait(lock, [&conn] { return conn->rdma_inflight_count == 0; });
+// tell the server it may free or move the values of these transfers again
+int release_leases(connection_t *conn, const std::vector<uint64_t> &leases) {
+    leases_t req = {.leases = leases};
+    std::string serialized_data;
+    if (!serialize(req, serialized_data)) {
+        ERROR("Failed to serialize leases");
+        return -1;
+    }
+
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_RELEASE_LEASES,
+        .body_size = static_cast<unsigned int>(serialized_data.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(serialized_data.data()));
+    iov[1].iov_len = serialized_data.size();
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to release leases, return code {}", return_code);
+        return -1;
+    }
+
+    int released = 0;
+    if (recv(conn->sock, &released, sizeof(released), MSG_WAITALL) != sizeof(released)) {
+        ERROR("Failed to receive released count");
+        return -1;
+    }
+    if (released < (int)leases.size()) {
+        // the transfers finished, but after the server had given up on them
+        WARN("{} of {} leases had expired", leases.size() - released, leases.size());
+    }
     return 0;
 }
 
+int sync_rdma(connection_t *conn) {
+    std::vector<uint64_t> leases;
+    {
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        conn->cv.wait(lock, [&conn] { return conn->rdma_inflight_count == 0; });
+        leases.swap(conn->leases);
+    }
+    if (leases.empty()) {
+        return 0;
+    }
+    return release_leases(conn, leases);
+}
+
 // assume all memory regions are registered
 IBVMemoryRegion *search_mr_from_ptr(std::map<uintptr_t, IBVMemoryRegion *> &mrs, void *ptr) {
     DEBUG("searching lkey for ptr {}", ptr);
@@ -253,81 +314,70 @@ IBVMemoryRegion *search_mr_from_ptr(std::map<uintptr_t, IBVMemoryRegion *> &mrs,
     return NULL;
 }
 
-int perform_rdma_read(connection_t *conn, uintptr_t src_buf, size_t src_size, char *dst_buf,
-                      size_t dst_size, uint32_t rkey, IBVMemoryRegion *mr) {
-    // Prepare RDMA read operation
-    struct ibv_sge sge = {};
-    sge.addr = (uintptr_t)dst_buf;
-    sge.length = dst_size;
-
-    sge.lkey = mr->get_mr()->lkey;
-
-    struct ibv_send_wr wr = {};
-    if (conn->limited_bar1) {
-        wr.wr_id = (uint64_t)mr;
-        mr->add_ref();
-    }
-    else {
-        wr.wr_id = (uintptr_t)conn;
-    }
-    wr.opcode = IBV_WR_RDMA_READ;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.send_flags = IBV_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = src_buf;  // Obtain from server
-    wr.wr.rdma.rkey = rkey;            // Obtain from server
-
-    struct ibv_send_wr *bad_wr = NULL;
-    int ret = ibv_post_send(conn->qp, &wr, &bad_wr);
-    if (ret) {
-        ERROR("Failed to post RDMA read");
-        return -1;
-    }
-
-    conn->rdma_inflight_count++;
-    DEBUG("RDMA read completed successfully");
-    // RDMA read successful
-    return 0;
-}
-
-int perform_rdma_write(connection_t *conn, char *src_buf, size_t src_size, uintptr_t dst_buf,
-                       size_t dst_size, uint32_t rkey, IBVMemoryRegion *mr) {
-    // Prepare RDMA write operation
-    struct ibv_sge sge = {};
-    sge.addr = (uintptr_t)src_buf;
-    sge.length = src_size;
-    sge.lkey = mr->get_mr()->lkey;
-
-    struct ibv_send_wr wr = {};
-
-    if (conn->limited_bar1) {
-        // we have to pass mr to cq_handler to deregister it
-        wr.wr_id = (uint64_t)mr;
-        mr->add_ref();
-    }
-    else {
-        // maybe we will use request ctx in the future
-        wr.wr_id = (uintptr_t)conn;
+// one RDMA read or write of the local bytes at local_ptr, mr holds them
+typedef struct {
+    char *local_ptr;
+    uintptr_t remote_addr;
+    uint32_t rkey;
+    size_t size;
+    IBVMemoryRegion *mr;
+} rdma_request_t;
+
+// post requests as one chain of work requests in a single ibv_post_send. Every
+// work request is signaled, cq_handler counts them and releases their MR one by one
+int post_rdma_chain(connection_t *conn, char op, const std::vector<rdma_request_t> &requests) {
+    if (requests.empty()) {
+        return 0;
+    }
+    std::vector<struct ibv_sge> sges(requests.size());
+    std::vector<struct ibv_send_wr> wrs(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        const rdma_request_t &request = requests[i];
+        sges[i].addr = (uintptr_t)request.local_ptr;
+        sges[i].length = request.size;
+        sges[i].lkey = request.mr->get_mr()->lkey;
+
+        struct ibv_send_wr &wr = wrs[i];
+        wr = {};
+        if (conn->limited_bar1) {
+            // we have to pass mr to cq_handler to deregister it
+            wr.wr_id = (uint64_t)request.mr;
+            request.mr->add_ref();
+        }
+        else {
+            // maybe we will use request ctx in the future
+            wr.wr_id = (uintptr_t)conn;
+        }
+        wr.opcode = op == OP_RDMA_WRITE ? IBV_WR_RDMA_WRITE : IBV_WR_RDMA_READ;
+        wr.sg_list = &sges[i];
+        wr.num_sge = 1;
+        wr.send_flags = IBV_SEND_SIGNALED;
+        wr.wr.rdma.remote_addr = request.remote_addr;  // Obtain from server
+        wr.wr.rdma.rkey = request.rkey;                // Obtain from server
+        wr.next = i + 1 < requests.size() ? &wrs[i + 1] : NULL;
     }
-    wr.opcode = IBV_WR_RDMA_WRITE;
-    wr.sg_list = &sge;
-    wr.num_sge = 1;
-    wr.send_flags = IBV_SEND_SIGNALED;
-    wr.wr.rdma.remote_addr = dst_buf;  // Obtain from server
-    wr.wr.rdma.rkey = rkey;            // Obtain from server
 
     struct ibv_send_wr *bad_wr = NULL;
-    int ret = ibv_post_send(conn->qp, &wr, &bad_wr);
+    int ret = ibv_post_send(conn->qp, wrs.data(), &bad_wr);
     if (ret) {
-        ERROR("Failed to post RDMA write :{}", strerror(ret));
+        ERROR("Failed to post RDMA {}: {}", op == OP_RDMA_WRITE ? "write" : "read",
+              strerror(ret));
+        // the work requests from bad_wr on were not posted
+        size_t posted = bad_wr ? bad_wr - wrs.data() : 0;
+        for (size_t i = posted; i < requests.size() && conn->limited_bar1; ++i) {
+            conn->rdma_inflight_mr_size -= requests[i].mr->release();
+        }
+        conn->rdma_inflight_count += posted;
         return -1;
     }
-    conn->rdma_inflight_count++;
+    conn->rdma_inflight_count += requests.size();
     return 0;
 }
 
 void cq_handler(connection_t *conn) {
     assert(conn->comp_channel != NULL);
+    // poll completions from the socket the NIC is attached to
+    bind_thread_to_node(get_device_numa_node(conn->ib_ctx));
     while (!conn->stop) {
         struct ibv_cq *ev_cq;
         void *ev_ctx;
@@ -437,6 +487,45 @@ int init_connection(connection_t *conn, client_config_t config) {
     }
 
     conn->sock = sock;
+    if (!config.ns.empty()) {
+        return use_namespace(conn, config.ns);
+    }
+    return 0;
+}
+
+int use_namespace(connection_t *conn, const std::string &name) {
+    assert(conn != NULL);
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_USE_NAMESPACE,
+        .body_size = static_cast<unsigned int>(name.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(name.data()));
+    iov[1].iov_len = name.size();
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to use namespace {}, return code {}", name, return_code);
+        return -1;
+    }
     return 0;
 }
 
@@ -604,6 +693,107 @@ int check_exist(connection_t *conn, std::string key) {
     return exist;
 }
 
+int check_exist_batch(connection_t *conn, const std::vector<std::string> &keys,
+                      std::vector<uint8_t> *bitmap) {
+    assert(conn != NULL);
+
+    keys_t meta = {
+        .keys = keys,
+    };
+    if (pack_digests(meta.keys, meta.digests)) {
+        meta.keys.clear();
+    }
+
+    std::string serialized_data;
+    if (!serialize(meta, serialized_data)) {
+        ERROR("Failed to serialize keys meta");
+        return -1;
+    }
+
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_CHECK_EXIST_BATCH,
+        .body_size = static_cast<unsigned int>(serialized_data.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(serialized_data.data()));
+    iov[1].iov_len = serialized_data.size();
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to check keys, return code {}", return_code);
+        return -1;
+    }
+
+    // the size follows from the number of keys
+    bitmap->assign((keys.size() + 7) / 8, 0);
+    if (!bitmap->empty() &&
+        recv(conn->sock, bitmap->data(), bitmap->size(), MSG_WAITALL) != (ssize_t)bitmap->size()) {
+        ERROR("Failed to receive bitmap");
+        return -1;
+    }
+    return 0;
+}
+
+int drop_subtree(connection_t *conn, std::string key) {
+    assert(conn != NULL);
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_DROP_SUBTREE,
+        .body_size = static_cast<unsigned int>(key.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(key.data()));
+    iov[1].iov_len = key.size();
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to drop subtree, return code {}", return_code);
+        return -1;
+    }
+
+    int dropped = 0;
+    if (recv(conn->sock, &dropped, sizeof(int), MSG_WAITALL) != sizeof(int)) {
+        ERROR("Failed to receive dropped count");
+        return -1;
+    }
+    return dropped;
+}
+
 int get_match_last_index(connection_t *conn, std::vector<std::string> keys) {
     INFO("get_match_last_index");
     assert(conn != NULL);
@@ -611,6 +801,9 @@ int get_match_last_index(connection_t *conn, std::vector<std::string> keys) {
     keys_t meta = {
         .keys = keys,
     };
+    if (pack_digests(meta.keys, meta.digests)) {
+        meta.keys.clear();
+    }
 
     std::string serialized_data;
     if (!serialize(meta, serialized_data)) {
@@ -659,11 +852,144 @@ int get_match_last_index(connection_t *conn, std::vector<std::string> keys) {
     return last_index;
 }
 
+int delete_keys(connection_t *conn, std::vector<std::string> keys) {
+    assert(conn != NULL);
+
+    keys_t meta = {
+        .keys = keys,
+    };
+    if (pack_digests(meta.keys, meta.digests)) {
+        meta.keys.clear();
+    }
+
+    std::string serialized_data;
+    if (!serialize(meta, serialized_data)) {
+        ERROR("Failed to serialize keys meta");
+        return -1;
+    }
+
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_DELETE,
+        .body_size = static_cast<unsigned int>(serialized_data.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(serialized_data.data()));
+    iov[1].iov_len = serialized_data.size();
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to delete keys, return code {}", return_code);
+        return -1;
+    }
+
+    int deleted = 0;
+    if (recv(conn->sock, &deleted, sizeof(deleted), MSG_WAITALL) != sizeof(deleted)) {
+        ERROR("Failed to receive deleted count");
+        return -1;
+    }
+    return deleted;
+}
+
+int clone_keys(connection_t *conn, const std::vector<std::string> &sources,
+               const std::vector<std::string> &keys, const write_options_t &options) {
+    assert(conn != NULL);
+
+    clone_request req = {
+        .keys = keys,
+        .sources = {.keys = sources},
+        .pinned = options.pinned,
+        .chain = options.chain,
+        .parent = options.parent,
+        .ttl_ms = options.ttl_ms,
+    };
+    if (pack_digests(req.keys, req.digests)) {
+        req.keys.clear();
+    }
+    if (pack_digests(req.sources.keys, req.sources.digests)) {
+        req.sources.keys.clear();
+    }
+
+    std::string serialized_data;
+    if (!serialize(req, serialized_data)) {
+        ERROR("Failed to serialize clone request");
+        return -1;
+    }
+
+    header_t header = {
+        .magic = MAGIC,
+        .op = OP_CLONE,
+        .body_size = static_cast<unsigned int>(serialized_data.size()),
+    };
+
+    struct iovec iov[2];
+    struct msghdr msg;
+    iov[0].iov_base = &header;
+    iov[0].iov_len = FIXED_HEADER_SIZE;
+    iov[1].iov_base = const_cast<void *>(static_cast<const void *>(serialized_data.data()));
+    iov[1].iov_len = serialized_data.size();
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    if (sendmsg(conn->sock, &msg, 0) < 0) {
+        ERROR("Failed to send header and body");
+        return -1;
+    }
+
+    int return_code = 0;
+    if (recv(conn->sock, &return_code, RETURN_CODE_SIZE, MSG_WAITALL) != RETURN_CODE_SIZE) {
+        ERROR("Failed to receive return code");
+        return -1;
+    }
+    if (return_code == KEY_NOT_FOUND) {
+        return 0;
+    }
+    if (return_code != FINISH) {
+        ERROR("Failed to clone keys, return code {}", return_code);
+        return -1;
+    }
+
+    int cloned = 0;
+    if (recv(conn->sock, &cloned, sizeof(cloned), MSG_WAITALL) != sizeof(cloned)) {
+        ERROR("Failed to receive cloned count");
+        return -1;
+    }
+    return cloned;
+}
+
 int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block_size,
-            void *base_ptr, size_t ptr_region_size) {
+            const std::vector<size_t> &sizes, void *base_ptr, size_t ptr_region_size,
+            const write_options_t &options, std::vector<bool> *present) {
     assert(conn != NULL);
     assert(op == OP_RDMA_READ || op == OP_RDMA_WRITE);
     assert(base_ptr != NULL);
+    assert(sizes.empty() || sizes.size() == blocks.size());
+
+    // bytes reserved for block i in the local buffer
+    auto slot_size = [&](size_t i) -> size_t { return sizes.empty() ? block_size : sizes[i]; };
+    size_t total_size = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        total_size += slot_size(i);
+    }
 
     std::vector<std::pair<uintptr_t, uintptr_t>> mr_blocks;
 
@@ -673,51 +999,14 @@ int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block
     if (conn->limited_bar1) {
         // compare already registered blocks with incoming blocks
 
-        if (conn->rdma_inflight_mr_size + blocks.size() * block_size >
-            conn->bar1_mem_in_mib * 1024 * 1024) {
+        if (conn->rdma_inflight_mr_size + total_size > conn->bar1_mem_in_mib * 1024 * 1024) {
             ERROR(
                 "Not enough BAR1 memory rdma_inflight_mr_size {} + incoming "
                 "size {} > bar1 size {}",
-                conn->rdma_inflight_mr_size.load(), blocks.size() * block_size,
+                conn->rdma_inflight_mr_size.load(), total_size,
                 conn->bar1_mem_in_mib * 1024 * 1024);
             return -1;
         }
-
-        std::pair<unsigned long, unsigned long> cur_block = {0, 0};
-        size_t cur_end = -1;
-        // sort blocks by offset
-        // TODO:usualy blocks is already sorted, we can optimize this.
-        std::sort(blocks.begin(), blocks.end(),
-                  [](const block_t &a, const block_t &b) { return a.offset < b.offset; });
-
-        for (auto &block : blocks) {
-            if (block.offset == cur_end) {
-                cur_block.second += block_size;
-            }
-            else {
-                if (cur_block.second != 0) {
-                    mr_blocks.push_back(cur_block);
-                }
-                cur_block.first = block.offset;
-                cur_block.second = block.offset + block_size;
-                DEBUG("cur_block: {}, {}", cur_block.first, cur_block.second);
-            }
-            cur_end = cur_block.second;
-        }
-        if (cur_block.second != 0) {
-            mr_blocks.push_back(cur_block);
-        }
-
-        DEBUG("mr_blocks size: {}, blocks size: {}", mr_blocks.size(), blocks.size());
-
-        // register mr for each block, and save it to temperary local_mr
-        for (auto &mr_block : mr_blocks) {
-            void *ptr = base_ptr + mr_block.first;
-            IBVMemoryRegion *mr =
-                new IBVMemoryRegion(conn->pd, ptr, mr_block.second - mr_block.first);
-            local_mr[(uintptr_t)ptr] = mr;
-            conn->rdma_inflight_mr_size += mr->get_mr()->length;
-        }
     }
     else {
         // A10G or V100 has enough bar1 memory, so we can register the whole
@@ -739,7 +1028,16 @@ int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block
     remote_meta_request request = {
         .keys = keys,
         .block_size = block_size,
+        .sizes = sizes,
+        .pinned = options.pinned,
+        .chain = options.chain,
+        .parent = options.parent,
+        .ttl_ms = options.ttl_ms,
+        .if_absent = op == OP_RDMA_WRITE && options.if_absent,
     };
+    if (pack_digests(request.keys, request.digests)) {
+        request.keys.clear();
+    }
 
     std::string serialized_data;
     if (!serialize(request, serialized_data)) {
@@ -775,6 +1073,11 @@ int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block
         return -1;
     }
 
+    if (return_code == NOT_ADMITTED) {
+        // nothing was allocated, nothing to transfer
+        DEBUG("write of {} keys not admitted", blocks.size());
+        return WRITE_NOT_ADMITTED;
+    }
     if (return_code != TASK_ACCEPTED) {
         ERROR("Remote operation failed {}", return_code);
         return -1;
@@ -797,54 +1100,168 @@ int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block
         return -1;
     }
 
-    if (response.blocks.size() != blocks.size()) {
+    if (response.blocks.size() != blocks.size() ||
+        (!response.present.empty() && response.present.size() != (blocks.size() + 7) / 8)) {
         ERROR("Invalid response");
         return -1;
     }
+    if (present) {
+        present->assign(blocks.size(), false);
+        for (size_t i = 0; i < blocks.size() && !response.present.empty(); ++i) {
+            (*present)[i] = response.present[i / 8] >> (i % 8) & 1;
+        }
+    }
 
-    // if incoming blocks plus current inflight blocks exceed MAX_WR, wait
-    std::unique_lock<std::mutex> lock(conn->mutex);
-    conn->cv.wait(lock,
-                  [&conn, &blocks] { return conn->rdma_inflight_count + blocks.size() <= MAX_WR; });
+    // one piece per remote extent, a value the server split into several
+    // extents is read or written with one work request per extent. A key the
+    // server already stored has no extent and is skipped.
+    struct piece_t {
+        unsigned long offset;  // in the local buffer
+        uintptr_t remote_addr;
+        uint32_t rkey;
+        size_t size;
+    };
+    std::vector<piece_t> pieces;
+    pieces.reserve(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        size_t pos = 0;
+        for (const auto &extent : response.blocks[i]) {
+            DEBUG("remote response: addr: {}, rkey: {}, size: {}", extent.remote_addr,
+                  extent.rkey, extent.size);
+            pieces.push_back({.offset = blocks[i].offset + pos,
+                              .remote_addr = extent.remote_addr,
+                              .rkey = extent.rkey,
+                              .size = extent.size});
+            pos += extent.size;
+        }
+        if (pos > slot_size(i)) {
+            ERROR("Value of {} has {} bytes, more than its {} bytes buffer", blocks[i].key, pos,
+                  slot_size(i));
+            return -1;
+        }
+    }
 
-    for (int i = 0; i < response.blocks.size(); i++) {
-        DEBUG("remote response: addr: {}, rkey: {}", response.blocks[i].remote_addr,
-              response.blocks[i].rkey);
+    // temporary MRs are only registered for a transfer that takes place: they
+    // are freed by cq_handler once the work requests using them completed.
+    // They cover the pieces to transfer, so every one of them gets a work
+    // request; keys the server already stored have none.
+    if (conn->limited_bar1) {
+        std::pair<unsigned long, unsigned long> cur_block = {0, 0};
+        size_t cur_end = -1;
+        // sort (offset, size) of the pieces by offset
+        // TODO:usualy pieces are already sorted, we can optimize this.
+        std::vector<std::pair<unsigned long, size_t>> ranges;
+        ranges.reserve(pieces.size());
+        for (const auto &piece : pieces) {
+            ranges.push_back({piece.offset, piece.size});
+        }
+        std::sort(ranges.begin(), ranges.end());
 
-        // request_mr could be temperary mr or registered mr
-        IBVMemoryRegion *request_mr = NULL;
-        if (conn->limited_bar1) {
-            request_mr = search_mr_from_ptr(local_mr, (char *)base_ptr + blocks[i].offset);
+        for (auto &range : ranges) {
+            if (range.first == cur_end) {
+                cur_block.second += range.second;
+            }
+            else {
+                if (cur_block.second != 0) {
+                    mr_blocks.push_back(cur_block);
+                }
+                cur_block.first = range.first;
+                cur_block.second = range.first + range.second;
+                DEBUG("cur_block: {}, {}", cur_block.first, cur_block.second);
+            }
+            cur_end = cur_block.second;
         }
-        else {
-            request_mr = search_mr_from_ptr(conn->local_mr, (char *)base_ptr + blocks[i].offset);
+        if (cur_block.second != 0) {
+            mr_blocks.push_back(cur_block);
         }
-        int ret;
-        if (op == OP_RDMA_WRITE) {
-            ret = perform_rdma_write(conn, (char *)base_ptr + blocks[i].offset, block_size,
-                                     response.blocks[i].remote_addr, block_size,
-                                     response.blocks[i].rkey, request_mr);
+
+        DEBUG("mr_blocks size: {}, pieces size: {}", mr_blocks.size(), pieces.size());
+
+        // register mr for each block, and save it to temperary local_mr
+        for (auto &mr_block : mr_blocks) {
+            void *ptr = base_ptr + mr_block.first;
+            IBVMemoryRegion *mr =
+                new IBVMemoryRegion(conn->pd, ptr, mr_block.second - mr_block.first);
+            local_mr[(uintptr_t)ptr] = mr;
+            conn->rdma_inflight_mr_size += mr->get_mr()->length;
+            // held until every work request is posted
+            mr->add_ref();
         }
-        else if (op == OP_RDMA_READ) {
-            ret = perform_rdma_read(conn, response.blocks[i].remote_addr, block_size,
-                                    (char *)base_ptr + blocks[i].offset, block_size,
-                                    response.blocks[i].rkey, request_mr);
+    }
+
+    // pieces that are contiguous on both sides are merged into one work request.
+    // The server places a batch in as few contiguous extents as it can.
+    struct request_t {
+        size_t piece;  // the first one
+        size_t size;
+    };
+    std::vector<request_t> requests;
+    for (size_t i = 0; i < pieces.size();) {
+        size_t j = i + 1;
+        size_t size = pieces[i].size;
+        while (j < pieces.size() && pieces[j].rkey == pieces[i].rkey &&
+               pieces[j].remote_addr == pieces[j - 1].remote_addr + pieces[j - 1].size &&
+               pieces[j].offset == pieces[j - 1].offset + pieces[j - 1].size &&
+               size + pieces[j].size <= MAX_RDMA_MSG_SIZE) {
+            size += pieces[j].size;
+            j++;
         }
-        else {
-            ERROR("Invalid operation");
-            return -1;
+        if (j - i > 1) {
+            DEBUG("merge pieces [{}, {}) into one request of {} bytes", i, j, size);
+        }
+        requests.push_back({.piece = i, .size = size});
+        i = j;
+    }
+
+    // at most MAX_WR work requests are in flight: post them in chunks of one
+    // chain each, once the requests in flight leave room for it
+    std::vector<rdma_request_t> chain;
+    size_t posted = 0;
+    int ret = 0;
+    do {
+        size_t count = std::min(requests.size() - posted, (size_t)MAX_WR);
+        chain.clear();
+        for (size_t k = posted; k < posted + count; ++k) {
+            const piece_t &piece = pieces[requests[k].piece];
+            char *local_ptr = (char *)base_ptr + piece.offset;
+            // request_mr could be temperary mr or registered mr
+            IBVMemoryRegion *request_mr = NULL;
+            if (conn->limited_bar1) {
+                request_mr = search_mr_from_ptr(local_mr, local_ptr);
+            }
+            else {
+                request_mr = search_mr_from_ptr(conn->local_mr, local_ptr);
+            }
+            chain.push_back({.local_ptr = local_ptr,
+                             .remote_addr = piece.remote_addr,
+                             .rkey = piece.rkey,
+                             .size = requests[k].size,
+                             .mr = request_mr});
         }
-        if (ret < 0) {
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        conn->cv.wait(lock, [&conn, count] { return conn->rdma_inflight_count + count <= MAX_WR; });
+        if (post_rdma_chain(conn, op, chain) < 0) {
             ERROR("Failed to perform RDMA operation");
-            return -1;
+            ret = -1;
+            break;
         }
-    }
+        posted += count;
+        // released by the next sync_rdma, once every work request above completed
+        if (posted == requests.size() && response.lease != 0) {
+            conn->leases.push_back(response.lease);
+        }
+    } while (posted < requests.size());
 
-    return 0;
+    // drop the reference taken at registration, the posted work requests
+    // hold the temporary MRs from now on
+    for (auto &it : local_mr) {
+        conn->rdma_inflight_mr_size -= it.second->release();
+    }
+    return ret;
 }
 
 int rw_local(connection_t *conn, char op, const std::vector<block_t> &blocks, int block_size,
-             void *ptr) {
+             void *ptr, const write_options_t &options, std::vector<bool> *present) {
     assert(conn != NULL);
     assert(ptr != NULL);
 
@@ -857,7 +1274,21 @@ int rw_local(connection_t *conn, char op, const std::vector<block_t> &blocks, in
         .ipc_handle = ipc_handle,
         .block_size = block_size,
         .blocks = blocks,
+        .pinned = options.pinned,
+        .chain = options.chain,
+        .parent = options.parent,
+        .ttl_ms = options.ttl_ms,
+        .if_absent = op == OP_W && options.if_absent,
     };
+    std::vector<std::string> keys;
+    for (const auto &block : blocks) {
+        keys.push_back(block.key);
+    }
+    if (pack_digests(keys, meta.digests)) {
+        for (auto &block : meta.blocks) {
+            block.key.clear();
+        }
+    }
 
     std::string serialized_data;
     if (!serialize(meta, serialized_data)) {
@@ -894,8 +1325,26 @@ int rw_local(connection_t *conn, char op, const std::vector<block_t> &blocks, in
         return -1;
     }
 
+    if (return_code == NOT_ADMITTED) {
+        return WRITE_NOT_ADMITTED;
+    }
     if (return_code != FINISH && return_code != TASK_ACCEPTED) {
         return -1;
     }
+    if (meta.if_absent) {
+        // the size follows from the number of blocks
+        std::vector<uint8_t> bitmap((blocks.size() + 7) / 8, 0);
+        if (!bitmap.empty() && recv(conn->sock, bitmap.data(), bitmap.size(), MSG_WAITALL) !=
+                                   (ssize_t)bitmap.size()) {
+            ERROR("Failed to receive present bitmap");
+            return -1;
+        }
+        if (present) {
+            present->assign(blocks.size(), false);
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                (*present)[i] = bitmap[i / 8] >> (i % 8) & 1;
+            }
+        }
+    }
     return 0;
 }
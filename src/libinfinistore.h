@@ -17,6 +17,9 @@
 
 // typedef struct connection connection_t;
 
+// upper bound of one merged RDMA read/write
+#define MAX_RDMA_MSG_SIZE (1UL << 30)
+
 class IBVMemoryRegion {
    public:
     IBVMemoryRegion(struct ibv_pd *pd, void *addr, size_t length) : ref_count_(0) {
@@ -75,6 +78,8 @@ struct Connection {
     std::atomic<bool> stop{false};
     std::mutex mutex;
     std::condition_variable cv;
+    // leases of RDMA transfers posted since the last sync_rdma, guarded by mutex
+    std::vector<uint64_t> leases;
 
     // if GPU's bar1 is less than total avaliable memory, we need to set this
     // flag. so every RDMA read/write will have to check if the memory region is
@@ -91,19 +96,61 @@ struct Connection {
 
 typedef struct Connection connection_t;
 
+// how a write stores its values
+typedef struct {
+    bool pinned;  // never evicted
+    // link the blocks in the server's prefix index: blocks[0] follows parent,
+    // or starts a sequence if parent is empty, every next block the one before
+    bool chain;
+    std::string parent;
+    unsigned int ttl_ms;  // expire the values ttl_ms after the write, 0: never
+    // skip the keys the server already stores. A key is stored as soon as the
+    // server answered its write, before the writer's sync: a reader must not
+    // take present for written
+    bool if_absent;
+} write_options_t;
+
+// returned by rw_local and rw_rdma when the server's admission control
+// declined a write, no data was transferred
+#define WRITE_NOT_ADMITTED 1
+
 int init_connection(connection_t *conn, client_config_t config);
+// the next requests of conn are about the keys of namespace name, which the
+// server creates if needed. "": the default namespace
+int use_namespace(connection_t *conn, const std::string &name);
 // async rw local cpu memory, even rw_local returns, it is not guaranteed that
 // the operation is completed until sync_local is recved.
+// options: ignored by reads. present: like rw_rdma
 int rw_local(connection_t *conn, char op, const std::vector<block_t> &blocks, int block_size,
-             void *ptr);
+             void *ptr, const write_options_t &options, std::vector<bool> *present = NULL);
 int sync_local(connection_t *conn);
 int get_kvmap_len();
+std::map<std::string, size_t> get_mem_stats();
 int setup_rdma(connection_t *conn, client_config_t config);
-int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block_size, void *ptr,
-            size_t ptr_region_size);
-
+// sizes: length of each value, empty if every value is block_size bytes.
+// A value may come back from the server in several extents.
+// present: if_absent writes, set to one flag per block, true if the server already
+// stored the key and the block was not transferred
+int rw_rdma(connection_t *conn, char op, std::vector<block_t> &blocks, int block_size,
+            const std::vector<size_t> &sizes, void *ptr, size_t ptr_region_size,
+            const write_options_t &options, std::vector<bool> *present = NULL);
+
+// wait for the RDMA transfers posted so far, then release their leases in one request
 int sync_rdma(connection_t *conn);
 int check_exist(connection_t *conn, std::string key);
+// one round trip for many keys: bit i % 8 of (*bitmap)[i / 8] is set if keys[i] is stored
+int check_exist_batch(connection_t *conn, const std::vector<std::string> &keys,
+                      std::vector<uint8_t> *bitmap);
 int get_match_last_index(connection_t *conn, std::vector<std::string>);
+// drop key and every block chained after it, return the number of values dropped
+int drop_subtree(connection_t *conn, std::string key);
+// delete the keys, return the number of keys that were stored. A value stays
+// readable for a short grace period, a read that got its address still completes.
+int delete_keys(connection_t *conn, std::vector<std::string> keys);
+// keys[i] gets the value of sources[i] without moving data, the two keys share
+// it until either is written. Return keys.size(), or 0 if a source key is not
+// stored and nothing was cloned. options: like a write, if_absent is ignored
+int clone_keys(connection_t *conn, const std::vector<std::string> &sources,
+               const std::vector<std::string> &keys, const write_options_t &options);
 
 #endif  // LIBINFINISTORE_H
@@ -1,17 +1,91 @@
 #include "mempool.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <numeric>
 #include <stdexcept>
 
 #include "log.h"
+#include "topology.h"
 #include "utils.h"
 
-MemoryPool::MemoryPool(size_t pool_size, size_t block_size, struct ibv_pd* pd)
-    : pool_(nullptr), pool_size_(pool_size), block_size_(block_size), pd_(pd), mr_(nullptr) {
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+int thread_slot() {
+    static std::atomic<int> next_slot{0};
+    static thread_local int slot = next_slot.fetch_add(1) % THREAD_SLOTS;
+    return slot;
+}
+
+// mmap size bytes backed by huge pages, already faulted in. Fall back to
+// regular pages if the huge page pool can not serve the request.
+static void* alloc_hugepages(size_t size, size_t hugepage_size) {
+    int page_shift = __builtin_ctzl(hugepage_size);
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB |
+                         (page_shift << MAP_HUGE_SHIFT),
+                     -1, 0);
+    if (ptr != MAP_FAILED) {
+        INFO("Memory pool backed by {} KB huge pages", hugepage_size >> 10);
+        return ptr;
+    }
+    WARN("Failed to allocate {} KB huge pages: {}, fall back to regular pages",
+         hugepage_size >> 10, strerror(errno));
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        ERROR("Failed to mmap {} bytes: {}", size, strerror(errno));
+        return nullptr;
+    }
+    // ask for transparent huge pages before the pages are touched
+    madvise(ptr, size, MADV_HUGEPAGE);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// mmap size bytes of plain host memory, faulted in and locked. The pool is
+// only pinned by ibv_reg_mr, so no CUDA runtime or GPU is needed.
+static void* alloc_host(size_t size, size_t hugepage_size) {
+    void* ptr;
+    if (hugepage_size > 0) {
+        ptr = alloc_hugepages(size, hugepage_size);
+        if (!ptr) {
+            return nullptr;
+        }
+    }
+    else {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                   -1, 0);
+        if (ptr == MAP_FAILED) {
+            ERROR("Failed to mmap {} bytes: {}", size, strerror(errno));
+            return nullptr;
+        }
+    }
+    if (mlock(ptr, size) != 0) {
+        WARN("Failed to mlock {} bytes: {}, check RLIMIT_MEMLOCK", size, strerror(errno));
+    }
+    return ptr;
+}
+
+MemoryPool::MemoryPool(size_t pool_size, size_t block_size, struct ibv_pd* pd,
+                       const pool_options_t& options, int numa_node)
+    : pool_(nullptr),
+      mmapped_(options.hugepage_size > 0 || options.host_only),
+      host_only_(options.host_only),
+      numa_node_(numa_node),
+      pool_size_(pool_size),
+      block_size_(block_size),
+      magazines_(new Magazine[THREAD_SLOTS]),
+      free_blocks_(0),
+      mr_(nullptr),
+      pd_(pd) {
     // 计算总的内存块数量
     total_blocks_ = pool_size_ / block_size_;
     assert(pool_size % block_size == 0);
@@ -20,24 +94,69 @@ MemoryPool::MemoryPool(size_t pool_size, size_t block_size, struct ibv_pd* pd)
         "Memory pool size: {} bytes, block size: {} bytes, total blocks: {}, "
         "it may take a while",
         pool_size_, block_size_, total_blocks_);
-    CHECK_CUDA(cudaMallocHost(&pool_, pool_size_));
+    // pages are placed when they are faulted in below, by this thread
+    if (numa_node_ >= 0) {
+        INFO("Memory pool placed on NUMA node {}", numa_node_);
+        set_thread_mem_node(numa_node_);
+    }
+    // a failure leaves the pool not ready, the caller deletes it
+    if (host_only_) {
+        assert(options.hugepage_size == 0 || pool_size % options.hugepage_size == 0);
+        pool_ = alloc_host(pool_size_, options.hugepage_size);
+    }
+    else if (mmapped_) {
+        assert(pool_size % options.hugepage_size == 0);
+        pool_ = alloc_hugepages(pool_size_, options.hugepage_size);
+        // pin it for cudaMemcpyAsync of local GPU clients
+        cudaError_t err;
+        if (pool_ &&
+            (err = cudaHostRegister(pool_, pool_size_, cudaHostRegisterPortable)) != cudaSuccess) {
+            ERROR("Failed to pin {} bytes: {}", pool_size_, cudaGetErrorString(err));
+            munmap(pool_, pool_size_);
+            pool_ = nullptr;
+        }
+    }
+    else {
+        cudaError_t err = cudaMallocHost(&pool_, pool_size_);
+        if (err != cudaSuccess) {
+            ERROR("Failed to allocate {} bytes of pinned memory: {}", pool_size_,
+                  cudaGetErrorString(err));
+            pool_ = nullptr;
+        }
+    }
+    if (numa_node_ >= 0) {
+        set_thread_mem_node(-1);
+    }
+    if (!pool_) {
+        return;
+    }
     INFO("Memory pool allocated at {}", pool_);
 
     // 注册内存区域
-    mr_ = ibv_reg_mr(pd_, pool_, pool_size_,
-                     IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ);
-    if (!mr_) {
-        ERROR("Failed to register MR");
-        exit(EXIT_FAILURE);
+    if (pd_) {
+        mr_ = ibv_reg_mr(pd_, pool_, pool_size_,
+                         IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ);
+        if (!mr_) {
+            ERROR("Failed to register MR");
+            return;
+        }
     }
-    bitmap_.resize(total_blocks_, 0);
+    bitmap_.reset(total_blocks_);
+    in_use_.reset(new std::atomic<uint64_t>[(total_blocks_ + 63) / 64]());
+    free_blocks_ = total_blocks_;
 }
 
 MemoryPool::~MemoryPool() {
     if (mr_) {
         ibv_dereg_mr(mr_);
     }
-    if (pool_) {
+    if (pool_ && mmapped_) {
+        if (!host_only_) {
+            cudaHostUnregister(pool_);
+        }
+        munmap(pool_, pool_size_);
+    }
+    else if (pool_) {
         cudaFreeHost(pool_);
     }
 }
@@ -52,44 +171,129 @@ void* MemoryPool::allocate(size_t size) {
         return nullptr;
     }
 
-    size_t bit_per_word = 64;
-
-    for (size_t word_index = 0; word_index < bitmap_.size(); ++word_index) {
-        uint64_t word = bitmap_[word_index];
-        if (word == 0xFFFFFFFFFFFFFFFFULL) {
-            continue;
-        }
-
-        for (size_t bit_index = 0; bit_index < bit_per_word; ++bit_index) {
-            size_t start_block = word_index * bit_per_word + bit_index;
+    size_t start_block;
+    if (required_blocks == 1) {
+        start_block = allocate_cached();
+    }
+    else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_block = bitmap_.allocate(required_blocks);
+    }
+    if (start_block == BlockBitmap::npos) {
+        return nullptr;
+    }
+    set_in_use(start_block, required_blocks, true);
+    free_blocks_.fetch_sub(required_blocks, std::memory_order_relaxed);
+    return static_cast<char*>(pool_) + start_block * block_size_;
+}
 
-            if (start_block + required_blocks > total_blocks_) {
-                return nullptr;
-            }
+void* MemoryPool::allocate_lowest(size_t size) {
+    size_t required_blocks = (size + block_size_ - 1) / block_size_;
+    size_t start_block;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_block = bitmap_.allocate(required_blocks);
+    }
+    if (start_block == BlockBitmap::npos) {
+        return nullptr;
+    }
+    set_in_use(start_block, required_blocks, true);
+    free_blocks_.fetch_sub(required_blocks, std::memory_order_relaxed);
+    return static_cast<char*>(pool_) + start_block * block_size_;
+}
 
-            bool found = true;
-            for (size_t i = 0; i < required_blocks; ++i) {
-                size_t idx = (start_block + i) / bit_per_word;
-                size_t bit = (start_block + i) % bit_per_word;
-                if (bitmap_[idx] & (1ULL << bit)) {
-                    found = false;
-                    bit_index += i;  // skip all the blocks we already checked
+size_t MemoryPool::allocate_cached() {
+    Magazine& mag = magazines_[thread_slot()];
+    std::lock_guard<std::mutex> lock(mag.mutex);
+    if (mag.blocks.empty()) {
+        {
+            std::lock_guard<std::mutex> bitmap_lock(mutex_);
+            for (int i = 0; i < MAGAZINE_BATCH; ++i) {
+                size_t block = bitmap_.allocate(1);
+                if (block == BlockBitmap::npos) {
                     break;
                 }
+                mag.blocks.push_back(block);
             }
+        }
+        // hand out the lowest blocks first
+        std::reverse(mag.blocks.begin(), mag.blocks.end());
+        if (mag.blocks.empty() && !steal(mag)) {
+            return BlockBitmap::npos;
+        }
+    }
+    size_t block = mag.blocks.back();
+    mag.blocks.pop_back();
+    return block;
+}
 
-            if (found) {
-                for (size_t i = 0; i < required_blocks; ++i) {
-                    size_t idx = (start_block + i) / bit_per_word;
-                    size_t bit = (start_block + i) % bit_per_word;
-                    bitmap_[idx] |= (1ULL << bit);
-                }
-                void* addr = static_cast<char*>(pool_) + start_block * block_size_;
-                return addr;
+bool MemoryPool::steal(Magazine& mag) {
+    // try_lock: two threads stealing from each other must not deadlock
+    for (int i = 0; i < THREAD_SLOTS; ++i) {
+        Magazine& other = magazines_[i];
+        if (&other == &mag || !other.mutex.try_lock()) {
+            continue;
+        }
+        size_t n = (other.blocks.size() + 1) / 2;
+        mag.blocks.assign(other.blocks.end() - n, other.blocks.end());
+        other.blocks.resize(other.blocks.size() - n);
+        other.mutex.unlock();
+        if (n > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MemoryPool::set_in_use(size_t start, size_t n, bool in_use) {
+    bool changed = true;
+    for (size_t i = start; i < start + n;) {
+        size_t bit = i % 64;
+        size_t len = std::min<size_t>(64 - bit, start + n - i);
+        uint64_t mask = (len == 64 ? ~0ULL : (1ULL << len) - 1) << bit;
+        uint64_t old = in_use
+                           ? in_use_[i / 64].fetch_or(mask, std::memory_order_relaxed)
+                           : in_use_[i / 64].fetch_and(~mask, std::memory_order_relaxed);
+        if ((old & mask) != (in_use ? 0 : mask)) {
+            changed = false;
+        }
+        i += len;
+    }
+    return changed;
+}
+
+void MemoryPool::deallocate_cached(size_t block) {
+    Magazine& mag = magazines_[thread_slot()];
+    std::lock_guard<std::mutex> lock(mag.mutex);
+    mag.blocks.push_back(block);
+    if (mag.blocks.size() < 2 * MAGAZINE_BATCH) {
+        return;
+    }
+    // give the oldest half back
+    std::lock_guard<std::mutex> bitmap_lock(mutex_);
+    for (int i = 0; i < MAGAZINE_BATCH; ++i) {
+        if (!bitmap_.deallocate(mag.blocks[i], 1)) {
+            ERROR("Double free detected in block {}", mag.blocks[i]);
+        }
+    }
+    mag.blocks.erase(mag.blocks.begin(), mag.blocks.begin() + MAGAZINE_BATCH);
+}
+
+void MemoryPool::flush_magazines() {
+    for (int i = 0; i < THREAD_SLOTS; ++i) {
+        Magazine& mag = magazines_[i];
+        std::lock_guard<std::mutex> lock(mag.mutex);
+        if (mag.blocks.empty()) {
+            continue;
+        }
+        std::lock_guard<std::mutex> bitmap_lock(mutex_);
+        for (size_t block : mag.blocks) {
+            if (!bitmap_.deallocate(block, 1)) {
+                ERROR("Double free detected in block {}", block);
             }
         }
+        mag.blocks.clear();
     }
-    return nullptr;
 }
 
 void MemoryPool::deallocate(void* ptr, size_t size) {
@@ -115,22 +319,352 @@ void MemoryPool::deallocate(void* ptr, size_t size) {
         return;
     }
 
-    for (size_t i = start_block; i < start_block + blocks_to_free; ++i) {
-        size_t idx = i / 64;
-        size_t bit = i % 64;
-        if (bitmap_[idx] & (1ULL << bit)) {
-            bitmap_[idx] &= ~(1ULL << bit);
+    if (blocks_to_free == 1) {
+        // a block that is free in the bitmap or held in a magazine is not in use
+        if (!set_in_use(start_block, 1, false)) {
+            ERROR("Double free detected in block {}", start_block);
+            return;
+        }
+        deallocate_cached(start_block);
+    }
+    else {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!bitmap_.deallocate(start_block, blocks_to_free)) {
+            ERROR("Double free detected in blocks [{}, {})", start_block,
+                  start_block + blocks_to_free);
+            return;
+        }
+        // before the mutex is released, the blocks may be handed out again then
+        set_in_use(start_block, blocks_to_free, false);
+    }
+    free_blocks_.fetch_add(blocks_to_free, std::memory_order_relaxed);
+}
+
+double MemoryPool::get_fragmentation() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t free_blocks = bitmap_.free_blocks();
+    if (free_blocks == 0) {
+        return 0;
+    }
+    return 1 - (double)bitmap_.largest_free_run() / free_blocks;
+}
+
+bool MemoryPool::reformat(size_t block_size) {
+    if (!is_empty() || block_size == 0 || pool_size_ % block_size != 0) {
+        return false;
+    }
+    // blocks held in magazines are free, they only need to be forgotten
+    for (int i = 0; i < THREAD_SLOTS; ++i) {
+        magazines_[i].blocks.clear();
+    }
+    block_size_ = block_size;
+    total_blocks_ = pool_size_ / block_size_;
+    bitmap_.reset(total_blocks_);
+    in_use_.reset(new std::atomic<uint64_t>[(total_blocks_ + 63) / 64]());
+    free_blocks_ = total_blocks_;
+    return true;
+}
+
+MM::MM(size_t pool_size, size_t max_pool_size,
+       const std::vector<size_class_config_t>& size_classes, const pool_options_t& options,
+       struct ibv_pd* pd)
+    : pd_(pd), options_(options) {
+    std::vector<size_class_config_t> sorted(size_classes);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const size_class_config_t& a, const size_class_config_t& b) {
+                  return a.block_size < b.block_size;
+              });
+
+    size_t total_slabs = std::max<size_t>(pool_size / SLAB_SIZE, 1);
+    std::vector<size_t> slabs;
+    for (const auto& cfg : sorted) {
+        SizeClass size_class = {.block_size = cfg.block_size << 10, .pools = {}};
+        assert(SLAB_SIZE % size_class.block_size == 0);
+        classes_.push_back(size_class);
+        // every class owns at least one slab, so it can serve before rebalancing
+        slabs.push_back(std::max<size_t>((total_slabs * cfg.share + 50) / 100, 1));
+        INFO("size class {} KB: {} slabs", cfg.block_size, slabs.back());
+    }
+    // interleave classes, so every class gets its first slab early
+    for (size_t round = 0; pending_.size() < std::accumulate(slabs.begin(), slabs.end(), 0UL);
+         ++round) {
+        for (size_t i = 0; i < slabs.size(); ++i) {
+            if (round < slabs[i]) {
+                int node = options_.numa_nodes.empty()
+                               ? -1
+                               : options_.numa_nodes[round % options_.numa_nodes.size()];
+                pending_.push_back({.class_idx = (int)i, .numa_node = node});
+            }
+        }
+    }
+    min_slabs_ = pending_.size();
+    max_slabs_ = std::max(max_pool_size / SLAB_SIZE, min_slabs_);
+    mempools_.reserve(max_slabs_);
+    growing_.assign(classes_.size(), 0);
+    INFO("memory pools: {} slabs, up to {} slabs", min_slabs_, max_slabs_);
+}
+
+MM::~MM() {
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex_);
+        stopping_ = true;
+    }
+    grow_cv_.notify_all();
+    if (grower_.joinable()) {
+        grower_.join();
+    }
+    for (auto& loader : loaders_) {
+        loader.join();
+    }
+    for (auto& loaded : loaded_) {
+        delete loaded.second;
+    }
+    for (auto& grown : grown_) {
+        delete grown.second;
+    }
+    for (auto& pool : mempools_) {
+        delete pool;
+    }
+}
+
+MemoryPool* MM::create_pool(int class_idx, int numa_node) const {
+    MemoryPool* pool =
+        new MemoryPool(SLAB_SIZE, classes_[class_idx].block_size, pd_, options_, numa_node);
+    if (!pool->is_ready()) {
+        ERROR("Failed to build a slab of size class {} KB", classes_[class_idx].block_size >> 10);
+        delete pool;
+        return nullptr;
+    }
+    return pool;
+}
+
+int MM::add_pool(int class_idx, MemoryPool* pool) {
+    // reuse the slot of a released pool
+    auto it = std::find(mempools_.begin(), mempools_.end(), nullptr);
+    int idx = it - mempools_.begin();
+    if (it == mempools_.end()) {
+        // readers do not take lock_, see mempools_
+        assert(mempools_.size() < mempools_.capacity());
+        mempools_.push_back(pool);
+    }
+    else {
+        *it = pool;
+    }
+    pools_by_addr_[(uintptr_t)pool->get_base()] = idx;
+    // first fit walks the pools in order, keep the ones on the preferred node in front
+    std::vector<int>& pools = classes_[class_idx].pools;
+    if (pool->get_numa_node() == preferred_node()) {
+        auto pos = std::find_if(pools.begin(), pools.end(), [this](int p) {
+            return mempools_[p]->get_numa_node() != preferred_node();
+        });
+        pools.insert(pos, idx);
+    }
+    else {
+        pools.push_back(idx);
+    }
+    n_slabs_++;
+    return idx;
+}
+
+void MM::load_async(int n_threads, std::function<void()> on_loaded) {
+    on_loaded_ = on_loaded;
+    auto loader = [this, on_loaded]() {
+        size_t i;
+        while ((i = next_pending_.fetch_add(1)) < pending_.size()) {
+            // fault the slab in from cpus of its own node
+            bind_thread_to_node(pending_[i].numa_node);
+            MemoryPool* pool = create_pool(pending_[i].class_idx, pending_[i].numa_node);
+            {
+                std::lock_guard<std::mutex> lock(loaded_mutex_);
+                if (pool) {
+                    loaded_.push_back({pending_[i].class_idx, pool});
+                }
+                else {
+                    load_failed_ = true;
+                }
+                // the owner is going away, or gives up after a failure
+                if (stopping_ || load_failed_) {
+                    next_pending_ = pending_.size();
+                }
+            }
+            on_loaded();
+        }
+    };
+    for (int i = 0; i < n_threads; ++i) {
+        loaders_.emplace_back(loader);
+    }
+}
+
+size_t MM::collect_loaded() {
+    std::vector<std::pair<int, MemoryPool*>> loaded, grown;
+    {
+        std::lock_guard<std::mutex> lock(loaded_mutex_);
+        loaded.swap(loaded_);
+        grown.swap(grown_);
+    }
+    std::lock_guard<SlotLock> guard(lock_);
+    for (auto& slab : loaded) {
+        add_pool(slab.first, slab.second);
+    }
+    collected_ += loaded.size();
+    if (!loaded.empty()) {
+        INFO("memory pools: {} of {} initial slabs ready", collected_, pending_.size());
+    }
+    for (auto& slab : grown) {
+        int idx = add_pool(slab.first, slab.second);
+        INFO("add slab {} to size class {} KB, {} of {} slabs in use", idx,
+             classes_[slab.first].block_size >> 10, n_slabs_, max_slabs_);
+        std::lock_guard<std::mutex> lock(loaded_mutex_);
+        growing_[slab.first]--;
+    }
+    return loaded.size() + grown.size();
+}
+
+int MM::most_fragmented_pool(double threshold, double* fragmentation) {
+    SlotLock::Shared guard(lock_);
+    int worst = -1;
+    *fragmentation = threshold;
+    for (size_t i = 0; i < mempools_.size(); ++i) {
+        if (!mempools_[i]) {
+            continue;
+        }
+        mempools_[i]->flush_magazines();
+        double frag = mempools_[i]->get_fragmentation();
+        if (frag > *fragmentation) {
+            worst = i;
+            *fragmentation = frag;
+        }
+    }
+    return worst;
+}
+
+size_t MM::get_used_size() const {
+    SlotLock::Shared guard(lock_);
+    size_t used = 0;
+    for (const auto& pool : mempools_) {
+        if (pool) {
+            used += (pool->get_total_blocks() - pool->get_free_blocks()) * pool->get_block_size();
+        }
+    }
+    return used;
+}
+
+size_t MM::free_bytes(int class_idx) const {
+    size_t bytes = 0;
+    for (int i : classes_[class_idx].pools) {
+        bytes += mempools_[i]->get_free_blocks() * mempools_[i]->get_block_size();
+    }
+    return bytes;
+}
+
+void MM::request_grow(int class_idx) {
+    std::lock_guard<std::mutex> lock(loaded_mutex_);
+    size_t requested = std::accumulate(growing_.begin(), growing_.end(), 0UL);
+    // nothing is built before load_async(), which gives the callback
+    if (!on_loaded_ || stopping_ || growing_[class_idx] > 0 ||
+        n_slabs_ + pending_.size() - collected_ + requested >= max_slabs_) {
+        return;
+    }
+    growing_[class_idx]++;
+    grow_queue_.push_back(class_idx);
+    if (!grower_.joinable()) {
+        grower_ = std::thread(&MM::grow_loop, this);
+    }
+    grow_cv_.notify_one();
+}
+
+void MM::grow_loop() {
+    bind_thread_to_node(preferred_node());
+    std::unique_lock<std::mutex> lock(loaded_mutex_);
+    while (true) {
+        grow_cv_.wait(lock, [this]() { return stopping_ || !grow_queue_.empty(); });
+        if (stopping_) {
+            return;
+        }
+        int class_idx = grow_queue_.front();
+        grow_queue_.erase(grow_queue_.begin());
+        // allocating, faulting in and registering a slab takes seconds
+        lock.unlock();
+        MemoryPool* pool = create_pool(class_idx, preferred_node());
+        lock.lock();
+        if (pool) {
+            grown_.push_back({class_idx, pool});
         }
         else {
-            ERROR("Double free detected at block index {}", i);
+            // asked again the next time the class runs low
+            growing_[class_idx]--;
         }
+        lock.unlock();
+        on_loaded_();
+        lock.lock();
     }
 }
 
-void* MM::allocate(size_t size, int* pool_idx) {
-    // first fit. TODO: binaray search
-    for (int i = 0; i < mempools_.size(); ++i) {
-        void* ptr = mempools_[i]->allocate(size);
+size_t MM::shrink() {
+    std::lock_guard<SlotLock> guard(lock_);
+    std::set<int> idle;
+    size_t released = 0;
+    for (auto& size_class : classes_) {
+        std::vector<int>& pools = size_class.pools;
+        for (auto it = pools.begin(); it != pools.end();) {
+            MemoryPool* pool = mempools_[*it];
+            if (!pool->is_empty()) {
+                ++it;
+                continue;
+            }
+            if (n_slabs_ > min_slabs_ && pools.size() > 1 && idle_pools_.count(*it)) {
+                INFO("release empty slab {} of size class {} KB", *it, size_class.block_size >> 10);
+                pools_by_addr_.erase((uintptr_t)pool->get_base());
+                delete pool;
+                mempools_[*it] = nullptr;
+                n_slabs_--;
+                released++;
+                it = pools.erase(it);
+                continue;
+            }
+            idle.insert(*it);
+            ++it;
+        }
+    }
+    idle_pools_.swap(idle);
+    return released;
+}
+
+int MM::pool_of(const void* ptr) const {
+    SlotLock::Shared guard(lock_);
+    return find_pool(ptr);
+}
+
+int MM::find_pool(const void* ptr) const {
+    auto it = pools_by_addr_.upper_bound((uintptr_t)ptr);
+    if (it == pools_by_addr_.begin()) {
+        return -1;
+    }
+    --it;
+    const MemoryPool* pool = mempools_[it->second];
+    if ((uintptr_t)ptr >= it->first + pool->get_pool_size()) {
+        return -1;
+    }
+    return it->second;
+}
+
+int MM::best_class(size_t size) const {
+    for (size_t i = 0; i < classes_.size(); ++i) {
+        if (classes_[i].block_size >= size) {
+            return i;
+        }
+    }
+    return classes_.size() - 1;
+}
+
+void* MM::allocate_from_class(int class_idx, size_t size, size_t count, int* pool_idx) {
+    // first fit, pools without enough free blocks are skipped without searching
+    for (int i : classes_[class_idx].pools) {
+        size_t required = mempools_[i]->get_stride(size) * count;
+        if (mempools_[i]->get_free_blocks() * mempools_[i]->get_block_size() < required) {
+            continue;
+        }
+        void* ptr = mempools_[i]->allocate(required);
         if (ptr) {
             *pool_idx = i;
             return ptr;
@@ -138,6 +672,165 @@ void* MM::allocate(size_t size, int* pool_idx) {
     }
     return nullptr;
 }
+
+bool MM::rebalance(int class_idx) {
+    // take an empty slab from the class with the most idle slabs, never its last one
+    int donor = -1;
+    size_t donor_empty = 0;
+    for (int i = 0; i < (int)classes_.size(); ++i) {
+        if (i == class_idx || classes_[i].pools.size() <= 1) {
+            continue;
+        }
+        size_t n_empty = std::count_if(classes_[i].pools.begin(), classes_[i].pools.end(),
+                                       [this](int p) { return mempools_[p]->is_empty(); });
+        if (n_empty > donor_empty) {
+            donor = i;
+            donor_empty = n_empty;
+        }
+    }
+    if (donor < 0) {
+        return false;
+    }
+
+    std::vector<int>& pools = classes_[donor].pools;
+    for (auto it = pools.begin(); it != pools.end(); ++it) {
+        MemoryPool* pool = mempools_[*it];
+        if (pool->is_empty() && pool->reformat(classes_[class_idx].block_size)) {
+            INFO("move slab {} from size class {} KB to {} KB", *it,
+                 classes_[donor].block_size >> 10, classes_[class_idx].block_size >> 10);
+            classes_[class_idx].pools.push_back(*it);
+            pools.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void* MM::allocate_contiguous(size_t size, size_t count, int* pool_idx) {
+    int best = best_class(size);
+    void* ptr = allocate_from_class(best, size, count, pool_idx);
+    if (ptr || (rebalance(best) && (ptr = allocate_from_class(best, size, count, pool_idx)))) {
+        return ptr;
+    }
+    size_t block_size = classes_[best].block_size;
+    size_t required = (size + block_size - 1) / block_size * block_size * count;
+    if (required <= SLAB_SIZE) {
+        // for the next calls, this one does not wait for it
+        request_grow(best);
+    }
+    // fall back to larger blocks first, then to runs of smaller blocks
+    for (int i = best + 1; i < (int)classes_.size(); ++i) {
+        if ((ptr = allocate_from_class(i, size, count, pool_idx))) {
+            return ptr;
+        }
+    }
+    for (int i = best - 1; i >= 0; --i) {
+        if ((ptr = allocate_from_class(i, size, count, pool_idx))) {
+            return ptr;
+        }
+    }
+    return nullptr;
+}
+
+void* MM::allocate_any(size_t size, size_t count, int* pool_idx, size_t* stride) {
+    void* ptr;
+    {
+        SlotLock::Shared guard(lock_);
+        int class_idx = best_class(size);
+        if ((ptr = allocate_from_class(class_idx, size, count, pool_idx))) {
+            *stride = mempools_[*pool_idx]->get_stride(size);
+            // the next slab is on its way before the class runs out
+            if (n_slabs_ < max_slabs_ && free_bytes(class_idx) < GROW_LOW_WATER) {
+                request_grow(class_idx);
+            }
+            return ptr;
+        }
+    }
+    // rebalancing or growing changes the pool list
+    std::lock_guard<SlotLock> guard(lock_);
+    if ((ptr = allocate_contiguous(size, count, pool_idx))) {
+        *stride = mempools_[*pool_idx]->get_stride(size);
+    }
+    return ptr;
+}
+
+void MM::free_extents(const std::vector<extent_t>& extents) {
+    SlotLock::Shared guard(lock_);
+    for (const auto& extent : extents) {
+        mempools_[extent.pool_idx]->deallocate(extent.ptr, extent.stride * extent.count);
+    }
+}
+
+void* MM::allocate(size_t size, int* pool_idx) {
+    size_t stride;
+    return allocate_any(size, 1, pool_idx, &stride);
+}
+
+bool MM::allocate_batch(size_t size, size_t count, std::vector<extent_t>* extents) {
+    extents->clear();
+    size_t remaining = count;
+    size_t chunk = count;
+    // try the whole batch first, then halve the extent size until it fits
+    while (remaining > 0) {
+        size_t n = std::min(chunk, remaining);
+        int pool_idx;
+        size_t stride;
+        void* ptr = allocate_any(size, n, &pool_idx, &stride);
+        if (ptr) {
+            extents->push_back({.ptr = ptr, .count = n, .stride = stride, .pool_idx = pool_idx});
+            remaining -= n;
+            continue;
+        }
+        if (n == 1) {
+            // roll back
+            free_extents(*extents);
+            extents->clear();
+            return false;
+        }
+        chunk = (n + 1) / 2;
+    }
+    return true;
+}
+
+bool MM::allocate_scattered(size_t size, std::vector<extent_t>* segments) {
+    segments->clear();
+    // segments other than the last are multiples of the smallest block size,
+    // classes_ itself never changes after construction
+    size_t min_chunk = classes_.front().block_size;
+    size_t remaining = size;
+    size_t chunk = std::min(size, (size_t)SLAB_SIZE);
+    while (remaining > 0) {
+        size_t n = std::min(chunk, remaining);
+        int pool_idx;
+        size_t stride;
+        void* ptr = allocate_any(n, 1, &pool_idx, &stride);
+        if (ptr) {
+            segments->push_back({.ptr = ptr, .count = 1, .stride = n, .pool_idx = pool_idx});
+            remaining -= n;
+            continue;
+        }
+        if (n <= min_chunk) {
+            // roll back
+            free_extents(*segments);
+            segments->clear();
+            return false;
+        }
+        chunk = (n / 2 + min_chunk - 1) / min_chunk * min_chunk;
+    }
+    return true;
+}
+
 void MM::deallocate(void* ptr, size_t size, int pool_idx) {
+    SlotLock::Shared guard(lock_);
+    mempools_[pool_idx]->deallocate(ptr, size);
+}
+
+void MM::deallocate(void* ptr, size_t size) {
+    SlotLock::Shared guard(lock_);
+    int pool_idx = find_pool(ptr);
+    if (pool_idx < 0) {
+        ERROR("Pointer {} does not belong to any pool", ptr);
+        return;
+    }
     mempools_[pool_idx]->deallocate(ptr, size);
 }
@@ -6,15 +6,109 @@
 #include <cuda_runtime.h>
 #include <infiniband/verbs.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 #include <vector>
 
+#include "bitmap.h"
+#include "config.h"
+
+// pools are carved in slabs of this size, so memory can move between size
+// classes one slab at a time.
+#define SLAB_SIZE (1UL << 30)
+// a class that may still grow gets a new slab built in the background once
+// less than this is free in it
+#define GROW_LOW_WATER (SLAB_SIZE / 4)
+
+// per-thread state (the magazines of a pool, the reader locks of MM) is kept in
+// this many slots, threads beyond that share a slot
+#define THREAD_SLOTS 64
+// single blocks a magazine takes from or gives back to the bitmap at once
+#define MAGAZINE_BATCH 32
+
+// slot of the calling thread, in [0, THREAD_SLOTS)
+int thread_slot();
+
+/*
+SlotLock is a reader/writer lock for data that is read on every allocation
+and changed rarely. A reader only locks the mutex of its own thread slot, so
+readers on different cores never write to a shared cache line. A writer locks
+every slot. A thread must not take it again while it holds it.
+*/
+class SlotLock {
+   public:
+    void lock_shared() { slots_[thread_slot()].mutex.lock(); }
+    void unlock_shared() { slots_[thread_slot()].mutex.unlock(); }
+    void lock() {
+        for (auto& slot : slots_) {
+            slot.mutex.lock();
+        }
+    }
+    void unlock() {
+        for (auto& slot : slots_) {
+            slot.mutex.unlock();
+        }
+    }
+
+    class Shared {
+       public:
+        explicit Shared(SlotLock& lock) : lock_(lock) { lock_.lock_shared(); }
+        ~Shared() { lock_.unlock_shared(); }
+
+       private:
+        SlotLock& lock_;
+    };
+
+   private:
+    struct Slot {
+        std::mutex mutex;
+        char pad[64];  // one cache line per slot
+    };
+    Slot slots_[THREAD_SLOTS];
+};
+
+// how the memory of a pool is obtained
+typedef struct {
+    // back the pool with huge pages of this size (2 MB or 1 GB). If they can not
+    // be allocated, regular pages are used. 0: pinned memory from cudaMallocHost
+    size_t hugepage_size;
+    // slabs are spread over these NUMA nodes, the first one is preferred for
+    // allocations. empty: no NUMA binding
+    std::vector<int> numa_nodes;
+    // plain mmap + mlock memory without any CUDA call, for servers without a GPU
+    bool host_only;
+} pool_options_t;
+
+/*
+MemoryPool is safe to use from many threads. Runs of several blocks come
+from the bitmap under the pool mutex. Single blocks go through a magazine per
+thread slot: a small stack of free blocks taken from and given back to the
+bitmap MAGAZINE_BATCH at a time, so most single block allocations only touch
+the caller's own magazine.
+*/
 class MemoryPool {
    public:
-    MemoryPool(size_t pool_size, size_t block_size, struct ibv_pd* pd);
+    /*
+    @brief numa_node: node the memory is placed on, -1 for the default policy.
+    pd may be NULL for a pool that is not registered with RDMA (tests).
+    Check is_ready() before using the pool.
+    */
+    MemoryPool(size_t pool_size, size_t block_size, struct ibv_pd* pd,
+               const pool_options_t& options, int numa_node = -1);
 
     ~MemoryPool();
 
+    // false if the memory could not be allocated, pinned or registered, the
+    // pool can only be deleted then
+    bool is_ready() const { return pool_ && (!pd_ || mr_); }
+
     /*
     @brief size should be aligned to block size
     */
@@ -24,42 +118,258 @@ class MemoryPool {
     */
     void deallocate(void* ptr, size_t size);
 
-    uint32_t get_rkey() const { return mr_->rkey; }
+    /*
+    @brief first fit on the bitmap, bypassing the magazines, so the lowest
+    free address is returned. Used to relocate values.
+    */
+    void* allocate_lowest(size_t size);
+    // give every block held in magazines back to the bitmap
+    void flush_magazines();
+
+    uint32_t get_rkey() const { return mr_ ? mr_->rkey : 0; }
+    void* get_base() const { return pool_; }
+    size_t get_pool_size() const { return pool_size_; }
+    int get_numa_node() const { return numa_node_; }
+    size_t get_block_size() const { return block_size_; }
+    // bytes one value of size occupies, rounded up to whole blocks
+    size_t get_stride(size_t size) const {
+        return (size + block_size_ - 1) / block_size_ * block_size_;
+    }
+    // blocks not handed out, including the ones held in magazines
+    size_t get_free_blocks() const { return free_blocks_.load(std::memory_order_relaxed); }
+    size_t get_total_blocks() const { return total_blocks_; }
+    bool is_empty() const { return get_free_blocks() == total_blocks_; }
+    /*
+    @brief 1 - largest free run / free blocks. 0 when the free space is one
+    run, close to 1 when it is scattered in single blocks. Blocks held in
+    magazines count as used, flush_magazines() first for an exact value.
+    */
+    double get_fragmentation() const;
+
+    /*
+    @brief change the block size of an empty pool, the registered memory is kept.
+    block_size must divide the pool size. No other thread may use the pool.
+    */
+    bool reformat(size_t block_size);
 
    private:
+    struct Magazine {
+        std::mutex mutex;
+        std::vector<size_t> blocks;  // free blocks, taken from the back
+        char pad[64];
+    };
+
+    size_t allocate_cached();
+    void deallocate_cached(size_t block);
+    // set or clear the in-use bits of [start, start + n). Return false if any
+    // of them already had that state
+    bool set_in_use(size_t start, size_t n, bool in_use);
+    // take blocks from the magazines of other slots, the caller holds mag's mutex
+    bool steal(Magazine& mag);
+
     void* pool_;
+    bool mmapped_;    // pool_ comes from mmap instead of cudaMallocHost
+    bool host_only_;  // pool_ is not registered with CUDA
+    int numa_node_;
     size_t pool_size_;
     size_t block_size_;
     size_t total_blocks_;
 
-    // TODO: use judy libray to speed up the bitmap?
-    std::vector<uint64_t> bitmap_;
+    // guards bitmap_
+    mutable std::mutex mutex_;
+    BlockBitmap bitmap_;
+    std::unique_ptr<Magazine[]> magazines_;
+    std::atomic<size_t> free_blocks_;
+    // bit i set iff block i is handed out. A block held in a magazine is used
+    // in bitmap_ but not in use here, so a single block free is checked
+    // without the pool mutex
+    std::unique_ptr<std::atomic<uint64_t>[]> in_use_;
 
     struct ibv_mr* mr_;
     struct ibv_pd* pd_;
 };
 
+// values laid out back to back in one pool by MM::allocate_batch, or one
+// segment of a value from MM::allocate_scattered
+typedef struct {
+    void* ptr;      // address of the first value
+    size_t count;   // number of values
+    size_t stride;  // distance between two values
+    int pool_idx;
+} extent_t;
+
+/*
+MM is safe to use from many threads. The pool list is guarded by a SlotLock:
+allocations and frees take it shared, and only fall back to the exclusive
+lock to rebalance, add or shrink the pools. Slabs are never built under it:
+the initial ones are built by the loader threads and the ones added on demand
+by a grower thread, and the pool list only takes them in collect_loaded().
+*/
 class MM {
    private:
+    struct SizeClass {
+        size_t block_size;
+        std::vector<int> pools;  // index into mempools_
+    };
+
+    // a released pool leaves a nullptr behind, so pool indexes stay valid.
+    // Room for max_slabs_ pools is reserved up front and the vector never
+    // reallocates, so get_block_address() and get_block_index() read it
+    // without lock_: the pool of a block in use is neither released nor moved
     std::vector<MemoryPool*> mempools_;
+    // base address -> index into mempools_
+    std::map<uintptr_t, int> pools_by_addr_;
+    // sorted by block size
+    std::vector<SizeClass> classes_;
+
+    struct ibv_pd* pd_;
+    pool_options_t options_;
+    size_t n_slabs_ = 0;
+    size_t min_slabs_;  // slabs created at start are never released
+    size_t max_slabs_;
+    // pools that were empty at the last shrink()
+    std::set<int> idle_pools_;
+
+    // initial slabs are built by loader threads, see load_async()
+    struct PendingSlab {
+        int class_idx;
+        int numa_node;
+    };
+    std::vector<PendingSlab> pending_;  // every initial slab
+    std::atomic<size_t> next_pending_{0};
+    size_t collected_ = 0;
+    std::mutex loaded_mutex_;
+    std::vector<std::pair<int, MemoryPool*>> loaded_;  // built, not yet collected
+    std::vector<std::thread> loaders_;
+    std::function<void()> on_loaded_;
+    bool load_failed_ = false;  // an initial slab could not be built
+
+    // slabs added on demand, see request_grow(). Guarded by loaded_mutex_
+    std::vector<int> growing_;     // per class: requested, not yet collected
+    std::vector<int> grow_queue_;  // classes waiting for grower_
+    std::vector<std::pair<int, MemoryPool*>> grown_;  // built, not yet collected
+    std::condition_variable grow_cv_;
+    bool stopping_ = false;
+    std::thread grower_;
+
+    mutable SlotLock lock_;
+
+    // the functions below expect lock_ to be held
+
+    // index of the smallest class whose block fits size, or the largest class
+    int best_class(size_t size) const;
+    // count values of size bytes back to back in one pool of the class
+    void* allocate_from_class(int class_idx, size_t size, size_t count, int* pool_idx);
+    void* allocate_contiguous(size_t size, size_t count, int* pool_idx);
+    int find_pool(const void* ptr) const;
+
+    // try the best class under the shared lock, then allocate_contiguous()
+    // under the exclusive one. Takes lock_ itself. stride: see extent_t
+    void* allocate_any(size_t size, size_t count, int* pool_idx, size_t* stride);
+    void free_extents(const std::vector<extent_t>& extents);
+    // move an empty slab from another class to class_idx
+    bool rebalance(int class_idx);
+    // bytes of the free blocks of class_idx
+    size_t free_bytes(int class_idx) const;
+    /*
+    @brief have grower_ build one more slab for class_idx, unless one is
+    already on its way or max_slabs_ would be passed. Returns at once, the
+    slab is used once collect_loaded() took it. Takes loaded_mutex_.
+    */
+    void request_grow(int class_idx);
+    void grow_loop();
+    int add_pool(int class_idx, MemoryPool* pool);
+    // nullptr if the slab could not be built, the error is logged
+    MemoryPool* create_pool(int class_idx, int numa_node) const;
+    int preferred_node() const { return options_.numa_nodes.empty() ? -1 : options_.numa_nodes[0]; }
 
    public:
-    MM(size_t pool_size, size_t block_size, struct ibv_pd* pd) {
-        mempools_.push_back(new MemoryPool(pool_size, block_size, pd));
-    }
+    /*
+    @brief each size class gets its share of pool_size, rounded to whole
+    slabs. block sizes must divide SLAB_SIZE. Slabs are added on demand up to
+    max_pool_size, built in the background when a class runs low or out, and
+    released by shrink() once they are empty again. An allocation never waits
+    for a slab: it fails if none is ready.
+    The initial slabs are only built by load_async().
+    */
+    MM(size_t pool_size, size_t max_pool_size,
+       const std::vector<size_class_config_t>& size_classes, const pool_options_t& options,
+       struct ibv_pd* pd);
     MM(const MM& mm) = delete;
+    /*
+    @brief allocate, pre-fault and register the initial slabs on n_threads
+    background threads. on_loaded is called from a loader thread after each
+    slab, and from the grower thread after each slab added on demand; the
+    slab is only used after collect_loaded() picked it up. It is called for a
+    slab that could not be built too: see load_failed(). A slab added on
+    demand that failed is requested again the next time its class runs low.
+    */
+    void load_async(int n_threads, std::function<void()> on_loaded);
+    // an initial slab could not be built, the pool will never reach its size
+    bool load_failed() {
+        std::lock_guard<std::mutex> lock(loaded_mutex_);
+        return load_failed_;
+    }
+    // add the slabs built so far, initial or on demand, return how many were added
+    size_t collect_loaded();
+    size_t get_loading_size() const {
+        SlotLock::Shared guard(lock_);
+        return (pending_.size() - collected_) * SLAB_SIZE;
+    }
     void* allocate(size_t size, int* pool_idx);
+    /*
+    @brief allocate count values of size bytes, all or nothing. One contiguous
+    extent is preferred, otherwise as few extents as possible. Extents follow
+    the value order. On failure nothing stays allocated and false is returned.
+    */
+    bool allocate_batch(size_t size, size_t count, std::vector<extent_t>* extents);
+    /*
+    @brief allocate one value of size bytes, split in as few segments as
+    possible when no contiguous run is large enough. Each segment is an extent
+    with count 1 and stride set to its length. All or nothing, like
+    allocate_batch.
+    */
+    bool allocate_scattered(size_t size, std::vector<extent_t>* segments);
     void deallocate(void* ptr, size_t size, int pool_idx);
+    // same as above, the pool is looked up by address
+    void deallocate(void* ptr, size_t size);
+    // index of the pool holding ptr, or -1
+    int pool_of(const void* ptr) const;
+    // lowest fit inside one pool, used to relocate values
+    void* allocate_in_pool(int pool_idx, size_t size) {
+        SlotLock::Shared guard(lock_);
+        return mempools_[pool_idx]->allocate_lowest(size);
+    }
+    // the pool with the highest fragmentation above threshold, or -1.
+    // Magazines are flushed first.
+    int most_fragmented_pool(double threshold, double* fragmentation);
+    /*
+    @brief release slabs above the initial size that stayed empty since the
+    previous call. Return the number of released slabs.
+    */
+    size_t shrink();
+    size_t get_total_size() const {
+        SlotLock::Shared guard(lock_);
+        return n_slabs_ * SLAB_SIZE;
+    }
+    size_t get_used_size() const;
     uint32_t get_rkey(int pool_idx) const {
-        assert(pool_idx >= 0 && pool_idx < mempools_.size());
+        SlotLock::Shared guard(lock_);
+        assert(pool_idx >= 0 && pool_idx < (int)mempools_.size());
         return mempools_[pool_idx]->get_rkey();
     }
-
-    ~MM() {
-        for (auto& pool : mempools_) {
-            delete pool;
-        }
+    // address of block number block in pool pool_idx, and the other way round.
+    // Lock free, pool_idx must hold a block in use
+    void* get_block_address(int pool_idx, size_t block) const {
+        const MemoryPool* pool = mempools_[pool_idx];
+        return (char*)pool->get_base() + block * pool->get_block_size();
+    }
+    size_t get_block_index(int pool_idx, const void* ptr) const {
+        const MemoryPool* pool = mempools_[pool_idx];
+        return ((const char*)ptr - (const char*)pool->get_base()) / pool->get_block_size();
     }
+
+    ~MM();
 };
 
 #endif  // MEMORY_POOL_H
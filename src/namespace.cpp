@@ -0,0 +1,71 @@
+#include "namespace.h"
+
+NamespaceTable::NamespaceTable() { open(""); }
+
+int NamespaceTable::open(const std::string &name) {
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+        return it->second;
+    }
+    int id = -1;
+    uint32_t generation = 0;
+    // a dropped id whose values are all freed
+    for (size_t i = 0; i < spaces_.size(); ++i) {
+        if (!spaces_[i].live && spaces_[i].used == 0) {
+            id = i;
+            generation = spaces_[i].generation + 1;
+            break;
+        }
+    }
+    if (id < 0) {
+        if (spaces_.size() == MAX_NAMESPACES) {
+            return -1;
+        }
+        id = spaces_.size();
+        spaces_.push_back(Namespace());
+    }
+    spaces_[id] = {.name = name, .quota = 0, .used = 0, .live = true, .generation = generation};
+    ids_[name] = id;
+    return id;
+}
+
+int NamespaceTable::find(const std::string &name) const {
+    auto it = ids_.find(name);
+    return it == ids_.end() ? -1 : it->second;
+}
+
+bool NamespaceTable::drop(int id) {
+    if (id == DEFAULT_NAMESPACE || !spaces_[id].live) {
+        return false;
+    }
+    ids_.erase(spaces_[id].name);
+    spaces_[id].name.clear();
+    spaces_[id].quota = 0;
+    spaces_[id].live = false;
+    return true;
+}
+
+bool NamespaceTable::over_quota(int id, size_t bytes) const {
+    const Namespace &space = spaces_[id];
+    return space.quota > 0 && space.used + bytes > space.quota;
+}
+
+size_t NamespaceTable::excess(int id) const {
+    const Namespace &space = spaces_[id];
+    if (space.quota == 0) {
+        return space.used;
+    }
+    return space.used > space.quota ? space.used - space.quota : 0;
+}
+
+int NamespaceTable::victim(int id) const {
+    int victim = id;
+    size_t most = 0;
+    for (size_t i = 0; i < spaces_.size(); ++i) {
+        if (spaces_[i].live && excess(i) > most) {
+            victim = i;
+            most = excess(i);
+        }
+    }
+    return victim;
+}
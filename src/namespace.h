@@ -0,0 +1,84 @@
+#ifndef NAMESPACE_H
+#define NAMESPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ids fit the namespace byte of an index entry
+#define MAX_NAMESPACES 256
+// id of the namespace named "", which clients use unless they pick another
+#define DEFAULT_NAMESPACE 0
+
+/*
+NamespaceTable names the namespaces sharing the pool and accounts the bytes of
+the values stored in each. A quota bounds a namespace's bytes and also
+protects them: when the pool is full, victim() picks a namespace over its
+quota before one under it. A dropped namespace loses its name at once, its id
+is only reused once all its bytes have been uncharged, with the next
+generation, so a holder of the old id can tell it is gone. Not thread safe.
+*/
+class NamespaceTable {
+   public:
+    // the default namespace exists from the start, without a quota
+    NamespaceTable();
+
+    // id of namespace name, created without a quota if needed. -1 if every id is in use
+    int open(const std::string &name);
+    // id of namespace name, -1 if there is none
+    int find(const std::string &name) const;
+    // the default namespace cannot be dropped, return false for it
+    bool drop(int id);
+
+    // bytes: 0 for no quota
+    void set_quota(int id, size_t bytes) { spaces_[id].quota = bytes; }
+    void charge(int id, size_t bytes) { spaces_[id].used += bytes; }
+    void uncharge(int id, size_t bytes) { spaces_[id].used -= bytes; }
+    // would bytes more take namespace id past its quota
+    bool over_quota(int id, size_t bytes) const;
+    /*
+    @brief namespace to evict from when id needs room in a full pool: the one
+    furthest above its quota, all the bytes of a namespace without a quota
+    count as above it. id itself if every namespace is within its quota.
+    */
+    int victim(int id) const;
+
+    bool live(int id) const { return spaces_[id].live; }
+    // times id was given to a new namespace before the current one
+    uint32_t generation(int id) const { return spaces_[id].generation; }
+    const std::string &name(int id) const { return spaces_[id].name; }
+    size_t quota(int id) const { return spaces_[id].quota; }
+    size_t used(int id) const { return spaces_[id].used; }
+    // live namespaces
+    size_t size() const { return ids_.size(); }
+
+    // call fn(id) for every live namespace
+    template <typename F>
+    void for_each(F fn) const {
+        for (size_t id = 0; id < spaces_.size(); ++id) {
+            if (spaces_[id].live) {
+                fn((int)id);
+            }
+        }
+    }
+
+   private:
+    struct Namespace {
+        std::string name;
+        size_t quota;
+        size_t used;
+        bool live;
+        uint32_t generation;
+    };
+
+    // bytes of namespace id above its quota
+    size_t excess(int id) const;
+
+    std::vector<Namespace> spaces_;
+    std::unordered_map<std::string, int> ids_;
+};
+
+#endif  // NAMESPACE_H
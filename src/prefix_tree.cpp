@@ -0,0 +1,156 @@
+#include "prefix_tree.h"
+
+#define ROOT 0
+#define NIL ((uint32_t)-1)
+
+PrefixTree::PrefixTree() {
+    nodes_.push_back({.key = "",
+                      .parent = NIL,
+                      .first_child = NIL,
+                      .prev_sibling = NIL,
+                      .next_sibling = NIL,
+                      .resident = false});
+}
+
+uint32_t PrefixTree::find(KeyView key) const {
+    const uint32_t *id = ids_.find(key);
+    return id ? *id : NIL;
+}
+
+uint32_t PrefixTree::new_node(KeyView key, uint32_t parent, bool resident) {
+    uint32_t n;
+    if (!free_nodes_.empty()) {
+        n = free_nodes_.back();
+        free_nodes_.pop_back();
+    }
+    else {
+        n = nodes_.size();
+        nodes_.push_back(Node());
+    }
+    Node &node = nodes_[n];
+    node.key.assign(key.data, key.size);
+    key_bytes_ += key.size;
+    node.first_child = NIL;
+    node.resident = resident;
+    link(n, parent);
+    ids_.insert_or_assign(key, n);
+    return n;
+}
+
+void PrefixTree::free_node(uint32_t n) {
+    ids_.erase(nodes_[n].key);
+    key_bytes_ -= nodes_[n].key.size();
+    nodes_[n].key.clear();
+    nodes_[n].key.shrink_to_fit();
+    free_nodes_.push_back(n);
+}
+
+void PrefixTree::link(uint32_t n, uint32_t parent) {
+    Node &node = nodes_[n];
+    node.parent = parent;
+    node.prev_sibling = NIL;
+    node.next_sibling = nodes_[parent].first_child;
+    if (node.next_sibling != NIL) {
+        nodes_[node.next_sibling].prev_sibling = n;
+    }
+    nodes_[parent].first_child = n;
+}
+
+void PrefixTree::unlink(uint32_t n) {
+    Node &node = nodes_[n];
+    if (node.prev_sibling != NIL) {
+        nodes_[node.prev_sibling].next_sibling = node.next_sibling;
+    }
+    else {
+        nodes_[node.parent].first_child = node.next_sibling;
+    }
+    if (node.next_sibling != NIL) {
+        nodes_[node.next_sibling].prev_sibling = node.prev_sibling;
+    }
+    node.parent = NIL;
+}
+
+void PrefixTree::prune(uint32_t n) {
+    while (n != ROOT && !nodes_[n].resident && nodes_[n].first_child == NIL) {
+        uint32_t parent = nodes_[n].parent;
+        unlink(n);
+        free_node(n);
+        n = parent;
+    }
+}
+
+bool PrefixTree::is_ancestor(uint32_t a, uint32_t n) const {
+    for (; n != NIL; n = nodes_[n].parent) {
+        if (n == a) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PrefixTree::insert(KeyView key, KeyView parent) {
+    uint32_t p = ROOT;
+    if (parent.size > 0) {
+        p = find(parent);
+        if (p == NIL) {
+            // a parent that is not in the tree is kept as a placeholder
+            p = new_node(parent, ROOT, false);
+        }
+    }
+    uint32_t n = find(key);
+    if (n == NIL) {
+        new_node(key, p, true);
+        return;
+    }
+    nodes_[n].resident = true;
+    // moving a node under its own subtree would cut it off the root
+    if (nodes_[n].parent != p && !is_ancestor(n, p)) {
+        uint32_t old_parent = nodes_[n].parent;
+        unlink(n);
+        link(n, p);
+        prune(old_parent);
+    }
+}
+
+void PrefixTree::remove(KeyView key) {
+    uint32_t n = find(key);
+    if (n != NIL) {
+        nodes_[n].resident = false;
+        prune(n);
+    }
+}
+
+size_t PrefixTree::match(const std::vector<KeyView> &keys) const {
+    uint32_t prev = NIL;
+    size_t i = 0;
+    for (; i < keys.size(); ++i) {
+        uint32_t n = find(keys[i]);
+        if (n == NIL || !nodes_[n].resident || (i > 0 && nodes_[n].parent != prev)) {
+            break;
+        }
+        prev = n;
+    }
+    return i;
+}
+
+void PrefixTree::drop_subtree(KeyView key, std::vector<std::string> *keys) {
+    uint32_t top = find(key);
+    if (top == NIL) {
+        return;
+    }
+    uint32_t parent = nodes_[top].parent;
+    unlink(top);
+    std::vector<uint32_t> stack = {top};
+    while (!stack.empty()) {
+        uint32_t n = stack.back();
+        stack.pop_back();
+        for (uint32_t c = nodes_[n].first_child; c != NIL; c = nodes_[c].next_sibling) {
+            stack.push_back(c);
+        }
+        if (nodes_[n].resident) {
+            keys->push_back(nodes_[n].key);
+        }
+        free_node(n);
+    }
+    prune(parent);
+}
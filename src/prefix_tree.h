@@ -0,0 +1,75 @@
+#ifndef PREFIX_TREE_H
+#define PREFIX_TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "kvindex.h"
+
+/*
+PrefixTree links block keys to the block before them in a sequence, so the
+blocks of many sequences form a tree with shared prefixes. A node is resident
+while its value is stored; a node whose value was evicted stays as long as it
+has children, so the blocks after it come back into reach if it is written
+again. Every key has at most one node, nodes are found through a FlatIndex.
+Not thread safe.
+*/
+class PrefixTree {
+   public:
+    PrefixTree();
+
+    /*
+    @brief key is resident and follows parent, or starts a sequence if parent
+    is empty. A key already in the tree is moved under parent.
+    */
+    void insert(KeyView key, KeyView parent);
+    // key is not resident any more
+    void remove(KeyView key);
+    /*
+    @brief number of leading keys that are resident and each the child of
+    the one before, keys[0] may have any parent.
+    */
+    size_t match(const std::vector<KeyView> &keys) const;
+    /*
+    @brief remove key and every node below it, the resident keys are
+    appended to keys.
+    */
+    void drop_subtree(KeyView key, std::vector<std::string> *keys);
+
+    // nodes, including the ones that are not resident
+    size_t size() const { return ids_.size(); }
+    // bytes of the nodes, their keys and the index finding them
+    size_t memory_usage() const {
+        return nodes_.capacity() * sizeof(Node) + key_bytes_ +
+               free_nodes_.capacity() * sizeof(uint32_t) + ids_.memory_usage();
+    }
+
+   private:
+    struct Node {
+        std::string key;
+        uint32_t parent;
+        uint32_t first_child;
+        uint32_t prev_sibling;
+        uint32_t next_sibling;
+        bool resident;
+    };
+
+    uint32_t find(KeyView key) const;
+    uint32_t new_node(KeyView key, uint32_t parent, bool resident);
+    void free_node(uint32_t n);
+    void link(uint32_t n, uint32_t parent);
+    void unlink(uint32_t n);
+    // free n and its ancestors while they are neither resident nor have children
+    void prune(uint32_t n);
+    bool is_ancestor(uint32_t a, uint32_t n) const;
+
+    std::vector<Node> nodes_;  // nodes_[ROOT] is the root, it has no key
+    std::vector<uint32_t> free_nodes_;
+    FlatIndex<uint32_t> ids_;
+    size_t key_bytes_ = 0;  // of the keys of the nodes
+};
+
+#endif  // PREFIX_TREE_H
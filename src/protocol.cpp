@@ -1,5 +1,7 @@
 #include "protocol.h"
 
+#include <string.h>
+
 #include <msgpack.hpp>
 
 std::unordered_map<char, std::string> op_map = {{OP_R, "READ"},
@@ -9,7 +11,13 @@ std::unordered_map<char, std::string> op_map = {{OP_R, "READ"},
                                                 {OP_RDMA_WRITE, "RDMA_WRITE"},
                                                 {OP_RDMA_READ, "RDMA_READ"},
                                                 {OP_CHECK_EXIST, "CHECK_EXIST"},
-                                                {OP_GET_MATCH_LAST_IDX, "GET_MATCH_LAST_IDX"}};
+                                                {OP_GET_MATCH_LAST_IDX, "GET_MATCH_LAST_IDX"},
+                                                {OP_DROP_SUBTREE, "DROP_SUBTREE"},
+                                                {OP_DELETE, "DELETE"},
+                                                {OP_CHECK_EXIST_BATCH, "CHECK_EXIST_BATCH"},
+                                                {OP_RELEASE_LEASES, "RELEASE_LEASES"},
+                                                {OP_CLONE, "CLONE"},
+                                                {OP_USE_NAMESPACE, "USE_NAMESPACE"}};
 
 std::string op_name(char op_code) {
     auto it = op_map.find(op_code);
@@ -18,3 +26,19 @@ std::string op_name(char op_code) {
     }
     return "UNKNOWN";  // 如果未找到匹配项
 }
+
+bool pack_digests(const std::vector<std::string>& keys, std::vector<char>& digests) {
+    if (keys.empty()) {
+        return false;
+    }
+    for (const auto& key : keys) {
+        if (key.size() != DIGEST_SIZE) {
+            return false;
+        }
+    }
+    digests.resize(keys.size() * DIGEST_SIZE);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        memcpy(&digests[i * DIGEST_SIZE], keys[i].data(), DIGEST_SIZE);
+    }
+    return true;
+}
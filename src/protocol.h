@@ -62,6 +62,12 @@ OR
 #define OP_RDMA_READ 'A'
 #define OP_CHECK_EXIST 'C'
 #define OP_GET_MATCH_LAST_IDX 'M'
+#define OP_DROP_SUBTREE 'T'
+#define OP_DELETE 'X'
+#define OP_CHECK_EXIST_BATCH 'B'
+#define OP_RELEASE_LEASES 'L'
+#define OP_CLONE 'K'
+#define OP_USE_NAMESPACE 'N'
 #define OP_SIZE 1
 // please add op name in protocol.cpp
 
@@ -74,10 +80,19 @@ std::string op_name(char op);
 #define INTERNAL_ERROR 500
 #define KEY_NOT_FOUND 404
 #define RETRY 408
+// a write was not admitted: its keys are read less often than what it would evict
+#define NOT_ADMITTED 409
+// the namespace the client picked was dropped, pick one again
+#define NAMESPACE_GONE 410
 #define SYSTEM_ERROR 503
 
 #define RETURN_CODE_SIZE sizeof(int)
 
+// Keys are byte strings. When every key of a request is DIGEST_SIZE bytes,
+// e.g. a 128 bit hash of a token block, the client packs them back to back
+// into one msgpack bin, `digests`, and leaves the string keys empty.
+#define DIGEST_SIZE 16
+
 typedef struct __attribute__((packed)) {
     unsigned int magic;
     char op;
@@ -92,7 +107,8 @@ typedef struct {
 
 typedef struct {
     std::vector<std::string> keys;
-    MSGPACK_DEFINE(keys)
+    std::vector<char> digests;
+    MSGPACK_DEFINE(keys, digests)
 } keys_t;
 
 // implement pack for ipcHandler
@@ -129,27 +145,82 @@ typedef struct {
     cudaIpcMemHandle_t ipc_handle;
     int block_size;
     std::vector<block_t> blocks;
-    MSGPACK_DEFINE(ipc_handle, block_size, blocks)
+    // keys of the blocks, whose key fields are then empty
+    std::vector<char> digests;
+    // write: the values are never evicted
+    bool pinned;
+    // write: link the keys in the prefix index, keys[0] follows parent
+    // (starts a sequence if parent is empty), every next key the one before
+    bool chain;
+    std::string parent;
+    // write: the values expire ttl_ms after the write, 0: never
+    unsigned int ttl_ms;
+    // write: keys already stored keep their value and are not copied. The
+    // TASK_ACCEPTED code is followed by the present bitmap of
+    // remote_meta_response then
+    bool if_absent;
+    MSGPACK_DEFINE(ipc_handle, block_size, blocks, digests, pinned, chain, parent, ttl_ms,
+                   if_absent)
 
 } local_meta_t;
 
 typedef struct {
     std::vector<std::string> keys;
     int block_size;
-    MSGPACK_DEFINE(keys, block_size)
+    // length of each value, empty: every value is block_size bytes
+    std::vector<size_t> sizes;
+    std::vector<char> digests;
+    // write: the values are never evicted
+    bool pinned;
+    // write: see local_meta_t
+    bool chain;
+    std::string parent;
+    unsigned int ttl_ms;
+    // write: keys already stored keep their value and get none allocated
+    bool if_absent;
+    MSGPACK_DEFINE(keys, block_size, sizes, digests, pinned, chain, parent, ttl_ms, if_absent)
 } remote_meta_request;  // rdma read/write request
 
 typedef struct {
     uint32_t rkey;
     uintptr_t remote_addr;
-    MSGPACK_DEFINE(rkey, remote_addr)
-} remote_block_t;
+    size_t size;
+    MSGPACK_DEFINE(rkey, remote_addr, size)
+} remote_block_t;  // one contiguous extent of a value
 
 typedef struct {
-    std::vector<remote_block_t> blocks;
-    MSGPACK_DEFINE(blocks)
+    // extents of each key in request order, a value that did not fit one
+    // contiguous run on the server has several
+    std::vector<std::vector<remote_block_t>> blocks;
+    // the server keeps the extents in place until the lease is released
+    // (OP_RELEASE_LEASES) or times out
+    uint64_t lease;
+    // if_absent writes: bit i % 8 of present[i / 8] is set if key i was already
+    // stored, blocks[i] is empty then and nothing is to be written. A key is
+    // stored once its write was answered, its data may still be in flight
+    std::vector<uint8_t> present;
+    MSGPACK_DEFINE(blocks, lease, present)
 } remote_meta_response;  // rdma read/write response
 
+typedef struct {
+    std::vector<uint64_t> leases;
+    MSGPACK_DEFINE(leases)
+} leases_t;  // leases a client is done with
+
+typedef struct {
+    // the new keys, like keys_t
+    std::vector<std::string> keys;
+    std::vector<char> digests;
+    // stored keys, keys[i] gets the value of sources[i]
+    keys_t sources;
+    // like a write: see local_meta_t
+    bool pinned;
+    bool chain;
+    std::string parent;
+    unsigned int ttl_ms;
+    MSGPACK_DEFINE(keys, digests, sources, pinned, chain, parent, ttl_ms)
+} clone_request;  // new keys for stored values, sharing their blocks
+
 // only RoCEv2 is supported for now.
 typedef struct __attribute__((packed)) rdma_conn_info_t {
     uint32_t qpn;
@@ -157,6 +228,9 @@ typedef struct __attribute__((packed)) rdma_conn_info_t {
     union ibv_gid gid;
 } rdma_conn_info_t;
 
+// fill digests and return true if every key is DIGEST_SIZE bytes
+bool pack_digests(const std::vector<std::string>& keys, std::vector<char>& digests);
+
 template <typename T>
 bool serialize(const T& data, std::string& out) {
     try {
@@ -187,6 +261,10 @@ template bool deserialize<local_meta_t>(const char* data, size_t size, local_met
 template bool serialize<remote_meta_request>(const remote_meta_request& data, std::string& out);
 template bool deserialize<remote_meta_response>(const char* data, size_t size,
                                                 remote_meta_response& out);
+template bool serialize<leases_t>(const leases_t& data, std::string& out);
+template bool deserialize<leases_t>(const char* data, size_t size, leases_t& out);
+template bool serialize<clone_request>(const clone_request& data, std::string& out);
+template bool deserialize<clone_request>(const char* data, size_t size, clone_request& out);
 
 #define FIXED_HEADER_SIZE sizeof(header_t)
 
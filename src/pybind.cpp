@@ -2,6 +2,7 @@
 #include <pybind11/stl.h>
 
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -12,25 +13,93 @@
 
 namespace py = pybind11;
 extern int register_server(unsigned long loop_ptr, server_config_t config);
+extern std::map<std::string, std::map<std::string, size_t>> get_namespace_stats();
+extern int set_namespace_quota(const std::string &name, size_t quota);
+extern int drop_namespace(const std::string &name);
 
-int rw_local_wrapper(connection_t *conn, char op,
-                     const std::vector<std::tuple<std::string, unsigned long>> &blocks,
-                     int block_size, uintptr_t ptr) {
+// the result of a read or write: the return code, and for if_absent writes one
+// flag per block, true if the server already stored the key
+typedef std::tuple<int, std::vector<bool>> rw_result_t;
+
+// pinned, chain, parent, ttl_ms, if_absent: see write_options_t
+rw_result_t rw_local_wrapper(connection_t *conn, char op,
+                             const std::vector<std::tuple<std::string, unsigned long>> &blocks,
+                             int block_size, uintptr_t ptr, bool pinned, bool chain,
+                             const std::string &parent, unsigned int ttl_ms, bool if_absent) {
+    write_options_t options = {.pinned = pinned,
+                               .chain = chain,
+                               .parent = parent,
+                               .ttl_ms = ttl_ms,
+                               .if_absent = if_absent};
+    std::vector<block_t> c_blocks;
+    for (const auto &block : blocks) {
+        c_blocks.push_back(block_t{std::get<0>(block), std::get<1>(block)});
+    }
+    std::vector<bool> present;
+    int ret = rw_local(conn, op, c_blocks, block_size, (void *)ptr, options, &present);
+    return rw_result_t(ret, present);
+}
+
+// if_absent: see write_options_t
+rw_result_t rw_rdma_wrapper(connection_t *conn, char op,
+                            const std::vector<std::tuple<std::string, unsigned long>> &blocks,
+                            int block_size, uintptr_t ptr, size_t ptr_region_size, bool pinned,
+                            bool chain, const std::string &parent, unsigned int ttl_ms,
+                            bool if_absent) {
+    write_options_t options = {.pinned = pinned,
+                               .chain = chain,
+                               .parent = parent,
+                               .ttl_ms = ttl_ms,
+                               .if_absent = if_absent};
     std::vector<block_t> c_blocks;
     for (const auto &block : blocks) {
         c_blocks.push_back(block_t{std::get<0>(block), std::get<1>(block)});
     }
-    return rw_local(conn, op, c_blocks, block_size, (void *)ptr);
+    std::vector<bool> present;
+    int ret = rw_rdma(conn, op, c_blocks, block_size, {}, (void *)ptr, ptr_region_size, options,
+                      &present);
+    return rw_result_t(ret, present);
 }
 
-int rw_rdma_wrapper(connection_t *conn, char op,
-                    const std::vector<std::tuple<std::string, unsigned long>> &blocks,
-                    int block_size, uintptr_t ptr, size_t ptr_region_size) {
+// blocks: (key, offset, size), every value has its own length
+rw_result_t rw_rdma_varlen_wrapper(
+    connection_t *conn, char op,
+    const std::vector<std::tuple<std::string, unsigned long, size_t>> &blocks, uintptr_t ptr,
+    size_t ptr_region_size, bool pinned, bool chain, const std::string &parent,
+    unsigned int ttl_ms, bool if_absent) {
+    write_options_t options = {.pinned = pinned,
+                               .chain = chain,
+                               .parent = parent,
+                               .ttl_ms = ttl_ms,
+                               .if_absent = if_absent};
     std::vector<block_t> c_blocks;
+    std::vector<size_t> sizes;
     for (const auto &block : blocks) {
         c_blocks.push_back(block_t{std::get<0>(block), std::get<1>(block)});
+        sizes.push_back(std::get<2>(block));
     }
-    return rw_rdma(conn, op, c_blocks, block_size, (void *)ptr, ptr_region_size);
+    std::vector<bool> present;
+    int ret = rw_rdma(conn, op, c_blocks, 0, sizes, (void *)ptr, ptr_region_size, options,
+                      &present);
+    return rw_result_t(ret, present);
+}
+
+// pinned, chain, parent, ttl_ms: see write_options_t
+int clone_keys_wrapper(connection_t *conn, const std::vector<std::string> &sources,
+                       const std::vector<std::string> &keys, bool pinned, bool chain,
+                       const std::string &parent, unsigned int ttl_ms) {
+    write_options_t options = {
+        .pinned = pinned, .chain = chain, .parent = parent, .ttl_ms = ttl_ms};
+    return clone_keys(conn, sources, keys, options);
+}
+
+// the bitmap of check_exist_batch as bytes
+py::bytes check_exist_batch_wrapper(connection_t *conn, const std::vector<std::string> &keys) {
+    std::vector<uint8_t> bitmap;
+    if (check_exist_batch(conn, keys, &bitmap) < 0) {
+        throw std::runtime_error("Failed to check keys");
+    }
+    return py::bytes(reinterpret_cast<const char *>(bitmap.data()), bitmap.size());
 }
 
 PYBIND11_MODULE(_infinistore, m) {
@@ -40,31 +109,59 @@ PYBIND11_MODULE(_infinistore, m) {
         .def_readwrite("service_port", &client_config_t::service_port)
         .def_readwrite("log_level", &client_config_t::log_level)
         .def_readwrite("dev_name", &client_config_t::dev_name)
-        .def_readwrite("host_addr", &client_config_t::host_addr);
+        .def_readwrite("host_addr", &client_config_t::host_addr)
+        .def_readwrite("namespace", &client_config_t::ns);
 
     py::class_<connection_t>(m, "Connection")
         .def(py::init<>())
         .def_readwrite("bar1_mem_in_mib", &Connection::bar1_mem_in_mib)
         .def_readwrite("limited_bar1", &Connection::limited_bar1);
 
+    m.attr("WRITE_NOT_ADMITTED") = WRITE_NOT_ADMITTED;
     m.def("init_connection", &init_connection, "Initialize a connection");
+    m.def("use_namespace", &use_namespace, "switch the connection to another namespace");
     m.def("rw_local", &rw_local_wrapper, "Read/Write cpu memory from GPU device");
     m.def("rw_rdma", &rw_rdma_wrapper, "Read/Write remote memory");
+    m.def("rw_rdma_varlen", &rw_rdma_varlen_wrapper,
+          "Read/Write remote memory, each value with its own length");
     m.def("sync_local", &sync_local, "sync the cuda stream");
     m.def("setup_rdma", &setup_rdma, "setup rdma connection");
     m.def("sync_rdma", &sync_rdma, "sync the remote server");
     m.def("check_exist", &check_exist, "check if the key exists in the store");
+    m.def("check_exist_batch", &check_exist_batch_wrapper,
+          "check many keys in one round trip, return a bitmap of the stored ones");
     m.def("get_match_last_index", &get_match_last_index,
           "get the last index of a key list which is in the store");
+    m.def("drop_subtree", &drop_subtree, "drop a key and every block chained after it");
+    m.def("delete_keys", &delete_keys, "delete keys from the store");
+    m.def("clone_keys", &clone_keys_wrapper, "new keys for stored values, sharing their blocks");
 
     // server side
+    py::class_<size_class_config_t>(m, "SizeClassConfig")
+        .def(py::init<>())
+        .def_readwrite("block_size", &SizeClassConfig::block_size)
+        .def_readwrite("share", &SizeClassConfig::share);
+
     py::class_<server_config_t>(m, "ServerConfig")
         .def(py::init<>())
         .def_readwrite("service_port", &ServerConfig::service_port)
         .def_readwrite("log_level", &ServerConfig::log_level)
         .def_readwrite("dev_name", &ServerConfig::dev_name)
-        .def_readwrite("prealloc_size", &ServerConfig::prealloc_size);
+        .def_readwrite("prealloc_size", &ServerConfig::prealloc_size)
+        .def_readwrite("max_size", &ServerConfig::max_size)
+        .def_readwrite("hugepage_size", &ServerConfig::hugepage_size)
+        .def_readwrite("size_classes", &ServerConfig::size_classes)
+        .def_readwrite("numa_nodes", &ServerConfig::numa_nodes)
+        .def_readwrite("memory_backend", &ServerConfig::memory_backend)
+        .def_readwrite("eviction_policy", &ServerConfig::eviction_policy)
+        .def_readwrite("prefix_index", &ServerConfig::prefix_index)
+        .def_readwrite("admission", &ServerConfig::admission)
+        .def_readwrite("dedup", &ServerConfig::dedup);
     m.def("get_kvmap_len", &get_kvmap_len, "get kv map size");
+    m.def("get_mem_stats", &get_mem_stats, "get memory pool size, loading and used bytes");
+    m.def("get_namespace_stats", &get_namespace_stats, "get keys and used bytes per namespace");
+    m.def("set_namespace_quota", &set_namespace_quota, "set the quota of a namespace, in bytes");
+    m.def("drop_namespace", &drop_namespace, "drop a namespace and all its keys");
     m.def("register_server", &register_server, "register the server");
 
     // //both side
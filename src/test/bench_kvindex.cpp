@@ -0,0 +1,92 @@
+// Lookup throughput of FlatIndex: a find per key against find_batch.
+//
+// The index holds 16 byte digest keys, enough of them that the table is far
+// larger than the last level cache. Every round looks up a batch of random
+// keys, stored ones and missing ones mixed, as a multi-key read would.
+//
+// usage: bench_kvindex [keys in the index] [batch size] [rounds] [hit percent]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../kvindex.h"
+
+#define DIGEST_SIZE 16
+
+static std::string digest(uint64_t i) {
+    uint64_t words[2] = {hash_mix(i + 1), hash_mix(~i)};
+    return std::string((const char *)words, DIGEST_SIZE);
+}
+
+// nanoseconds per key
+template <typename F>
+static double bench(size_t keys, size_t rounds, F lookup) {
+    auto start = std::chrono::steady_clock::now();
+    lookup();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * 1e9 / (keys * rounds);
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atol(argv[1]) : 10000000;
+    size_t batch = argc > 2 ? atol(argv[2]) : 4096;
+    size_t rounds = argc > 3 ? atol(argv[3]) : 1000;
+    int hit_percent = argc > 4 ? atoi(argv[4]) : 90;
+
+    FlatIndex<uint64_t> index;
+    for (size_t i = 0; i < n; ++i) {
+        index.insert_or_assign(digest(i), i);
+    }
+    while (index.rehashing()) {
+        index.erase("missing");
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<std::vector<std::string>> batches(rounds);
+    for (auto &names : batches) {
+        for (size_t i = 0; i < batch; ++i) {
+            bool hit = (int)(rng() % 100) < hit_percent;
+            names.push_back(digest(hit ? rng() % n : n + rng() % n));
+        }
+    }
+    std::vector<std::vector<KeyView>> keys;
+    for (auto &names : batches) {
+        keys.emplace_back(names.begin(), names.end());
+    }
+
+    // the sums keep the lookups from being optimized away and must agree
+    uint64_t sum_loop = 0, sum_batch = 0;
+    double loop_ns = bench(batch, rounds, [&]() {
+        for (auto &k : keys) {
+            for (size_t i = 0; i < k.size(); ++i) {
+                uint64_t *value = index.find(k[i]);
+                sum_loop += value ? *value : 0;
+            }
+        }
+    });
+    std::vector<uint64_t *> found;
+    double batch_ns = bench(batch, rounds, [&]() {
+        for (auto &k : keys) {
+            index.find_batch(k, &found);
+            for (uint64_t *value : found) {
+                sum_batch += value ? *value : 0;
+            }
+        }
+    });
+    if (sum_loop != sum_batch) {
+        fprintf(stderr, "lookups disagree\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%zu keys, %.0f MB index, batches of %zu, %d%% hits\n", index.size(),
+           index.memory_usage() / 1e6, batch, hit_percent);
+    printf("%-12s %10s\n", "lookup", "ns/key");
+    printf("%-12s %10.1f\n", "find loop", loop_ns);
+    printf("%-12s %10.1f\n", "find_batch", batch_ns);
+    printf("speedup %.2fx\n", loop_ns / batch_ns);
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Allocation throughput of MM from 1 to 64 threads.
+//
+// Every thread keeps a window of live values and frees the oldest one before
+// each new allocation. The same loop is run once against MM directly and once
+// with every call behind one global mutex, which is how a single threaded
+// allocator would have to be shared.
+//
+// usage: bench_mempool [ops per thread] [value size in bytes] [block size in KB]
+// The pool is plain host memory and is not registered with RDMA, so no GPU or
+// RDMA device is needed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../log.h"
+#include "../mempool.h"
+
+#define WINDOW 64
+
+static std::mutex global_mutex;
+
+static void run(MM *mm, size_t ops, size_t size, bool global_lock) {
+    struct value_t {
+        void *ptr;
+        int pool_idx;
+    };
+    std::vector<value_t> window(WINDOW, value_t{nullptr, -1});
+    for (size_t i = 0; i < ops; ++i) {
+        value_t &slot = window[i % WINDOW];
+        std::unique_lock<std::mutex> lock(global_mutex, std::defer_lock);
+        if (global_lock) {
+            lock.lock();
+        }
+        if (slot.ptr) {
+            mm->deallocate(slot.ptr, size, slot.pool_idx);
+        }
+        slot.ptr = mm->allocate(size, &slot.pool_idx);
+        if (!slot.ptr) {
+            fprintf(stderr, "allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (auto &slot : window) {
+        if (slot.ptr) {
+            mm->deallocate(slot.ptr, size, slot.pool_idx);
+        }
+    }
+}
+
+// million allocations and frees per second
+static double bench(MM *mm, int n_threads, size_t ops, size_t size, bool global_lock) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_threads; ++i) {
+        threads.emplace_back(run, mm, ops, size, global_lock);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return 2.0 * ops * n_threads / elapsed.count() / 1e6;
+}
+
+int main(int argc, char **argv) {
+    size_t ops = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t size = argc > 2 ? atol(argv[2]) : 32 << 10;
+    size_t block_size = argc > 3 ? atol(argv[3]) : 32;
+    set_log_level("warning");
+
+    pool_options_t options = {.hugepage_size = 0, .numa_nodes = {}, .host_only = true};
+    std::vector<size_class_config_t> classes = {{.block_size = block_size, .share = 100}};
+    MM mm(SLAB_SIZE, SLAB_SIZE, classes, options, NULL);
+    mm.load_async(1, []() {});
+    while (mm.get_loading_size() > 0) {
+        mm.collect_loaded();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    printf("value size %zu bytes, block size %zu KB, %zu ops per thread, %u cores\n", size,
+           block_size, ops, std::thread::hardware_concurrency());
+    printf("%8s %16s %16s\n", "threads", "MM Mops/s", "global lock");
+    for (int n = 1; n <= 64; n *= 2) {
+        double concurrent = bench(&mm, n, ops, size, false);
+        double serialized = bench(&mm, n, ops, size, true);
+        printf("%8d %16.2f %16.2f\n", n, concurrent, serialized);
+    }
+    if (mm.get_used_size() != 0) {
+        fprintf(stderr, "leaked %zu bytes\n", mm.get_used_size());
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
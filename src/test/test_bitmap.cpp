@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "../bitmap.h"
+
+// first fit over a plain vector, used as reference
+static size_t naive_find_run(const std::vector<bool> &used, size_t n) {
+    size_t run = 0;
+    for (size_t i = 0; i < used.size(); ++i) {
+        run = used[i] ? 0 : run + 1;
+        if (run == n) {
+            return i + 1 - n;
+        }
+    }
+    return BlockBitmap::npos;
+}
+
+TEST(SummaryBitmapTest, FindNext) {
+    SummaryBitmap bm(300000);
+    EXPECT_EQ(bm.find_next(0), SummaryBitmap::npos);
+    bm.set(5);
+    bm.set(4096 * 3 + 7);
+    bm.set(299999);
+    EXPECT_EQ(bm.find_next(0), 5);
+    EXPECT_EQ(bm.find_next(6), 4096 * 3 + 7);
+    EXPECT_EQ(bm.find_next(4096 * 3 + 8), 299999);
+    bm.clear(299999);
+    EXPECT_EQ(bm.find_next(4096 * 3 + 8), SummaryBitmap::npos);
+    EXPECT_EQ(bm.find_next(300000), SummaryBitmap::npos);
+}
+
+TEST(BlockBitmapTest, AllocateAndFree) {
+    BlockBitmap bm(130);
+    EXPECT_EQ(bm.allocate(1), 0);
+    EXPECT_EQ(bm.allocate(63), 1);
+    EXPECT_EQ(bm.allocate(2), 64);
+    EXPECT_EQ(bm.free_blocks(), 64);
+    EXPECT_EQ(bm.allocate(65), BlockBitmap::npos);
+    EXPECT_EQ(bm.allocate(64), 66);
+    EXPECT_EQ(bm.allocate(1), BlockBitmap::npos);
+
+    EXPECT_TRUE(bm.deallocate(1, 63));
+    EXPECT_FALSE(bm.deallocate(1, 1));
+    EXPECT_EQ(bm.allocate(63), 1);
+}
+
+TEST(BlockBitmapTest, LongRunAcrossWords) {
+    BlockBitmap bm(64 * 10);
+    ASSERT_TRUE(bm.mark_used(0, 60));
+    ASSERT_TRUE(bm.mark_used(64 * 3, 1));
+    // the 132 free blocks before block 192 are too short
+    EXPECT_EQ(bm.allocate(200), 64 * 3 + 1);
+    EXPECT_EQ(bm.allocate(130), 60);
+}
+
+TEST(BlockBitmapTest, LargestFreeRun) {
+    BlockBitmap bm(64 * 4);
+    EXPECT_EQ(bm.largest_free_run(), 64 * 4);
+    ASSERT_TRUE(bm.mark_used(10, 1));
+    ASSERT_TRUE(bm.mark_used(64 * 2 + 5, 3));
+    EXPECT_EQ(bm.largest_free_run(), 64 * 2 + 5 - 11);
+    ASSERT_TRUE(bm.mark_used(11, 64 * 2 + 5 - 11));
+    EXPECT_EQ(bm.largest_free_run(), 64 * 4 - (64 * 2 + 8));
+}
+
+TEST(BlockBitmapTest, MatchesFirstFit) {
+    const size_t total = 64 * 70 + 13;
+    BlockBitmap bm(total);
+    std::vector<bool> used(total, false);
+    std::vector<std::pair<size_t, size_t>> live;
+    std::mt19937 rng(42);
+
+    for (int iter = 0; iter < 20000; ++iter) {
+        if (live.empty() || rng() % 3) {
+            size_t n = 1 + (rng() % 4 == 0 ? rng() % 300 : rng() % 70);
+            size_t expected = naive_find_run(used, n);
+            size_t start = bm.allocate(n);
+            ASSERT_EQ(start, expected) << "n=" << n;
+            if (start != BlockBitmap::npos) {
+                for (size_t i = start; i < start + n; ++i) {
+                    used[i] = true;
+                }
+                live.push_back({start, n});
+            }
+        }
+        else {
+            size_t k = rng() % live.size();
+            ASSERT_TRUE(bm.deallocate(live[k].first, live[k].second));
+            for (size_t i = live[k].first; i < live[k].first + live[k].second; ++i) {
+                used[i] = false;
+            }
+            live[k] = live.back();
+            live.pop_back();
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
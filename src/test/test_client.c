@@ -53,7 +53,7 @@ int main() {
         goto out;
     }
 
-    ret = rw_local(&conn, OP_W, blocks, size, d_ptr);
+    ret = rw_local(&conn, OP_W, blocks, size, d_ptr, {});
     if (ret < 0) {
         printf("Failed to write local memory %d\n", ret);
         goto out;
@@ -70,7 +70,7 @@ int main() {
     printf("out:print address of d_ptr:  %p\n", d_ptr);
     printf("out:print address of d_ptr2: %p\n", d_ptr2);
 
-    ret = rw_local(&conn, OP_R, blocks, size, d_ptr2);
+    ret = rw_local(&conn, OP_R, blocks, size, d_ptr2, {});
     printf("read local memory runtime: %f ms\n", elapsed.count());
     if (ret < 0) {
         goto out;
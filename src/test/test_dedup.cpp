@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "../dedup.h"
+
+TEST(DedupTableTest, FingerprintSeesEveryByte) {
+    std::vector<char> block(4096 + 13, 'x');
+    uint64_t h = DedupTable::fingerprint(block.data(), block.size());
+    EXPECT_EQ(h, DedupTable::fingerprint(block.data(), block.size()));
+    for (size_t i : {(size_t)0, (size_t)63, (size_t)1024, block.size() - 1}) {
+        block[i] ^= 1;
+        EXPECT_NE(DedupTable::fingerprint(block.data(), block.size()), h) << i;
+        block[i] ^= 1;
+    }
+    // zero padding of the last stripe does not hide the size
+    std::string a(10, '\0');
+    EXPECT_NE(DedupTable::fingerprint(a.data(), 10), DedupTable::fingerprint(a.data(), 11));
+}
+
+TEST(DedupTableTest, SameBytesShareABlock) {
+    DedupTable table;
+    std::string x(1000, 'x'), x2(1000, 'x'), y(1000, 'y');
+    EXPECT_EQ(table.add(1, x.data(), x.size()), 1);
+    EXPECT_EQ(table.add(2, x2.data(), x2.size()), 1);
+    EXPECT_EQ(table.add(3, y.data(), y.size()), 3);
+    EXPECT_EQ(table.references(1), 2);
+    EXPECT_EQ(table.size(), 2);
+    EXPECT_EQ(table.logical_bytes(), 3000);
+    EXPECT_EQ(table.physical_bytes(), 2000);
+    EXPECT_EQ(table.hashed_bytes(), 3000);
+    EXPECT_EQ(table.dedup_blocks(), 2);
+    EXPECT_EQ(table.dedup_logical_bytes(), 3000);
+    EXPECT_EQ(table.dedup_physical_bytes(), 2000);
+
+    EXPECT_FALSE(table.release(1, true));
+    EXPECT_TRUE(table.release(1, true));
+    EXPECT_EQ(table.references(1), 0);
+    // a block with the same bytes is known again from scratch
+    EXPECT_EQ(table.add(4, x2.data(), x2.size()), 4);
+    EXPECT_TRUE(table.release(4, true));
+    EXPECT_TRUE(table.release(3, true));
+    EXPECT_EQ(table.size(), 0);
+    EXPECT_EQ(table.logical_bytes(), 0);
+    EXPECT_EQ(table.physical_bytes(), 0);
+    EXPECT_EQ(table.dedup_blocks(), 0);
+    EXPECT_EQ(table.dedup_logical_bytes(), 0);
+    EXPECT_EQ(table.dedup_physical_bytes(), 0);
+}
+
+TEST(DedupTableTest, ScopesDoNotShare) {
+    DedupTable table;
+    std::string x(1000, 'x'), x2(1000, 'x'), x3(1000, 'x');
+    EXPECT_EQ(table.add(1, x.data(), x.size(), 1), 1);
+    EXPECT_EQ(table.add(2, x2.data(), x2.size(), 2), 2);
+    EXPECT_EQ(table.add(3, x3.data(), x3.size(), 2), 2);
+    EXPECT_EQ(table.references(1), 1);
+    EXPECT_EQ(table.references(2), 2);
+    EXPECT_EQ(table.physical_bytes(), 2000);
+}
+
+TEST(DedupTableTest, RetainedBlocksAreNotMatched) {
+    DedupTable table;
+    std::string x(256, 'x'), x2(256, 'x');
+    table.retain(1, x.data(), x.size());
+    table.retain(1, x.data(), x.size());
+    EXPECT_EQ(table.references(1), 2);
+    EXPECT_EQ(table.logical_bytes(), 512);
+    EXPECT_EQ(table.physical_bytes(), 256);
+    // block 1 has no fingerprint
+    EXPECT_EQ(table.add(2, x2.data(), x2.size()), 2);
+    // a block found by add() can be retained as well
+    table.retain(2, x2.data(), x2.size());
+    EXPECT_EQ(table.add(3, x.data(), x.size()), 2);
+    EXPECT_EQ(table.references(2), 3);
+    // clones are not counted as dedup
+    EXPECT_EQ(table.logical_bytes(), 1280);
+    EXPECT_EQ(table.physical_bytes(), 512);
+    EXPECT_EQ(table.dedup_blocks(), 1);
+    EXPECT_EQ(table.dedup_logical_bytes(), 512);
+    EXPECT_EQ(table.dedup_physical_bytes(), 256);
+
+    EXPECT_FALSE(table.release(1, false));
+    EXPECT_TRUE(table.release(1, false));
+    EXPECT_EQ(table.size(), 1);
+    // block 2 keeps a clone reference once both deduped values are gone
+    EXPECT_FALSE(table.release(2, true));
+    EXPECT_FALSE(table.release(2, true));
+    EXPECT_EQ(table.dedup_blocks(), 0);
+    EXPECT_EQ(table.dedup_physical_bytes(), 0);
+    EXPECT_TRUE(table.release(2, false));
+}
+
+TEST(DedupTableTest, SizeMustMatch) {
+    DedupTable table;
+    std::string x(128, 'x');
+    EXPECT_EQ(table.add(1, x.data(), 128), 1);
+    EXPECT_EQ(table.add(2, x.data(), 64), 2);
+    EXPECT_EQ(table.references(1), 1);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,176 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+
+#include "../eviction.h"
+#include "../kvindex.h"
+
+static std::vector<entry_id_t> drain(EvictionPolicy *policy) {
+    std::vector<entry_id_t> order;
+    entry_id_t id;
+    while (policy->evict(&id)) {
+        order.push_back(id);
+    }
+    return order;
+}
+
+TEST(EvictionPolicyTest, UnknownName) { EXPECT_EQ(make_eviction_policy("mru"), nullptr); }
+
+TEST(EvictionPolicyTest, LRU) {
+    auto policy = make_eviction_policy("lru");
+    for (entry_id_t id = 0; id < 4; ++id) {
+        policy->insert(id, id);
+    }
+    policy->access(0);
+    policy->remove(2);
+    EXPECT_EQ(policy->size(), 3);
+    EXPECT_EQ(drain(policy.get()), std::vector<entry_id_t>({1, 3, 0}));
+}
+
+TEST(EvictionPolicyTest, ClockGivesSecondChance) {
+    auto policy = make_eviction_policy("clock");
+    for (entry_id_t id = 0; id < 4; ++id) {
+        policy->insert(id, id);
+    }
+    policy->access(0);
+    policy->access(1);
+    entry_id_t id;
+    ASSERT_TRUE(policy->evict(&id));
+    EXPECT_EQ(id, 2);
+    policy->remove(3);
+    // 0 and 1 lost their bits on the first sweep
+    std::vector<entry_id_t> rest = drain(policy.get());
+    EXPECT_EQ(std::set<entry_id_t>(rest.begin(), rest.end()), std::set<entry_id_t>({0, 1}));
+}
+
+TEST(EvictionPolicyTest, S3FIFODropsOneHitWonders) {
+    auto policy = make_eviction_policy("s3fifo");
+    // a full cache of 100 entries, 10 of them read over and over
+    entry_id_t next = 0;
+    for (; next < 100; ++next) {
+        policy->insert(next, 1000 + next);
+    }
+    // a scan of entries read once, each one evicts another entry
+    entry_id_t id;
+    for (int round = 0; round < 1000; ++round) {
+        for (entry_id_t hot = 0; hot < 10; ++hot) {
+            policy->access(hot);
+        }
+        ASSERT_TRUE(policy->evict(&id));
+        if (round >= 100) {
+            EXPECT_GE(id, 10) << round;
+        }
+        policy->insert(id, 1000 + next++);
+    }
+    EXPECT_EQ(policy->size(), 100);
+}
+
+TEST(EvictionPolicyTest, S3FIFOGhostGoesToMain) {
+    auto policy = make_eviction_policy("s3fifo");
+    for (entry_id_t id = 0; id < 20; ++id) {
+        policy->insert(id, 1000 + id);
+    }
+    // read once: moved to main
+    policy->access(0);
+    entry_id_t id;
+    ASSERT_TRUE(policy->evict(&id));
+    EXPECT_EQ(id, 1);
+    // key 1 comes back under a new id and skips the small queue
+    policy->insert(20, 1001);
+    std::vector<entry_id_t> order = drain(policy.get());
+    ASSERT_EQ(order.size(), 20);
+    EXPECT_EQ(order.back(), 20);
+}
+
+TEST(EvictorTest, PinnedEntriesAreNeverEvicted) {
+    Evictor evictor(make_eviction_policy("lru"));
+    entry_id_t a = evictor.add(10, 0, false);
+    evictor.add(11, 1, true);
+    entry_id_t c = evictor.add(12, 2, false);
+    evictor.access(a);
+    EXPECT_EQ(evictor.size(), 3);
+    EXPECT_EQ(evictor.pinned(), 1);
+
+    uint32_t handle;
+    ASSERT_TRUE(evictor.peek_victim(&handle));
+    EXPECT_EQ(handle, 12);
+    ASSERT_TRUE(evictor.next_victim(&handle));
+    EXPECT_EQ(handle, 12);
+    ASSERT_TRUE(evictor.next_victim(&handle));
+    EXPECT_EQ(handle, 10);
+    EXPECT_FALSE(evictor.next_victim(&handle));
+    EXPECT_EQ(evictor.evicted(), 2);
+    EXPECT_EQ(evictor.size(), 1);
+
+    // ids are reused
+    entry_id_t d = evictor.add(13, 3, false);
+    EXPECT_TRUE(d == a || d == c);
+}
+
+TEST(EvictorTest, MemoryPerEntry) {
+    for (const char *name : {"lru", "clock", "s3fifo"}) {
+        Evictor evictor(make_eviction_policy(name));
+        size_t empty = evictor.memory_usage();
+        for (uint32_t i = 0; i < 100000; ++i) {
+            evictor.add(i, i, false);
+        }
+        // a handle, the policy's links and, for S3-FIFO, a fingerprint
+        double per_entry = (double)(evictor.memory_usage() - empty) / evictor.size();
+        EXPECT_GE(per_entry, 12) << name;
+        EXPECT_LE(per_entry, 48) << name;
+    }
+}
+
+TEST(EvictionPolicyTest, PeekIsTheNextVictim) {
+    for (const char *name : {"lru", "clock", "s3fifo"}) {
+        auto policy = make_eviction_policy(name);
+        entry_id_t id;
+        EXPECT_FALSE(policy->peek(&id));
+        for (entry_id_t i = 0; i < 20; ++i) {
+            policy->insert(i, i);
+        }
+        // nothing was read, so nothing is spared
+        while (policy->size() > 0) {
+            entry_id_t peeked, victim;
+            ASSERT_TRUE(policy->peek(&peeked));
+            ASSERT_TRUE(policy->evict(&victim));
+            EXPECT_EQ(peeked, victim) << name;
+        }
+    }
+}
+
+TEST(FrequencySketchTest, EstimatesFollowCounts) {
+    FrequencySketch sketch(1024);
+    EXPECT_EQ(sketch.estimate(hash_key("never")), 0);
+    for (int i = 0; i < 5; ++i) {
+        sketch.increment(hash_key("hot"));
+    }
+    sketch.increment(hash_key("cold"));
+    // a count-min sketch never underestimates
+    EXPECT_GE(sketch.estimate(hash_key("hot")), 5);
+    EXPECT_GE(sketch.estimate(hash_key("cold")), 1);
+    EXPECT_GT(sketch.estimate(hash_key("hot")), sketch.estimate(hash_key("cold")));
+    // counters saturate
+    for (int i = 0; i < 20; ++i) {
+        sketch.increment(hash_key("hot"));
+    }
+    EXPECT_EQ(sketch.estimate(hash_key("hot")), 15);
+}
+
+TEST(FrequencySketchTest, OldCountsFade) {
+    FrequencySketch sketch(16);
+    for (int i = 0; i < 8; ++i) {
+        sketch.increment(hash_key("old"));
+    }
+    // 160 additions halve every counter
+    for (int i = 0; i < 160; ++i) {
+        sketch.increment(hash_key(std::to_string(i)));
+    }
+    EXPECT_LE(sketch.estimate(hash_key("old")), 7);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,260 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../kvindex.h"
+
+TEST(FlatIndexTest, InsertFindErase) {
+    FlatIndex<int> index;
+    EXPECT_EQ(index.find("a"), nullptr);
+    index.insert_or_assign("a", 1);
+    index.insert_or_assign("b", 2);
+    index.insert_or_assign("a", 3);
+    EXPECT_EQ(index.size(), 2);
+    EXPECT_EQ(*index.find("a"), 3);
+    EXPECT_EQ(index.count("b"), 1);
+    EXPECT_TRUE(index.erase("a"));
+    EXPECT_FALSE(index.erase("a"));
+    EXPECT_EQ(index.find("a"), nullptr);
+    EXPECT_EQ(index.size(), 1);
+}
+
+TEST(FlatIndexTest, DigestKeysAreInline) {
+    FlatIndex<int> index;
+    size_t table_bytes = index.memory_usage();
+    char digest[INLINE_KEY_SIZE] = {0};
+    for (int i = 0; i < 8; ++i) {
+        digest[i] = i;
+        index.insert_or_assign(KeyView(digest, sizeof(digest)), i);
+    }
+    EXPECT_EQ(index.memory_usage(), table_bytes);
+    EXPECT_EQ(*index.find(KeyView(digest, sizeof(digest))), 7);
+    // same prefix, one byte longer
+    std::string longer(digest, sizeof(digest));
+    longer.push_back('x');
+    EXPECT_EQ(index.find(longer), nullptr);
+    index.insert_or_assign(longer, 8);
+    // a longer key takes the first chunk of the arena
+    EXPECT_EQ(index.key_arena_bytes(), KEY_ARENA_CHUNK_SIZE);
+    EXPECT_EQ(index.memory_usage(), table_bytes + KEY_ARENA_CHUNK_SIZE);
+}
+
+TEST(KeyArenaTest, ChunksAreFreedWhenEmpty) {
+    KeyArena arena;
+    std::string key(KEY_ARENA_CHUNK_SIZE / 4, 'k');
+    std::vector<IndexKey> keys;
+    // two chunks of four keys and one key in a third
+    for (int i = 0; i < 9; ++i) {
+        keys.push_back(IndexKey(key, &arena));
+    }
+    EXPECT_EQ(arena.memory_usage(), 3 * KEY_ARENA_CHUNK_SIZE);
+    EXPECT_EQ(arena.live_bytes(), 9 * key.size());
+    EXPECT_EQ(keys[4].view(), KeyView(key));
+    // a chunk with one live key stays
+    for (int i = 0; i < 3; ++i) {
+        keys[i].release(&arena);
+    }
+    EXPECT_EQ(arena.memory_usage(), 3 * KEY_ARENA_CHUNK_SIZE);
+    keys[3].release(&arena);
+    EXPECT_EQ(arena.memory_usage(), 2 * KEY_ARENA_CHUNK_SIZE);
+    // the freed chunk is reused
+    keys[0] = IndexKey(std::string(KEY_ARENA_CHUNK_SIZE, 'x'), &arena);
+    EXPECT_EQ(arena.memory_usage(), 3 * KEY_ARENA_CHUNK_SIZE);
+    EXPECT_EQ(keys[0].view().size, KEY_ARENA_CHUNK_SIZE);
+}
+
+TEST(FlatIndexTest, LongKeysAreInterned) {
+    FlatIndex<int> index;
+    const int n = 100000;
+    std::string prefix(32, 'p');
+    for (int i = 0; i < n; ++i) {
+        index.insert_or_assign(prefix + std::to_string(i), i);
+    }
+    // the keys survived the migrations
+    for (int i = 0; i < n; i += 97) {
+        EXPECT_EQ(*index.find(prefix + std::to_string(i)), i);
+    }
+    EXPECT_LE(index.key_arena_bytes(), n * (prefix.size() + 5) + KEY_ARENA_CHUNK_SIZE);
+    for (int i = 0; i < n; ++i) {
+        index.erase(prefix + std::to_string(i));
+    }
+    // only the current chunk is kept
+    EXPECT_EQ(index.key_arena_bytes(), KEY_ARENA_CHUNK_SIZE);
+}
+
+TEST(FlatIndexTest, MatchesUnorderedMap) {
+    FlatIndex<std::string> index;
+    std::unordered_map<std::string, std::string> expected;
+    std::mt19937 rng(7);
+
+    for (int iter = 0; iter < 200000; ++iter) {
+        // short keys stay inline, long ones have a heap buffer
+        std::string key = std::to_string(rng() % 20000);
+        if (rng() % 4 == 0) {
+            key += std::string(20, 'x');
+        }
+        else if (rng() % 4 == 0) {
+            key.resize(INLINE_KEY_SIZE, '\0');
+        }
+        switch (rng() % 3) {
+            case 0:
+            case 1:
+                index.insert_or_assign(key, key + "v");
+                expected[key] = key + "v";
+                break;
+            case 2:
+                EXPECT_EQ(index.erase(key), expected.erase(key) == 1) << key;
+                break;
+        }
+        ASSERT_EQ(index.size(), expected.size());
+        // lookups are checked in the middle of incremental rehashes as well
+        std::string probe = std::to_string(rng() % 20000);
+        auto it = expected.find(probe);
+        std::string *value = index.find(probe);
+        ASSERT_EQ(value != nullptr, it != expected.end()) << probe;
+        if (value) {
+            EXPECT_EQ(*value, it->second);
+        }
+    }
+
+    size_t visited = 0;
+    index.for_each([&](KeyView key, std::string &value) {
+        EXPECT_EQ(expected.at(key.str()), value);
+        visited++;
+    });
+    EXPECT_EQ(visited, expected.size());
+}
+
+TEST(FlatIndexTest, GrowsIncrementally) {
+    FlatIndex<int> index;
+    bool seen_rehash = false;
+    for (int i = 0; i < 100000; ++i) {
+        index.insert_or_assign(std::to_string(i), i);
+        seen_rehash |= index.rehashing();
+    }
+    EXPECT_TRUE(seen_rehash);
+    for (int i = 0; i < 100000; ++i) {
+        ASSERT_NE(index.find(std::to_string(i)), nullptr);
+        EXPECT_EQ(*index.find(std::to_string(i)), i);
+    }
+}
+
+TEST(FlatIndexTest, FindBatchMatchesFind) {
+    FlatIndex<int> index;
+    std::vector<std::string> names;
+    bool seen_rehash = false;
+    for (int i = 0; i < 10000; ++i) {
+        index.insert_or_assign(std::to_string(i), i);
+        seen_rehash |= index.rehashing();
+        // half of the lookups miss, long keys too
+        names.push_back(std::to_string(i * 2));
+        names.push_back(std::string(40, 'k') + std::to_string(i));
+        if (i % 1000 == 999) {
+            std::vector<KeyView> keys(names.begin(), names.end());
+            std::vector<int *> found;
+            index.find_batch(keys, &found);
+            ASSERT_EQ(found.size(), keys.size());
+            for (size_t j = 0; j < keys.size(); ++j) {
+                EXPECT_EQ(found[j], index.find(keys[j]));
+            }
+        }
+    }
+    EXPECT_TRUE(seen_rehash);
+}
+
+TEST(FlatIndexTest, FindHashedByValue) {
+    FlatIndex<int> index;
+    std::string prefix(32, 'p');
+    for (int i = 0; i < 10000; ++i) {
+        index.insert_or_assign(prefix + std::to_string(i), i);
+        // entries are found in the middle of migrations too
+        if (i % 997 == 0) {
+            for (int j = 0; j <= i; j += 101) {
+                std::string key = prefix + std::to_string(j);
+                auto *slot =
+                    index.find_hashed(hash_key(key), [j](int value) { return value == j; });
+                ASSERT_NE(slot, nullptr);
+                EXPECT_EQ(slot->key.view(), KeyView(key));
+            }
+        }
+    }
+    std::string key = prefix + "5";
+    EXPECT_EQ(index.find_hashed(hash_key(key), [](int value) { return value == 6; }), nullptr);
+    index.erase(key);
+    EXPECT_EQ(index.find_hashed(hash_key(key), [](int value) { return value == 5; }), nullptr);
+}
+
+TEST(FlatIndexTest, SlicesVisitEveryEntryOnce) {
+    FlatIndex<int> index;
+    int n = 0;
+    // stop in the middle of a migration, old entries are visited too
+    while (n < 1000 || !index.rehashing()) {
+        index.insert_or_assign(std::to_string(n), n);
+        n++;
+    }
+    std::vector<int> seen(n, 0);
+    size_t cursor = 0;
+    int calls = 0;
+    bool more = true;
+    while (more) {
+        more = index.for_each_slice(&cursor, 100, [&](KeyView key, int &value) {
+            EXPECT_EQ(key.str(), std::to_string(value));
+            seen[value]++;
+        });
+        calls++;
+    }
+    EXPECT_GT(calls, 1);
+    EXPECT_EQ(std::count(seen.begin(), seen.end(), 1), n);
+    EXPECT_FALSE(index.for_each_slice(&cursor, 100, [](KeyView key, int &value) {}));
+}
+
+// the size of the server's PTR index entry
+struct Entry16 {
+    uint64_t a;
+    uint64_t b;
+};
+static_assert(sizeof(Entry16) == 16, "PTR is 16 bytes");
+
+// bytes per key of n keys made by key(i), once the last migration is over
+template <typename F>
+static double bytes_per_key(size_t n, F key) {
+    FlatIndex<Entry16> index;
+    for (size_t i = 0; i < n; ++i) {
+        index.insert_or_assign(key(i), Entry16{i, i});
+    }
+    while (index.rehashing()) {
+        index.erase("missing");
+    }
+    return (double)index.memory_usage() / index.size();
+}
+
+// 100M / 128 keys give the same load as 100M keys: 0.745 of a power of two
+// table. memory_usage() counts the key arena too.
+TEST(FlatIndexTest, MemoryPerKey) {
+    const size_t n = 100000000 / 128;
+    // 16 byte digests are inline: (40 + 1) / 0.745 = 55 bytes
+    EXPECT_LE(bytes_per_key(n, [](size_t i) {
+                  char digest[16] = {0};
+                  uint64_t h = hash_mix(i + 1);
+                  memcpy(digest, &h, sizeof(h));
+                  memcpy(digest + 8, &i, sizeof(i));
+                  return std::string(digest, sizeof(digest));
+              }),
+              56);
+    // string keys of 40 bytes are interned: 40 more bytes each in the arena
+    EXPECT_LE(bytes_per_key(n, [](size_t i) {
+                  std::string key = "llama-70b/layer-00/block-" + std::to_string(1000000 + i);
+                  key.resize(40, '#');
+                  return key;
+              }),
+              56 + 40 + 1);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include "../lease.h"
+
+TEST(LeaseTableTest, ReleaseUnpins) {
+    LeaseTable leases(1000);
+    uint64_t a = leases.grant({1, 2}, 0);
+    uint64_t b = leases.grant({2, 3}, 0);
+    EXPECT_NE(a, 0);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(leases.pinned_values(), 3);
+
+    EXPECT_TRUE(leases.release(a));
+    EXPECT_FALSE(leases.pinned(1));
+    // still covered by b
+    EXPECT_TRUE(leases.pinned(2));
+    EXPECT_FALSE(leases.release(a));
+
+    EXPECT_TRUE(leases.release(b));
+    EXPECT_EQ(leases.pinned_values(), 0);
+    EXPECT_EQ(leases.size(), 0);
+}
+
+TEST(LeaseTableTest, Expire) {
+    LeaseTable leases(1000);
+    uint64_t a = leases.grant({1}, 0);
+    uint64_t b = leases.grant({2}, 500);
+    uint64_t c = leases.grant({3}, 600);
+    leases.release(b);
+
+    EXPECT_EQ(leases.expire(999), 0);
+    EXPECT_EQ(leases.expire(1000), 1);
+    EXPECT_FALSE(leases.pinned(1));
+    EXPECT_TRUE(leases.pinned(3));
+    // the released lease is not counted
+    EXPECT_EQ(leases.expire(2000), 1);
+    EXPECT_EQ(leases.expired(), 2);
+    EXPECT_EQ(leases.size(), 0);
+    // too late
+    EXPECT_FALSE(leases.release(a));
+    EXPECT_FALSE(leases.release(c));
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
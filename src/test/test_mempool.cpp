@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../log.h"
+#include "../mempool.h"
+
+#define BLOCK_SIZE (4 << 10)
+
+static const pool_options_t host_options = {
+    .hugepage_size = 0, .numa_nodes = {}, .host_only = true};
+
+TEST(MemoryPoolTest, DoubleFreeOfSingleBlock) {
+    MemoryPool pool(256 * BLOCK_SIZE, BLOCK_SIZE, NULL, host_options);
+    ASSERT_TRUE(pool.is_ready());
+    void *ptr = pool.allocate(BLOCK_SIZE);
+    ASSERT_NE(ptr, nullptr);
+    pool.deallocate(ptr, BLOCK_SIZE);
+    // the block sits in a magazine now, the second free is rejected
+    pool.deallocate(ptr, BLOCK_SIZE);
+    EXPECT_EQ(pool.get_free_blocks(), pool.get_total_blocks());
+    // the block is handed out once only
+    void *a = pool.allocate(BLOCK_SIZE);
+    void *b = pool.allocate(BLOCK_SIZE);
+    EXPECT_NE(a, b);
+    pool.deallocate(a, BLOCK_SIZE);
+    pool.deallocate(b, BLOCK_SIZE);
+    EXPECT_TRUE(pool.is_empty());
+}
+
+TEST(MemoryPoolTest, FreeOfBlockNeverAllocated) {
+    MemoryPool pool(256 * BLOCK_SIZE, BLOCK_SIZE, NULL, host_options);
+    ASSERT_TRUE(pool.is_ready());
+    char *base = (char *)pool.get_base();
+    pool.deallocate(base + 3 * BLOCK_SIZE, BLOCK_SIZE);
+    pool.deallocate(base + 8 * BLOCK_SIZE, 2 * BLOCK_SIZE);
+    EXPECT_EQ(pool.get_free_blocks(), pool.get_total_blocks());
+    pool.flush_magazines();
+    EXPECT_EQ(pool.get_fragmentation(), 0);
+}
+
+TEST(MemoryPoolTest, ConcurrentThreadsNeverShareBlocks) {
+    MemoryPool pool(1024 * BLOCK_SIZE, BLOCK_SIZE, NULL, host_options);
+    ASSERT_TRUE(pool.is_ready());
+    // owners[i]: number of live allocations holding block i, never above 1
+    std::vector<std::atomic<int>> owners(pool.get_total_blocks());
+    std::atomic<bool> shared{false};
+    auto run = [&](int seed) {
+        struct value_t {
+            char *ptr;
+            size_t blocks;
+        };
+        std::mt19937 rng(seed);
+        std::vector<value_t> window(16, value_t{nullptr, 0});
+        for (int i = 0; i < 20000; ++i) {
+            value_t &slot = window[rng() % window.size()];
+            if (slot.ptr) {
+                size_t first = (slot.ptr - (char *)pool.get_base()) / BLOCK_SIZE;
+                for (size_t b = first; b < first + slot.blocks; ++b) {
+                    owners[b].fetch_sub(1);
+                }
+                pool.deallocate(slot.ptr, slot.blocks * BLOCK_SIZE);
+            }
+            // mostly single blocks, which go through the magazines
+            slot.blocks = rng() % 4 == 0 ? 1 + rng() % 3 : 1;
+            slot.ptr = (char *)pool.allocate(slot.blocks * BLOCK_SIZE);
+            if (!slot.ptr) {
+                continue;
+            }
+            size_t first = (slot.ptr - (char *)pool.get_base()) / BLOCK_SIZE;
+            for (size_t b = first; b < first + slot.blocks; ++b) {
+                if (owners[b].fetch_add(1) != 0) {
+                    shared = true;
+                }
+            }
+        }
+        for (auto &slot : window) {
+            if (slot.ptr) {
+                size_t first = (slot.ptr - (char *)pool.get_base()) / BLOCK_SIZE;
+                for (size_t b = first; b < first + slot.blocks; ++b) {
+                    owners[b].fetch_sub(1);
+                }
+                pool.deallocate(slot.ptr, slot.blocks * BLOCK_SIZE);
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back(run, i);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    EXPECT_FALSE(shared);
+    EXPECT_TRUE(pool.is_empty());
+    // every block came back to the bitmap exactly once
+    pool.flush_magazines();
+    EXPECT_EQ(pool.get_fragmentation(), 0);
+    EXPECT_EQ(pool.allocate(pool.get_total_blocks() * BLOCK_SIZE), pool.get_base());
+}
+
+// collect the slabs built in the background until the pools hold total bytes
+static bool wait_total_size(MM *mm, size_t total) {
+    for (int i = 0; i < 6000 && !mm->load_failed(); ++i) {
+        mm->collect_loaded();
+        if (mm->get_total_size() >= total) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+TEST(MMTest, AllocationLandsInSmallestFittingClass) {
+    std::vector<size_class_config_t> classes = {{.block_size = 64, .share = 50},
+                                                {.block_size = 4, .share = 50}};
+    MM mm(2 * SLAB_SIZE, 2 * SLAB_SIZE, classes, host_options, NULL);
+    mm.load_async(1, []() {});
+    ASSERT_TRUE(wait_total_size(&mm, 2 * SLAB_SIZE));
+
+    int small, large, other;
+    void *a = mm.allocate(3 << 10, &small);
+    ASSERT_NE(a, nullptr);
+    EXPECT_EQ(mm.get_used_size(), 4 << 10);
+    void *b = mm.allocate(10 << 10, &large);
+    ASSERT_NE(b, nullptr);
+    EXPECT_NE(small, large);
+    EXPECT_EQ(mm.get_used_size(), (4 << 10) + (64 << 10));
+    // larger than every block: runs of the largest blocks
+    void *c = mm.allocate(100 << 10, &other);
+    ASSERT_NE(c, nullptr);
+    EXPECT_EQ(other, large);
+    EXPECT_EQ(mm.get_used_size(), (4 << 10) + (64 << 10) + (128 << 10));
+
+    mm.deallocate(a, 3 << 10, small);
+    mm.deallocate(b, 10 << 10, large);
+    mm.deallocate(c, 100 << 10);
+    EXPECT_EQ(mm.get_used_size(), 0);
+}
+
+TEST(MMTest, RebalanceMovesIdleSlabToExhaustedClass) {
+    // 1 slab of 4 KB blocks, 2 slabs of 64 KB blocks, no room to grow
+    std::vector<size_class_config_t> classes = {{.block_size = 4, .share = 34},
+                                                {.block_size = 64, .share = 66}};
+    MM mm(3 * SLAB_SIZE, 3 * SLAB_SIZE, classes, host_options, NULL);
+    mm.load_async(1, []() {});
+    ASSERT_TRUE(wait_total_size(&mm, 3 * SLAB_SIZE));
+
+    std::vector<extent_t> full;
+    ASSERT_TRUE(mm.allocate_batch(4 << 10, SLAB_SIZE / (4 << 10), &full));
+    ASSERT_EQ(full.size(), 1);
+    int pool_idx;
+    void *ptr = mm.allocate(4 << 10, &pool_idx);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_NE(pool_idx, full[0].pool_idx);
+    // a 64 KB slab was reformatted, instead of falling back to a 64 KB block
+    EXPECT_EQ(mm.get_used_size(), SLAB_SIZE + (4 << 10));
+    // the 64 KB class keeps its last slab
+    int large;
+    void *value = mm.allocate(64 << 10, &large);
+    ASSERT_NE(value, nullptr);
+    EXPECT_NE(large, pool_idx);
+
+    mm.deallocate(value, 64 << 10, large);
+    mm.deallocate(ptr, 4 << 10, pool_idx);
+    mm.deallocate(full[0].ptr, full[0].stride * full[0].count, full[0].pool_idx);
+    EXPECT_EQ(mm.get_used_size(), 0);
+}
+
+TEST(MMTest, FailedBatchLeavesNothingAllocated) {
+    std::vector<size_class_config_t> classes = {{.block_size = 64, .share = 100}};
+    MM mm(SLAB_SIZE, SLAB_SIZE, classes, host_options, NULL);
+    mm.load_async(1, []() {});
+    ASSERT_TRUE(wait_total_size(&mm, SLAB_SIZE));
+
+    size_t capacity = SLAB_SIZE / (64 << 10);
+    std::vector<extent_t> extents;
+    // every value but the last one fits
+    EXPECT_FALSE(mm.allocate_batch(64 << 10, capacity + 1, &extents));
+    EXPECT_TRUE(extents.empty());
+    EXPECT_EQ(mm.get_used_size(), 0);
+    EXPECT_FALSE(mm.allocate_scattered(SLAB_SIZE + (64 << 10), &extents));
+    EXPECT_TRUE(extents.empty());
+    EXPECT_EQ(mm.get_used_size(), 0);
+
+    // the rolled back blocks can all be allocated again
+    ASSERT_TRUE(mm.allocate_batch(64 << 10, capacity, &extents));
+    EXPECT_EQ(mm.get_used_size(), SLAB_SIZE);
+    for (const auto &extent : extents) {
+        mm.deallocate(extent.ptr, extent.stride * extent.count, extent.pool_idx);
+    }
+    EXPECT_EQ(mm.get_used_size(), 0);
+}
+
+TEST(MMTest, GrowToCeilingAndShrinkBack) {
+    std::vector<size_class_config_t> classes = {{.block_size = 1024, .share = 100}};
+    MM mm(SLAB_SIZE, 2 * SLAB_SIZE, classes, host_options, NULL);
+    mm.load_async(1, []() {});
+    ASSERT_TRUE(wait_total_size(&mm, SLAB_SIZE));
+
+    // filling the slab asks for the next one in the background
+    int first, second, third;
+    void *a = mm.allocate(SLAB_SIZE, &first);
+    ASSERT_NE(a, nullptr);
+    ASSERT_TRUE(wait_total_size(&mm, 2 * SLAB_SIZE));
+    void *b = mm.allocate(SLAB_SIZE, &second);
+    ASSERT_NE(b, nullptr);
+    EXPECT_NE(first, second);
+    // at the ceiling: no slab is requested any more
+    EXPECT_EQ(mm.allocate(1 << 20, &third), nullptr);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(mm.collect_loaded(), 0);
+    EXPECT_EQ(mm.get_total_size(), 2 * SLAB_SIZE);
+
+    mm.deallocate(a, SLAB_SIZE, first);
+    mm.deallocate(b, SLAB_SIZE, second);
+    // a slab is released once it stayed empty over two calls
+    EXPECT_EQ(mm.shrink(), 0);
+    EXPECT_EQ(mm.shrink(), 1);
+    EXPECT_EQ(mm.get_total_size(), SLAB_SIZE);
+    // the initial slab is kept
+    EXPECT_EQ(mm.shrink(), 0);
+    EXPECT_EQ(mm.get_total_size(), SLAB_SIZE);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    set_log_level("warning");
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include "../namespace.h"
+
+TEST(NamespaceTableTest, OpenFindDrop) {
+    NamespaceTable table;
+    EXPECT_EQ(table.find(""), DEFAULT_NAMESPACE);
+    int a = table.open("a");
+    EXPECT_NE(a, DEFAULT_NAMESPACE);
+    EXPECT_EQ(table.open("a"), a);
+    EXPECT_EQ(table.find("a"), a);
+    EXPECT_EQ(table.size(), 2);
+
+    EXPECT_FALSE(table.drop(DEFAULT_NAMESPACE));
+    table.charge(a, 100);
+    EXPECT_TRUE(table.drop(a));
+    EXPECT_FALSE(table.drop(a));
+    EXPECT_EQ(table.find("a"), -1);
+    EXPECT_FALSE(table.live(a));
+    // the name is free at once, the id is not while bytes are charged to it
+    int a2 = table.open("a");
+    EXPECT_NE(a2, a);
+    EXPECT_EQ(table.used(a2), 0);
+    EXPECT_EQ(table.generation(a), 0);
+    table.uncharge(a, 100);
+    EXPECT_EQ(table.open("b"), a);
+    EXPECT_EQ(table.quota(a), 0);
+    // whoever still holds id a sees it was reused
+    EXPECT_EQ(table.generation(a), 1);
+}
+
+TEST(NamespaceTableTest, IdsRunOut) {
+    NamespaceTable table;
+    for (int i = 1; i < MAX_NAMESPACES; ++i) {
+        EXPECT_EQ(table.open(std::to_string(i)), i);
+    }
+    EXPECT_EQ(table.open("full"), -1);
+    table.drop(7);
+    EXPECT_EQ(table.open("full"), 7);
+}
+
+TEST(NamespaceTableTest, Quota) {
+    NamespaceTable table;
+    int a = table.open("a");
+    EXPECT_FALSE(table.over_quota(a, 1UL << 40));
+    table.set_quota(a, 1000);
+    table.charge(a, 600);
+    EXPECT_FALSE(table.over_quota(a, 400));
+    EXPECT_TRUE(table.over_quota(a, 401));
+}
+
+TEST(NamespaceTableTest, VictimIsFurthestAboveQuota) {
+    NamespaceTable table;
+    int a = table.open("a"), b = table.open("b");
+    table.set_quota(a, 1000);
+    table.set_quota(b, 1000);
+    table.charge(a, 900);
+    table.charge(b, 500);
+    // everyone is within quota, the writer makes room in itself
+    EXPECT_EQ(table.victim(b), b);
+    // bytes without a quota count as above one
+    table.charge(DEFAULT_NAMESPACE, 50);
+    EXPECT_EQ(table.victim(b), DEFAULT_NAMESPACE);
+    table.charge(a, 200);
+    EXPECT_EQ(table.victim(b), a);
+    // a dropped namespace is not picked, its values are already going
+    table.drop(a);
+    EXPECT_EQ(table.victim(b), DEFAULT_NAMESPACE);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+#include "../prefix_tree.h"
+
+static std::vector<KeyView> views(const std::vector<std::string> &keys) {
+    return std::vector<KeyView>(keys.begin(), keys.end());
+}
+
+// keys[0] starts a sequence, every next key follows the one before
+static void insert_chain(PrefixTree *tree, const std::vector<std::string> &keys) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree->insert(keys[i], i == 0 ? KeyView("") : KeyView(keys[i - 1]));
+    }
+}
+
+TEST(PrefixTreeTest, LongestResidentPrefix) {
+    PrefixTree tree;
+    insert_chain(&tree, {"a", "b", "c", "d"});
+    EXPECT_EQ(tree.match(views({"a", "b", "c", "d", "e"})), 4);
+    EXPECT_EQ(tree.match(views({"x", "a"})), 0);
+    // a suffix of a sequence matches too
+    EXPECT_EQ(tree.match(views({"b", "c"})), 2);
+    // d is resident but does not follow b
+    EXPECT_EQ(tree.match(views({"a", "b", "d"})), 2);
+}
+
+TEST(PrefixTreeTest, MissingBlockInTheMiddle) {
+    PrefixTree tree;
+    insert_chain(&tree, {"a", "b", "c", "d"});
+    tree.remove("b");
+    // c and d are still stored, a binary search would report 3
+    EXPECT_EQ(tree.match(views({"a", "b", "c", "d"})), 1);
+    EXPECT_EQ(tree.size(), 4);
+    // written again, the blocks after it are reachable again
+    tree.insert("b", "a");
+    EXPECT_EQ(tree.match(views({"a", "b", "c", "d"})), 4);
+}
+
+TEST(PrefixTreeTest, RemovedLeavesArePruned) {
+    PrefixTree tree;
+    insert_chain(&tree, {"a", "b", "c"});
+    tree.remove("b");
+    tree.remove("c");
+    EXPECT_EQ(tree.size(), 1);
+    tree.remove("a");
+    EXPECT_EQ(tree.size(), 0);
+}
+
+TEST(PrefixTreeTest, SharedPrefixes) {
+    PrefixTree tree;
+    insert_chain(&tree, {"sys", "u1", "u2"});
+    tree.insert("v1", "sys");
+    tree.insert("v2", "v1");
+    EXPECT_EQ(tree.match(views({"sys", "v1", "v2"})), 3);
+    EXPECT_EQ(tree.match(views({"sys", "u1", "v2"})), 2);
+}
+
+TEST(PrefixTreeTest, DropSubtree) {
+    PrefixTree tree;
+    insert_chain(&tree, {"sys", "u1", "u2"});
+    tree.insert("v1", "sys");
+    tree.insert("v2", "v1");
+    tree.remove("v1");
+
+    std::vector<std::string> dropped;
+    tree.drop_subtree("v1", &dropped);
+    // v1 itself is not resident
+    EXPECT_EQ(dropped, std::vector<std::string>({"v2"}));
+    EXPECT_EQ(tree.match(views({"sys", "u1", "u2"})), 3);
+    EXPECT_EQ(tree.size(), 3);
+
+    dropped.clear();
+    tree.drop_subtree("sys", &dropped);
+    std::sort(dropped.begin(), dropped.end());
+    EXPECT_EQ(dropped, std::vector<std::string>({"sys", "u1", "u2"}));
+    EXPECT_EQ(tree.size(), 0);
+}
+
+TEST(PrefixTreeTest, MoveUnderNewParent) {
+    PrefixTree tree;
+    insert_chain(&tree, {"a", "b"});
+    // the parent is created as a placeholder
+    tree.insert("b", "p");
+    EXPECT_EQ(tree.match(views({"a", "b"})), 1);
+    EXPECT_EQ(tree.match(views({"p", "b"})), 0);
+    tree.insert("p", "");
+    EXPECT_EQ(tree.match(views({"p", "b"})), 2);
+    // a node can not move below itself
+    tree.insert("p", "b");
+    EXPECT_EQ(tree.match(views({"p", "b"})), 2);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -43,6 +43,32 @@ TEST_F(SerializationTest, DeserializeInvalidData) {
     EXPECT_FALSE(deserialize(invalid_data.data(), invalid_data.size(), deserialized_meta));
 }
 
+TEST(DigestKeysTest, PackedIntoOneBin) {
+    std::vector<std::string> keys = {std::string(DIGEST_SIZE, 'a'), std::string(DIGEST_SIZE, '\0')};
+    remote_meta_request req = {.keys = keys, .block_size = 4096};
+    ASSERT_TRUE(pack_digests(req.keys, req.digests));
+    req.keys.clear();
+
+    std::string serialized_data;
+    ASSERT_TRUE(serialize(req, serialized_data));
+    msgpack::object_handle oh = msgpack::unpack(serialized_data.data(), serialized_data.size());
+    msgpack::object digests = oh.get().via.array.ptr[3];
+    ASSERT_EQ(digests.type, msgpack::type::BIN);
+    ASSERT_EQ(digests.via.bin.size, 2 * DIGEST_SIZE);
+    EXPECT_EQ(std::string(digests.via.bin.ptr + DIGEST_SIZE, DIGEST_SIZE), keys[1]);
+
+    remote_meta_request out;
+    ASSERT_TRUE(deserialize(serialized_data.data(), serialized_data.size(), out));
+    EXPECT_TRUE(out.keys.empty());
+    EXPECT_EQ(out.digests, req.digests);
+}
+
+TEST(DigestKeysTest, MixedSizesStayStrings) {
+    std::vector<char> digests;
+    EXPECT_FALSE(pack_digests({std::string(DIGEST_SIZE, 'a'), "short"}, digests));
+    EXPECT_FALSE(pack_digests({}, digests));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../timer_wheel.h"
+
+static std::vector<uint32_t> advance(TimerWheel *wheel, uint64_t now) {
+    std::vector<uint32_t> expired;
+    wheel->advance(now, &expired);
+    std::sort(expired.begin(), expired.end());
+    return expired;
+}
+
+TEST(TimerWheelTest, ExpiresInOrder) {
+    TimerWheel wheel(8, 100, 1000);
+    wheel.add(1, 1250);
+    wheel.add(2, 1300);
+    wheel.add(3, 1299);
+    EXPECT_EQ(wheel.size(), 3);
+    EXPECT_TRUE(advance(&wheel, 1249).empty());
+    EXPECT_EQ(advance(&wheel, 1250), std::vector<uint32_t>({1}));
+    EXPECT_EQ(advance(&wheel, 1310), std::vector<uint32_t>({2, 3}));
+    EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheelTest, DeadlinesBeyondOneTurn) {
+    // one turn is 800 ms
+    TimerWheel wheel(8, 100, 0);
+    wheel.add(1, 2050);
+    wheel.add(2, 50);
+    EXPECT_EQ(advance(&wheel, 100), std::vector<uint32_t>({2}));
+    // the slot of id 1 comes by twice before it is due
+    EXPECT_TRUE(advance(&wheel, 1000).empty());
+    EXPECT_TRUE(advance(&wheel, 2000).empty());
+    EXPECT_EQ(advance(&wheel, 2050), std::vector<uint32_t>({1}));
+}
+
+TEST(TimerWheelTest, PastDeadlineFiresOnNextAdvance) {
+    TimerWheel wheel(8, 100, 0);
+    EXPECT_TRUE(advance(&wheel, 500).empty());
+    wheel.add(7, 200);
+    EXPECT_EQ(advance(&wheel, 500), std::vector<uint32_t>({7}));
+}
+
+TEST(TimerWheelTest, LongPause) {
+    TimerWheel wheel(8, 100, 0);
+    for (int i = 0; i < 100; ++i) {
+        wheel.add(i, i * 37);
+    }
+    // far more than one turn at once
+    EXPECT_EQ(advance(&wheel, 10000).size(), 100);
+    EXPECT_EQ(wheel.size(), 0);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,47 @@
+#include "timer_wheel.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+TimerWheel::TimerWheel(size_t slots, uint64_t tick_ms, uint64_t now)
+    : slots_(slots), tick_ms_(tick_ms), tick_(now / tick_ms) {
+    assert(slots > 0 && tick_ms > 0);
+}
+
+void TimerWheel::add(uint32_t id, uint64_t deadline) {
+    // a deadline in a tick already processed fires on the next advance
+    uint64_t tick = std::max(deadline / tick_ms_, tick_);
+    slots_[tick % slots_.size()].push_back({.deadline = deadline, .id = id});
+    size_++;
+}
+
+size_t TimerWheel::memory_usage() const {
+    size_t bytes = slots_.capacity() * sizeof(slots_[0]);
+    for (const auto &slot : slots_) {
+        bytes += slot.capacity() * sizeof(Timer);
+    }
+    return bytes;
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<uint32_t> *expired) {
+    uint64_t last = now / tick_ms_;
+    // after a full turn every slot has been looked at
+    uint64_t end = std::min(last + 1, tick_ + slots_.size());
+    for (; tick_ < end; ++tick_) {
+        std::vector<Timer> &slot = slots_[tick_ % slots_.size()];
+        size_t kept = 0;
+        for (size_t i = 0; i < slot.size(); ++i) {
+            if (slot[i].deadline <= now) {
+                expired->push_back(slot[i].id);
+                size_--;
+            }
+            else {
+                slot[kept++] = slot[i];
+            }
+        }
+        slot.resize(kept);
+    }
+    // the current tick is not over, its slot is looked at again next time
+    tick_ = last;
+}
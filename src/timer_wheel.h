@@ -0,0 +1,45 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/*
+TimerWheel holds the deadlines of ids (the server's value handles) in a ring
+of slots, one slot per tick. An id goes to the slot of its deadline's tick
+modulo the ring size, so adding is O(1) and advancing by one tick only looks
+at one slot. Deadlines more than a turn away stay in their slot until the
+turn they are due. An id may be added several times, and reused by the
+caller: the caller checks whether an expired id is still due. A timer is 16
+bytes. Not thread safe.
+*/
+class TimerWheel {
+   public:
+    /*
+    @brief slots * tick_ms is the span of one turn. now: the current time,
+    in the same unit as the deadlines (uv_now() milliseconds on the server).
+    */
+    TimerWheel(size_t slots, uint64_t tick_ms, uint64_t now);
+
+    void add(uint32_t id, uint64_t deadline);
+    // append the ids whose deadline is <= now and remove them from the wheel
+    void advance(uint64_t now, std::vector<uint32_t> *expired);
+
+    size_t size() const { return size_; }
+    size_t memory_usage() const;
+
+   private:
+    struct Timer {
+        uint64_t deadline;
+        uint32_t id;
+    };
+
+    std::vector<std::vector<Timer>> slots_;
+    uint64_t tick_ms_;
+    uint64_t tick_;  // first tick that may still hold due timers
+    size_t size_ = 0;
+};
+
+#endif  // TIMER_WHEEL_H
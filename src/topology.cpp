@@ -0,0 +1,114 @@
+#include "topology.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "ibv_helper.h"
+#include "log.h"
+
+#define NODE_SYSFS_DIR "/sys/devices/system/node"
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// parse a sysfs cpu/node list like "0-3,8,10-11"
+static std::vector<int> parse_list(const std::string &list) {
+    std::vector<int> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n == 1) {
+            last = first;
+        }
+        else if (n != 2) {
+            continue;
+        }
+        for (int i = first; i <= last; ++i) {
+            ids.push_back(i);
+        }
+    }
+    return ids;
+}
+
+static std::string read_line(const std::string &path) {
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+int get_device_numa_node(struct ibv_context *ctx) {
+    char buf[16];
+    if (ibv_read_sysfs_file(ctx->device->ibdev_path, "device/numa_node", buf, sizeof(buf)) <= 0) {
+        return -1;
+    }
+    // single node hosts report -1
+    return atoi(buf);
+}
+
+std::vector<int> get_numa_nodes() { return parse_list(read_line(NODE_SYSFS_DIR "/online")); }
+
+std::vector<int> get_node_cpus(int node) {
+    return parse_list(read_line(NODE_SYSFS_DIR "/node" + std::to_string(node) + "/cpulist"));
+}
+
+int bind_thread_to_node(int node) {
+    if (node < 0) {
+        return 0;
+    }
+    std::vector<int> cpus = get_node_cpus(node);
+    if (cpus.empty()) {
+        WARN("No cpus found on NUMA node {}", node);
+        return -1;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &cpuset);
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (ret) {
+        WARN("Failed to pin thread to NUMA node {}: {}", node, strerror(ret));
+        return -1;
+    }
+    DEBUG("thread pinned to {} cpus of NUMA node {}", cpus.size(), node);
+    return 0;
+}
+
+int set_thread_mem_node(int node) {
+    // raw syscall, so libnuma is not needed
+    unsigned long mask = 0;
+    long ret;
+    if (node < 0) {
+        ret = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    }
+    else {
+        if (node >= (int)(sizeof(mask) * 8)) {
+            WARN("NUMA node {} is out of range", node);
+            return -1;
+        }
+        mask = 1UL << node;
+        ret = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8);
+    }
+    if (ret) {
+        WARN("Failed to set memory policy for NUMA node {}: {}", node, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <infiniband/verbs.h>
+
+#include <vector>
+
+// NUMA node the RDMA device is attached to, -1 if unknown or not a NUMA host
+int get_device_numa_node(struct ibv_context *ctx);
+// online NUMA nodes
+std::vector<int> get_numa_nodes();
+// cpus that belong to a NUMA node
+std::vector<int> get_node_cpus(int node);
+
+/*
+@brief pin the calling thread to the cpus of node. Nothing is done for node -1.
+*/
+int bind_thread_to_node(int node);
+/*
+@brief make pages faulted by the calling thread prefer node. node -1 restores
+the default policy. The kernel falls back to other nodes when node is full.
+*/
+int set_thread_mem_node(int node);
+
+#endif  // TOPOLOGY_H